@@ -0,0 +1,558 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// A microbenchmark suite for the bit array operations, built separately from
+// the test harness by "make bench".
+//
+// Where the harness's -s/-m/-l modes time one run of one operation per tier,
+// this sweeps every operation over bit arrays from 1KB up to several GB, and
+// rotation also over the fraction of the bit array it shifts by.  Each point
+// is warmed up, then timed over repeated trials; it reports the median and the
+// 10th and 90th percentiles of the trials, and the rate at the median.
+//
+// A trial that would take under BENCH_MIN_TRIAL_SECONDS runs the operation
+// several times over, enough to be measured, and reports the time of one.
+// Trials are timed on the clock -c selects, process CPU time by default;
+// the median wall and CPU times are reported beside them either way.  With
+// -p, the hardware events of a run, averaged over the trials, follow.  With
+// -o json or -o csv, the points are written as records instead (see
+// results.h), which everybit -C can compare between runs.
+
+// We need _POSIX_C_SOURCE >= 2 to use getopt.
+#define _POSIX_C_SOURCE 200112L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "./bitarray.h"
+#include "./ktiming.h"
+#include "./results.h"
+
+
+// ********************************* Macros *********************************
+
+// The sizes swept, in bytes: from BENCH_MIN_BYTES up by a factor of
+// BENCH_SIZE_STEP, to the -M limit or BENCH_MAX_BYTES.
+#define BENCH_MIN_BYTES 1024
+#define BENCH_SIZE_STEP 4
+#define BENCH_MAX_BYTES (4ULL << 30)
+
+// Untimed runs before, and timed trials of, each point, unless -w or -r say
+// otherwise.
+#define BENCH_WARMUPS 3
+#define BENCH_TRIALS 15
+#define BENCH_MAX_TRIALS 1000
+
+// The shortest a trial may be; shorter operations are repeated within it.
+#define BENCH_MIN_TRIAL_SECONDS 0.001
+
+// Each run of an access operation makes this many gets or sets.
+#define BENCH_ACCESSES 65536
+
+
+// ********************************* Types **********************************
+
+// An operation to benchmark.  run performs it once on the whole bit array;
+// shift is the rotation amount for those that take one.  accesses is the
+// number of single-bit or single-word accesses a run makes, or 0 if it
+// streams over the whole bit array.
+typedef struct {
+  const char* name;
+  void (*run)(bitarray_t* const bitarray, const size_t shift);
+  size_t accesses;
+  bool shifts;
+} bench_op_t;
+
+// The timing of one point: seconds per run at the median and at the 10th and
+// 90th percentiles of the trials, the median wall and CPU times, and the
+// events of one run summed over the trials, if they are counted.
+typedef struct {
+  double median;
+  double p10;
+  double p90;
+  double wall;
+  double cpu;
+  ktiming_counts_t counts;
+} bench_result_t;
+
+
+// ******************************* Prototypes *******************************
+
+// Benchmarked operations.
+static void bench_get(bitarray_t* const bitarray, const size_t shift);
+static void bench_set(bitarray_t* const bitarray, const size_t shift);
+static void bench_get_u64(bitarray_t* const bitarray, const size_t shift);
+static void bench_set_u64(bitarray_t* const bitarray, const size_t shift);
+static void bench_reverse(bitarray_t* const bitarray, const size_t shift);
+static void bench_rotate(bitarray_t* const bitarray, const size_t shift);
+static void bench_fill(bitarray_t* const bitarray, const size_t shift);
+static void bench_randfill(bitarray_t* const bitarray, const size_t shift);
+
+// Returns the next number of a xorshift sequence, the random indices of the
+// access operations.
+static inline uint64_t bench_next(uint64_t* const state);
+
+// Times op on bitarray: warmups untimed runs, then trials timed ones.
+static bench_result_t bench_point(const bench_op_t* const op,
+                                  bitarray_t* const bitarray,
+                                  const size_t shift,
+                                  const size_t warmups,
+                                  const size_t trials);
+
+// Returns the q-th quantile, 0 <= q <= 1, of the n sorted samples,
+// interpolating between the two nearest.
+static double quantile(const double* const sorted, const size_t n, const double q);
+
+// Orders doubles, for qsort.
+static int compare_doubles(const void* const a, const void* const b);
+
+// Parses a byte count with an optional K, M or G suffix.  Returns 0 if text
+// is not one.
+static size_t parse_bytes(const char* const text);
+
+// Formats a byte count as B, KB, MB or GB into buf.
+static void format_bytes(char* const buf, const size_t buf_sz, const size_t bytes);
+
+// Prints the rows of op for one size.
+static void bench_op_at_size(const bench_op_t* const op,
+                             bitarray_t* const bitarray,
+                             const size_t warmups,
+                             const size_t trials);
+
+void print_usage(const char* const argv_0);
+
+
+// ******************************** Globals *********************************
+
+static const bench_op_t bench_ops[] = {
+  {"get", bench_get, BENCH_ACCESSES, false},
+  {"set", bench_set, BENCH_ACCESSES, false},
+  {"getu64", bench_get_u64, BENCH_ACCESSES, false},
+  {"setu64", bench_set_u64, BENCH_ACCESSES, false},
+  {"reverse", bench_reverse, 0, false},
+  {"rotate", bench_rotate, 0, true},
+  {"fill", bench_fill, 0, false},
+  {"randfill", bench_randfill, 0, false},
+};
+
+// The rotations, as fractions of the bit array; 0 stands for a shift of one
+// bit.
+static const double bench_shift_ratios[] = {0, 0.001, 0.125, 1.0 / 3, 0.5};
+
+// Where the benchmarked reads go, so that they are not optimized away.
+static volatile uint64_t bench_sink;
+
+// Counts calls to the fills, so that each one writes something new.
+static uint64_t bench_calls;
+
+// Whether hardware events are counted around each trial.
+static bool bench_counting = false;
+
+
+// ******************************* Functions ********************************
+
+int main(int argc, char** argv) {
+  // Parse options.
+  int optchar;
+  opterr = 0;
+  const char* selected_op = NULL;
+  size_t max_bytes = BENCH_MAX_BYTES;
+  size_t warmups = BENCH_WARMUPS;
+  size_t trials = BENCH_TRIALS;
+  results_format_t format = RESULTS_TEXT;
+  while ((optchar = getopt(argc, argv, "b:M:w:r:c:po:h")) != -1) {
+    switch (optchar) {
+    case 'b':
+      selected_op = optarg;
+      break;
+    case 'M':
+      max_bytes = parse_bytes(optarg);
+      if (max_bytes < BENCH_MIN_BYTES) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'w':
+      warmups = strtoul(optarg, NULL, 10);
+      break;
+    case 'r':
+      trials = strtoul(optarg, NULL, 10);
+      if (trials == 0 || trials > BENCH_MAX_TRIALS) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'c':
+      {
+        ktiming_clock_t clock;
+        if (!ktiming_clock_from_name(optarg, &clock) || !ktiming_set_clock(clock)) {
+          fprintf(stderr, "Clock %s is not available\n", optarg);
+          return EXIT_FAILURE;
+        }
+      }
+      break;
+    case 'o':
+      if (!results_format_from_name(optarg, &format)) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'p':
+      bench_counting = ktiming_counters_open() > 0;
+      if (!bench_counting) {
+        fprintf(stderr, "No hardware performance counters are available; "
+                "timing without them\n");
+      }
+      break;
+    default:
+      print_usage(argv[0]);
+      return optchar == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  const size_t nops = sizeof(bench_ops) / sizeof(bench_ops[0]);
+  bool found = selected_op == NULL;
+  for (size_t i = 0; i < nops; i++) {
+    found = found || strcmp(bench_ops[i].name, selected_op) == 0;
+  }
+  if (!found) {
+    fprintf(stderr, "Unknown operation %s\n", selected_op);
+    return EXIT_FAILURE;
+  }
+
+  // Stay within half of physical memory, where it is known, rather than let
+  // the largest sizes swap.
+#ifdef _SC_PHYS_PAGES
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0 && max_bytes > (size_t)pages / 2 * page_size) {
+    max_bytes = (size_t)pages / 2 * page_size;
+  }
+#endif
+
+  if (format != RESULTS_TEXT) {
+    results_begin(stdout, format, "everybit-bench", trials);
+  } else {
+    printf("# times on the %s clock", ktiming_clock_name(ktiming_get_clock()));
+    if (ktiming_get_clock() == KTIMING_CYCLES) {
+      printf(", %.3f cycles/ns", ktiming_cycles_per_nsec());
+    }
+    printf("\n%-9s %7s %7s %12s %12s %12s %14s %12s %12s",
+           "op", "size", "shift", "median", "p10", "p90", "rate", "wall", "cpu");
+    for (int event = 0; bench_counting && event < KTIMING_NEVENTS; event++) {
+      printf(" %12s", ktiming_event_name(event));
+    }
+    printf("\n");
+  }
+  for (size_t bytes = BENCH_MIN_BYTES; bytes <= max_bytes; bytes *= BENCH_SIZE_STEP) {
+    bitarray_t* const bitarray = bitarray_new(bytes * 8);
+    if (bitarray == NULL) {
+      fprintf(stderr, "Stopping: out of memory for %zu bytes\n", bytes);
+      break;
+    }
+    for (size_t i = 0; i < nops; i++) {
+      if (selected_op == NULL || strcmp(bench_ops[i].name, selected_op) == 0) {
+        bitarray_randfill(bitarray, bytes);
+        bench_op_at_size(&bench_ops[i], bitarray, warmups, trials);
+      }
+    }
+    bitarray_free(bitarray);
+  }
+  results_end();
+  return EXIT_SUCCESS;
+}
+
+void print_usage(const char* const argv_0) {
+  fprintf(stderr, "usage: %s [-b op] [-M bytes] [-w warmups] [-r trials] [-c clock] [-p]\n"
+          "\t    [-o format]\n"
+          "\t -b rotate\tBenchmark only rotate (operations: get, set, getu64,\n"
+          "\t    setu64, reverse, rotate, fill, randfill); by default, all of them\n"
+          "\t -M 256M\tSweep sizes from 1KB up to 256MB (K, M or G; default 4G,\n"
+          "\t    or half of physical memory if less)\n"
+          "\t -w 3\tRun each point 3 times untimed first\n"
+          "\t -r 15\tTime each point over 15 trials\n"
+          "\t -c wall\tTime trials on the wall clock (clocks: cpu, the default,\n"
+          "\t    wall, thread, cycles)\n"
+          "\t -p\tAlso count the cycles, instructions, cache and TLB misses, loads\n"
+          "\t    and stores of a run, where perf_event_open allows\n"
+          "\t -o json\tWrite the points as JSON or CSV records (formats: text,\n"
+          "\t    json, csv), which everybit -C old new compares\n",
+          argv_0);
+}
+
+static void bench_op_at_size(const bench_op_t* const op,
+                             bitarray_t* const bitarray,
+                             const size_t warmups,
+                             const size_t trials) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  char size[16];
+  format_bytes(size, sizeof(size), bit_sz / 8);
+
+  const size_t nratios = op->shifts
+      ? sizeof(bench_shift_ratios) / sizeof(bench_shift_ratios[0]) : 1;
+  for (size_t i = 0; i < nratios; i++) {
+    const double ratio = bench_shift_ratios[i];
+    const size_t shift = ratio * bit_sz >= 1 ? (size_t)(ratio * bit_sz) : 1;
+    const bench_result_t result = bench_point(op, bitarray, shift, warmups, trials);
+
+    char shift_text[16];
+    if (!op->shifts) {
+      snprintf(shift_text, sizeof(shift_text), "-");
+    } else if (ratio == 0) {
+      snprintf(shift_text, sizeof(shift_text), "1 bit");
+    } else {
+      snprintf(shift_text, sizeof(shift_text), "%.3f", ratio);
+    }
+
+    const char* const unit = op->accesses > 0 ? "Mop/s" : "GB/s";
+    double rate_value = 0;
+    if (result.median > 0) {
+      rate_value = op->accesses > 0
+          ? op->accesses / result.median / 1e6
+          : bit_sz / 8 / result.median / 1e9;
+    }
+
+    if (results_active()) {
+      ktiming_counts_t per_run = result.counts;
+      for (int event = 0; event < KTIMING_NEVENTS; event++) {
+        per_run.count[event] /= trials;
+      }
+      const results_record_t record = {
+        op->name, -1, bit_sz / 8, op->shifts ? shift : 0,
+        result.median, result.p10, result.p90, result.wall, result.cpu,
+        rate_value, unit, true, bench_counting ? &per_run : NULL
+      };
+      results_write(&record);
+      continue;
+    }
+
+    char rate[32];
+    if (result.median <= 0) {
+      snprintf(rate, sizeof(rate), "-");
+    } else {
+      snprintf(rate, sizeof(rate), "%.2f %s", rate_value, unit);
+    }
+    printf("%-9s %7s %7s %10.3fus %10.3fus %10.3fus %14s %10.3fus %10.3fus",
+           op->name, size, shift_text, result.median * 1e6, result.p10 * 1e6,
+           result.p90 * 1e6, rate, result.wall * 1e6, result.cpu * 1e6);
+    for (int event = 0; bench_counting && event < KTIMING_NEVENTS; event++) {
+      if (result.counts.counted[event]) {
+        printf(" %12.4g", (double)result.counts.count[event] / trials);
+      } else {
+        printf(" %12s", "-");
+      }
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+}
+
+static bench_result_t bench_point(const bench_op_t* const op,
+                                  bitarray_t* const bitarray,
+                                  const size_t shift,
+                                  const size_t warmups,
+                                  const size_t trials) {
+  // Find how many runs make a trial long enough to measure; these runs warm
+  // up the caches and TLB along the way.
+  size_t runs = 1;
+  for (;;) {
+    const clockmark_t start = ktiming_getmark();
+    for (size_t r = 0; r < runs; r++) {
+      op->run(bitarray, shift);
+    }
+    const clockmark_t end = ktiming_getmark();
+    if (ktiming_diff_usec(&start, &end) / 1e9 >= BENCH_MIN_TRIAL_SECONDS) {
+      break;
+    }
+    runs *= 2;
+  }
+
+  for (size_t w = 0; w < warmups; w++) {
+    for (size_t r = 0; r < runs; r++) {
+      op->run(bitarray, shift);
+    }
+  }
+
+  double samples[BENCH_MAX_TRIALS];
+  double wall_samples[BENCH_MAX_TRIALS];
+  double cpu_samples[BENCH_MAX_TRIALS];
+  assert(trials > 0 && trials <= BENCH_MAX_TRIALS);
+  bench_result_t result;
+  memset(&result.counts, 0, sizeof(result.counts));
+  for (size_t t = 0; t < trials; t++) {
+    if (bench_counting) {
+      ktiming_counters_start();
+    }
+    const clockmark_t start_wall = ktiming_getmark_clock(KTIMING_WALL);
+    const clockmark_t start_cpu = ktiming_getmark_clock(KTIMING_CPU);
+    const clockmark_t start = ktiming_getmark();
+    for (size_t r = 0; r < runs; r++) {
+      op->run(bitarray, shift);
+    }
+    const clockmark_t end = ktiming_getmark();
+    const clockmark_t end_cpu = ktiming_getmark_clock(KTIMING_CPU);
+    const clockmark_t end_wall = ktiming_getmark_clock(KTIMING_WALL);
+    if (bench_counting) {
+      // Sum the counts of one run of each trial.
+      ktiming_counts_t counts;
+      ktiming_counters_stop(&counts);
+      for (int event = 0; event < KTIMING_NEVENTS; event++) {
+        result.counts.count[event] += counts.count[event] / runs;
+        result.counts.counted[event] = counts.counted[event];
+      }
+    }
+    samples[t] = ktiming_diff_usec(&start, &end) / 1e9 / runs;
+    wall_samples[t] = ktiming_diff_usec(&start_wall, &end_wall) / 1e9 / runs;
+    cpu_samples[t] = ktiming_diff_usec(&start_cpu, &end_cpu) / 1e9 / runs;
+  }
+  qsort(samples, trials, sizeof(double), compare_doubles);
+  qsort(wall_samples, trials, sizeof(double), compare_doubles);
+  qsort(cpu_samples, trials, sizeof(double), compare_doubles);
+
+  result.median = quantile(samples, trials, 0.5);
+  result.p10 = quantile(samples, trials, 0.1);
+  result.p90 = quantile(samples, trials, 0.9);
+  result.wall = quantile(wall_samples, trials, 0.5);
+  result.cpu = quantile(cpu_samples, trials, 0.5);
+  return result;
+}
+
+static double quantile(const double* const sorted, const size_t n, const double q) {
+  assert(n > 0);
+  const double position = q * (n - 1);
+  const size_t below = (size_t)position;
+  if (below + 1 >= n) {
+    return sorted[n - 1];
+  }
+  return sorted[below] + (position - below) * (sorted[below + 1] - sorted[below]);
+}
+
+static int compare_doubles(const void* const a, const void* const b) {
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static size_t parse_bytes(const char* const text) {
+  char* end;
+  const unsigned long long value = strtoull(text, &end, 10);
+  if (end == text) {
+    return 0;
+  }
+  switch (*end) {
+  case '\0':
+    return value;
+  case 'K':
+  case 'k':
+    return end[1] == '\0' ? value << 10 : 0;
+  case 'M':
+  case 'm':
+    return end[1] == '\0' ? value << 20 : 0;
+  case 'G':
+  case 'g':
+    return end[1] == '\0' ? value << 30 : 0;
+  default:
+    return 0;
+  }
+}
+
+static void format_bytes(char* const buf, const size_t buf_sz, const size_t bytes) {
+  if (bytes < 1024) {
+    snprintf(buf, buf_sz, "%zuB", bytes);
+  } else if (bytes < 1024 * 1024) {
+    snprintf(buf, buf_sz, "%zuKB", bytes / 1024);
+  } else if (bytes < 1024 * 1024 * 1024) {
+    snprintf(buf, buf_sz, "%zuMB", bytes / (1024 * 1024));
+  } else {
+    snprintf(buf, buf_sz, "%zuGB", bytes / (1024UL * 1024 * 1024));
+  }
+}
+
+inline static uint64_t bench_next(uint64_t* const state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+static void bench_get(bitarray_t* const bitarray, const size_t shift) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  uint64_t state = 88172645463325252ULL;
+  size_t hits = 0;
+  for (size_t i = 0; i < BENCH_ACCESSES; i++) {
+    hits += bitarray_get(bitarray, bench_next(&state) % bit_sz);
+  }
+  bench_sink += hits;
+}
+
+static void bench_set(bitarray_t* const bitarray, const size_t shift) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t i = 0; i < BENCH_ACCESSES; i++) {
+    const uint64_t x = bench_next(&state);
+    bitarray_set(bitarray, x % bit_sz, x >> 63);
+  }
+}
+
+static void bench_get_u64(bitarray_t* const bitarray, const size_t shift) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  uint64_t state = 88172645463325252ULL;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < BENCH_ACCESSES; i++) {
+    sum += bitarray_get_u64(bitarray, bench_next(&state) % (bit_sz - 63));
+  }
+  bench_sink += sum;
+}
+
+static void bench_set_u64(bitarray_t* const bitarray, const size_t shift) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  uint64_t state = 88172645463325252ULL;
+  for (size_t i = 0; i < BENCH_ACCESSES; i++) {
+    const uint64_t x = bench_next(&state);
+    bitarray_set_u64(bitarray, x % (bit_sz - 63), x);
+  }
+}
+
+static void bench_reverse(bitarray_t* const bitarray, const size_t shift) {
+  bitarray_reverse(bitarray, 0, bitarray_get_bit_sz(bitarray));
+}
+
+static void bench_rotate(bitarray_t* const bitarray, const size_t shift) {
+  bitarray_rotate(bitarray, 0, bitarray_get_bit_sz(bitarray), shift);
+}
+
+static void bench_fill(bitarray_t* const bitarray, const size_t shift) {
+  bitarray_fill_range(bitarray, 0, bitarray_get_bit_sz(bitarray), ++bench_calls & 1);
+}
+
+static void bench_randfill(bitarray_t* const bitarray, const size_t shift) {
+  bitarray_randfill(bitarray, ++bench_calls);
+}
@@ -25,18 +25,159 @@
 // memory.
 
 
+// mremap is a Linux extension.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "./bitarray.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// ********************************* Macros *********************************
+
+// Number of bits in a storage word.
+#define WORD_BITS BITARRAY_WORD_BITS
+
+// Ranges touching at least this many bytes are filled by several threads;
+// below it, the cost of spawning threads outweighs the extra bandwidth.
+#define PARALLEL_THRESHOLD_BYTES (32UL * 1024 * 1024)
+
+// Upper bound on the number of worker threads used by the parallel paths.
+#define MAX_THREADS 16
+
+// Runs of at least this many whole words are counted with the vector kernel
+// picked by CPU dispatch; shorter runs stay on the scalar popcount loop.
+#define SIMD_COUNT_MIN_WORDS 64
+
+// Scans only hand off to the vector zero-skip once this many words in a row
+// have been uninteresting; most sparse gaps end sooner than that.
+#define SIMD_SKIP_MIN_WORDS 16
+
+
+// Words compared per step when looking for the first difference between two
+// subarrays; the XORs within a step are ORed together, which vectorizes.
+#define COMPARE_BLOCK_WORDS 8
+
+// The random fill's counter steps by RANDFILL_GAMMA, the golden ratio in
+// fixed point, and each step goes through SplitMix64's finalizer, which
+// multiplies by RANDFILL_MIX1 and RANDFILL_MIX2.
+#define RANDFILL_GAMMA 0x9e3779b97f4a7c15ULL
+#define RANDFILL_MIX1 0xbf58476d1ce4e5b9ULL
+#define RANDFILL_MIX2 0x94d049bb133111ebULL
+
+// Densities are fixed-point fractions of 2^DENSITY_BITS.  Each bit of the
+// fraction costs one random word per word filled.
+#define DENSITY_BITS 32
+
+// Multipliers of the range hash, the primes of xxHash64.
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+#define HASH_PRIME4 0x85ebca77c2b2ae63ULL
+
+// Bit arrays of up to SMALL_BITS bits keep their bits in SMALL_WORDS words
+// inside the struct, slack word included, instead of in a buffer of their
+// own.
+#define SMALL_BITS 256
+#define SMALL_WORDS (SMALL_BITS / 64 + 1)
+
+// Buffers of at least this many bytes are mapped directly with mmap, so that
+// growing them can remap pages (mremap on Linux) instead of copying.
+// Smaller ones come from malloc.
+#define MMAP_THRESHOLD_BYTES (1UL * 1024 * 1024)
 
+// The binary format's magic string, version and flags.  A set
+// FILE_FLAG_CHECKSUM says the header's checksum covers the bits; readers
+// reject flags they do not know.
+#define FILE_MAGIC "EVRYBIT"
+#define FILE_VERSION 1
+#define FILE_FLAG_CHECKSUM 0x1
+
+// Text conversion works on eight characters as one 64-bit word.  XORing
+// with TEXT_ZEROS turns '0' and '1' into the bytes 0 and 1, and multiplying
+// by TEXT_GATHER collects the low bit of byte i into bit 56 + i.
+#define TEXT_ZEROS 0x3030303030303030ULL
+#define TEXT_LOW_BITS 0x0101010101010101ULL
+#define TEXT_GATHER 0x0102040810204080ULL
+
+// Byte i of TEXT_SPREAD_MASK keeps bit i of a byte copied into every byte.
+#define TEXT_SPREAD_MASK 0x8040201008040201ULL
+
+// Snapshots share a bit array's storage in chunks of this many bytes, a
+// page; the first write to a chunk after a snapshot copies it out.
+#define SNAPSHOT_CHUNK_BYTES 4096
+
+// The states of a chunk in a snapshot: still shared with the bit array,
+// being copied out by a writer, and copied.
+#define CHUNK_SHARED 0
+#define CHUNK_COPYING 1
+#define CHUNK_COPIED 2
+
+// Arenas carve blocks, in multiples of ARENA_ALIGN bytes, out of chunks of
+// ARENA_CHUNK_BYTES.  A block of more than a quarter of that gets a chunk of
+// its own.  Freed blocks of up to ARENA_MAX_RECYCLED bytes are kept on
+// free lists, one per size, for reuse.
+#define ARENA_CHUNK_BYTES (64 * 1024)
+#define ARENA_ALIGN 16
+#define ARENA_MAX_RECYCLED 1024
 
 // ********************************* Types **********************************
 
+// Storage that snapshots share with a bit array.  Once the bit array's
+// storage moves (it is resized or freed) the old storage is retired: it is
+// recorded here, never written again, and freed with the last snapshot.
+typedef struct {
+  size_t refs;
+  bool retired;
+  char* buf;
+  size_t capacity;
+  bool mapped;
+  char* file_map;
+  size_t file_map_bytes;
+  // Whether buf belongs to an arena, which frees it instead.
+  bool borrowed;
+} shared_storage_t;
+
+// The header of a chunk of an arena, allocated with buf_alloc.  Blocks
+// follow it.
+typedef struct arena_chunk {
+  struct arena_chunk* next;
+  size_t bytes;
+  bool mapped;
+} arena_chunk_t;
+
+// Concrete data type representing an arena.
+struct bitarray_arena {
+  // Every chunk, newest first.  New blocks come from [next, end), the
+  // unused tail of the chunk being carved up.
+  arena_chunk_t* chunks;
+  char* next;
+  char* end;
+
+  // Freed blocks of each size in ARENA_ALIGN units, each block holding a
+  // pointer to the next in its first bytes.
+  char* free_blocks[ARENA_MAX_RECYCLED / ARENA_ALIGN + 1];
+};
+
 // Concrete data type representing an array of bits.
 struct bitarray {
   // The number of bits represented by this bit array.
@@ -44,10 +185,113 @@ struct bitarray {
   size_t bit_sz;
 
   // The underlying memory buffer that stores the bits in
-  // packed form (8 per byte).
+  // packed form (8 per byte).  It is padded to a whole number of 64-bit
+  // words plus one extra word, so word-sized loads and stores near the end
+  // of the array never leave the allocation.
   char* buf;
+
+  // The storage of a small bit array, which buf points to until it grows
+  // past SMALL_BITS bits.  It sits next to bit_sz and buf so that reading a
+  // bit touches a single cache line.
+  uint64_t small[SMALL_WORDS];
+
+  // The size of buf in bytes, at least enough for bit_sz bits.  Appends
+  // grow it geometrically.
+  size_t capacity;
+
+  // Whether buf was mapped with mmap rather than allocated with malloc.
+  bool mapped;
+
+  // For a bit array mapped from a file by bitarray_map, the whole mapping,
+  // of which buf is the payload past the header; NULL otherwise.
+  char* file_map;
+  size_t file_map_bytes;
+
+  // The snapshots still sharing buf, as a doubly linked list, and the record
+  // they share it through; both NULL when there are none.  shared[c] is
+  // cleared once every snapshot has its own copy of chunk c.
+  bitarray_snapshot_t* snapshots;
+  shared_storage_t* storage;
+  atomic_uchar* shared;
+  size_t shared_chunks;
+
+  // For a bit array from bitarray_arena_alloc, the arena, which owns both
+  // the struct and buf; NULL otherwise.  Until the bit array grows, buf
+  // follows the struct in the same block, of arena_bytes bytes.  If
+  // snapshots were reading the bits in that block when they moved out, the
+  // block is pinned: it stays allocated until the arena is freed.
+  bitarray_arena_t* arena;
+  size_t arena_bytes;
+  bool arena_pinned;
+};
+
+// Concrete data type representing a snapshot of a bit array.
+struct bitarray_snapshot {
+  // The bit array, while its storage is still live; NULL once retired.
+  bitarray_t* source;
+  bitarray_snapshot_t* prev;
+  bitarray_snapshot_t* next;
+  shared_storage_t* storage;
+
+  // The storage as it was when the snapshot was taken.  Chunk c lives at
+  // the same offset in copies once copied[c] is CHUNK_COPIED, and in live
+  // until then.  copies is a reservation the size of the whole storage, of
+  // which only the copied chunks are ever touched.
+  const char* live;
+  char* copies;
+  atomic_uchar* copied;
+  size_t nchunks;
+  size_t bytes;
+  size_t bit_sz;
 };
 
+// The header of the binary format, stored little-endian like the words
+// that follow it.  Its 64 bytes keep the words aligned.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t bit_sz;
+  uint64_t checksum;
+  uint64_t reserved[4];
+} file_header_t;
+
+// Counts the set bits in nwords consecutive 64-bit words starting at buf.
+typedef size_t (*popcount_kernel_t)(const char* buf, size_t nwords);
+
+// Returns the index of the first word in [begin, end) of buf that differs
+// from skip, or end if there is none.
+typedef size_t (*skip_kernel_t)(const char* buf, size_t begin, size_t end, uint64_t skip);
+
+// Parses nwords * 64 characters at string into nwords words at buf,
+// character i becoming bit i.  Returns false if any character is neither
+// '0' nor '1'; the words are then unspecified.
+typedef bool (*parse_kernel_t)(const char* string, size_t nwords, char* buf);
+
+// Formats nwords words as 64 characters each into string.  Word i is the 64
+// bits starting shift bits into word i of buf, so word nwords is read too.
+typedef void (*format_kernel_t)(const char* buf, size_t shift, size_t nwords, char* string);
+
+// A contiguous run of bytes to be memset by one worker thread.
+typedef struct {
+  char* dst;
+  int value;
+  size_t n;
+} memset_chunk_t;
+
+// The words [begin, end) of buf to be randomly filled by one worker thread.
+// param is the fill's own parameter: a fixed-point density, or a period.
+// carry is the bit the fill of runs starts the chunk on, as 0 or all ones,
+// and then the bit it ended on; it starts at 0 past the first chunk.
+typedef struct {
+  char* buf;
+  uint64_t seed;
+  size_t begin;
+  size_t end;
+  uint64_t param;
+  uint64_t carry;
+} randfill_chunk_t;
+
 
 // ******************** Prototypes for static functions *********************
 
@@ -66,6 +310,10 @@ static inline void bitarray_rotate_right(bitarray_t* const bitarray,
                                  const size_t bit_length,
                                  const size_t bit_left_amount);
 
+// Returns word with the order of its 64 bits reversed.  Uses the compiler's
+// bit-reverse builtin where there is one, and a swap network otherwise.
+static inline uint64_t reverse_word(uint64_t word);
+
 // Portable modulo operation that supports negative dividends.
 //
 // Many programming languages define modulo in a manner incompatible with its
@@ -96,12 +344,312 @@ static inline size_t modulo(const ssize_t n, const size_t m);
 // not matter.
 static inline char bitmask(const size_t bit_index);
 
+// Returns the number of bytes allocated for a buffer of bit_sz bits: enough
+// 64-bit words to cover every bit, plus one word of slack.
+static inline size_t buf_bytes(const size_t bit_sz);
+
+// Allocates a zeroed buffer of at least *bytes bytes, with mmap if it is
+// large and malloc otherwise.  Rounds *bytes up to the size actually
+// allocated and sets *mapped to which allocator was used.  Returns NULL on
+// failure.
+static char* buf_alloc(size_t* const bytes, bool* const mapped);
+
+// Resizes a buffer from buf_alloc to at least *bytes bytes, preserving the
+// leading bytes both sizes have in common, and updates *bytes and *mapped as
+// buf_alloc does.  Large mapped buffers are remapped in place or moved by
+// the kernel without copying where the platform supports it.  Returns NULL,
+// leaving buf untouched, on failure.
+static char* buf_resize(char* const buf,
+                        const size_t old_bytes,
+                        size_t* const bytes,
+                        bool* const mapped);
+
+// Frees a buffer from buf_alloc or buf_resize.
+static void buf_free(char* const buf, const size_t bytes, const bool mapped);
+
+// Rounds bytes up to a multiple of ARENA_ALIGN.
+static inline size_t arena_round(const size_t bytes);
+
+// Returns a block of at least bytes bytes from an arena, aligned to
+// ARENA_ALIGN and not zeroed, or NULL if memory could not be allocated.
+static char* arena_alloc(bitarray_arena_t* const arena, const size_t bytes);
+
+// Gives a block of bytes bytes from arena_alloc back to the arena.
+static void arena_recycle(bitarray_arena_t* const arena,
+                          char* const block,
+                          const size_t bytes);
+
+// Moves bitarray's bits to a buffer of capacity bytes, which must hold
+// them, resizing its buffer in place where possible.  A bit array mapped
+// from a file moves to storage of its own.  One from an arena moves to a
+// new block when it grows, and one with its bits in the struct moves out
+// when it outgrows them; both keep their storage when they shrink.
+// Returns false, leaving the bit array untouched, if memory could not be
+// allocated.
+static bool resize_storage(bitarray_t* const bitarray, size_t capacity);
+
+// Copies bitarray's bits into a new buffer from buf_alloc of capacity
+// bytes, and lets go of the old storage.  Returns false, leaving the bit
+// array untouched, if memory could not be allocated.
+static bool move_storage(bitarray_t* const bitarray, size_t capacity);
+
+// Returns whether a bit array keeps its bits inside the struct.
+static inline bool storage_small(const bitarray_t* const bitarray);
+
+// Sets up the fields of a new bit array of bit_sz bits whose bits are in
+// buf, of capacity bytes, or in the struct if buf is NULL.
+static void bitarray_init(bitarray_t* const bitarray,
+                          const size_t bit_sz,
+                          char* const buf,
+                          const size_t capacity,
+                          const bool mapped,
+                          bitarray_arena_t* const arena);
+
+// Returns whether a header is a valid one of this version.
+static bool header_valid(const file_header_t* const header);
+
+// Returns whether a bit array read or mapped from a file matches its
+// header's checksum, if it has one.
+static bool checksum_matches(const bitarray_t* const bitarray,
+                             const file_header_t* const header);
+
+// Writes all of iov to fd, retrying short and interrupted writes.  Updates
+// iov as it goes.
+static bool write_all(const int fd, struct iovec* iov, int iovcnt);
+
+// Reads exactly n bytes from fd into dst, retrying short and interrupted
+// reads.  Returns false at end of file or on error.
+static bool read_all(const int fd, char* const dst, const size_t n);
+
+// Ensures bitarray's buffer can hold bit_sz bits, growing it to at least
+// twice its current size if it must grow at all.  Returns false if memory
+// could not be allocated.
+static bool ensure_capacity(bitarray_t* const bitarray, const size_t bit_sz);
+
+// Loads and stores the word_index th 64-bit word of buf.  Bit i of the
+// array lives in bit (i % 64) of word (i / 64).  Loads go through
+// bitarray_load_word, which the modules built on the buffer share.
+static inline uint64_t load_word(const char* const buf, const size_t word_index);
+static inline void store_word(char* const buf,
+                              const size_t word_index,
+                              const uint64_t word);
+
+// Returns the number of threads to use for a job touching n bytes, which is
+// 1 below PARALLEL_THRESHOLD_BYTES.
+static size_t thread_count(const size_t n);
+
+// Runs worker on each of the njobs consecutive argument records of arg_size
+// bytes starting at args, one thread per record; record 0 runs on the
+// calling thread.  Returns once every job has finished.
+static void run_parallel(void* (*worker)(void*),
+                         void* const args,
+                         const size_t arg_size,
+                         const size_t njobs);
+
+// memset over n bytes, split across thread_count(n) threads.
+static void parallel_memset(char* const dst, const int value, const size_t n);
+
+// Returns word word_index of the random fill drawn from seed: the output of
+// a SplitMix64 generator seeded with seed, taken word_index + 1 steps on.
+static inline uint64_t randfill_word(const uint64_t seed, const size_t word_index);
+
+// Returns word word_index of a fill drawn from seed in which each bit is set
+// with probability density / 2^DENSITY_BITS.  The word is built from one
+// random word per bit of the density, least significant first: ORing in a
+// random word maps probability q to (1 + q) / 2, ANDing to q / 2.
+static inline uint64_t density_word(const uint64_t seed,
+                                    const size_t word_index,
+                                    const uint64_t density);
+
+// Returns 64 bits of the uniform fill drawn from seed, starting at bit
+// bit_index, of which only the first bit_length are meaningful.
+static inline uint64_t randfill_bits(const uint64_t seed,
+                                     const size_t bit_index,
+                                     const size_t bit_length);
+
+// Splits the words of bitarray into chunks like proto, the first of which
+// keeps proto's carry, and runs worker over them, threads permitting, in
+// parallel.  Returns the number of chunks, which are left in chunks.
+static size_t randfill_parallel(bitarray_t* const bitarray,
+                                void* (*worker)(void*),
+                                const randfill_chunk_t* const proto,
+                                randfill_chunk_t chunks[MAX_THREADS]);
+
+// Returns the word of a periodic fill whose first bit is bit *at of the
+// pattern, and advances *at to where the next word starts.
+static uint64_t periodic_word(const uint64_t seed, const size_t period, size_t* const at);
+
+// Workers that each fill one randfill_chunk_t.
+static void* randfill_worker(void* const arg);
+static void* density_worker(void* const arg);
+static void* runs_worker(void* const arg);
+static void* invert_worker(void* const arg);
+static void* periodic_worker(void* const arg);
+static void* adversarial_worker(void* const arg);
+
+// Returns a density as a fixed-point fraction of 2^DENSITY_BITS.
+static uint64_t density_fixed(const double density);
+
+// Popcount kernels over nwords whole words at buf.  The vector kernels only
+// exist on x86-64 and are only called when the CPU supports them.
+static size_t popcount_words_scalar(const char* buf, size_t nwords);
+#if defined(__x86_64__)
+static size_t popcount_words_avx2(const char* buf, size_t nwords);
+static size_t popcount_words_avx512(const char* buf, size_t nwords);
+#endif
+
+// Counts the set bits in nwords whole words at buf, using the fastest
+// kernel this CPU supports for long runs.
+static size_t popcount_words(const char* const buf, const size_t nwords);
+
+// Skip kernels, as described by skip_kernel_t.
+static size_t skip_words_scalar(const char* buf, size_t begin, size_t end, uint64_t skip);
+#if defined(__x86_64__)
+static size_t skip_words_avx2(const char* buf, size_t begin, size_t end, uint64_t skip);
+#endif
+
+// Returns the index of the first word in [begin, end) of buf that differs
+// from skip (0 or ~0), or end, using the vector kernel for long runs.
+static size_t skip_words(const char* const buf,
+                         const size_t begin,
+                         const size_t end,
+                         const uint64_t skip);
+
+// Text kernels, as described by parse_kernel_t and format_kernel_t.
+static bool parse_words_scalar(const char* string, size_t nwords, char* buf);
+static void format_words_scalar(const char* buf, size_t shift, size_t nwords, char* string);
+#if defined(__x86_64__)
+static bool parse_words_avx2(const char* string, size_t nwords, char* buf);
+static void format_words_avx2(const char* buf, size_t shift, size_t nwords, char* string);
+#endif
+
+// Parse and format through the fastest text kernel this CPU supports.
+static bool parse_words(const char* const string, const size_t nwords, char* const buf);
+static void format_words(const char* const buf,
+                         const size_t shift,
+                         const size_t nwords,
+                         char* const string);
+
+// Returns the index of the first bit in [bit_index, bit_end) whose value is
+// not that of skip's bits, or bit_end if there is none.  skip is 0 to find
+// set bits and ~0 to find clear ones.
+static size_t find_next(const bitarray_t* const bitarray,
+                        const size_t bit_index,
+                        const size_t bit_end,
+                        const uint64_t skip);
+
+// Returns the 64 bits starting a_shift bits into the word pair (lo, hi),
+// for a_shift in [0, 64).  This is the funnel shift of bitarray_get_u64,
+// written so that a shift of 0 needs no branch.
+static inline uint64_t funnel(const uint64_t lo, const uint64_t hi, const size_t shift);
+
+// Applies op to nwords words of operands a and b, storing into dst (which
+// may overlap a or b from below) or, if dst is NULL, returning the number of
+// set bits in the result instead.  Operand word i is the 64 bits starting
+// a_shift (b_shift) bits into word i of a (b).  These are simple enough
+// word loops for the compiler to vectorize.
+static size_t logic_words(char* const dst,
+                          const char* const a,
+                          const size_t a_shift,
+                          const char* const b,
+                          const size_t b_shift,
+                          const size_t nwords,
+                          const bitarray_logic_t op);
+
+// Shared body of the bitarray_logic functions.  Walks the words of dst, or
+// of a when dst is NULL, in which case the result bits are counted instead
+// of stored.  Returns the count (0 when storing).
+static size_t logic_range(bitarray_t* const dst,
+                          const size_t dst_offset,
+                          const bitarray_t* const a,
+                          const size_t a_offset,
+                          const bitarray_t* const b,
+                          const size_t b_offset,
+                          const size_t bit_length,
+                          const bitarray_logic_t op);
+
+// Counts the set bits of buf in the half-open bit interval
+// [bit_offset, bit_offset + bit_length).
+static size_t count_bits(const char* const buf,
+                         const size_t bit_offset,
+                         const size_t bit_length);
+
+// Returns the index of the first of nwords words at which operands a and b
+// differ, or nwords if they agree.  As in logic_words, operand word i is
+// the 64 bits starting a_shift (b_shift) bits into word i of a (b).
+static size_t first_difference(const char* const a,
+                               const size_t a_shift,
+                               const char* const b,
+                               const size_t b_shift,
+                               const size_t nwords);
+
+// Returns the position, relative to the start of the subarrays, of the first
+// bit at which two subarrays of bit_length bits differ, or bit_length if
+// they are equal.
+static size_t range_difference(const bitarray_t* const a,
+                               const size_t a_offset,
+                               const bitarray_t* const b,
+                               const size_t b_offset,
+                               const size_t bit_length);
+
+// Frees a bit array's storage, whichever way it was allocated.
+static void storage_free(char* const buf,
+                         const size_t capacity,
+                         const bool mapped,
+                         char* const file_map,
+                         const size_t file_map_bytes);
+
+// Lets go of a bit array's storage: it is retired if snapshots share it and
+// freed otherwise.
+static void release_storage(bitarray_t* const bitarray);
+
+// Copies out every chunk overlapping bytes [byte_begin, byte_end) of the
+// bit array's storage that a snapshot still shares, before it is written.
+// cow_touch is the inline check that there is anything to do.
+static inline void cow_touch(bitarray_t* const bitarray,
+                             const size_t byte_begin,
+                             const size_t byte_end);
+static void cow_copy_chunks(bitarray_t* const bitarray,
+                            const size_t byte_begin,
+                            const size_t byte_end);
+
+// Copies n bytes starting at byte `at` of a snapshot, all within one chunk,
+// into dst.  Safe while the bit array is being written: a chunk read from
+// live storage is reread from the copy if a writer copied it meanwhile.
+static void snapshot_read(const bitarray_snapshot_t* const snapshot,
+                          const size_t at,
+                          char* const dst,
+                          const size_t n);
+
+// Returns word word_index of the bit array's storage as an atomic object.
+// The storage is always word-aligned.
+static inline _Atomic uint64_t* atomic_word(const bitarray_t* const bitarray,
+                                            const size_t word_index);
+
+// Returns the C11 ordering for a read-modify-write with the given order.
+static inline memory_order rmw_order(const bitarray_order_t order);
+
+// One xxHash64 accumulation round, folding word into acc.
+static inline uint64_t hash_round(uint64_t acc, const uint64_t word);
+
 
 // ******************************* Functions ********************************
 
 bitarray_t* bitarray_new(const size_t bit_sz) {
-  // Allocate an underlying buffer of ceil(bit_sz/8) bytes.
-  char* const buf = calloc(1, (bit_sz+7) / 8);
+  // A small bit array needs only the struct.
+  if (bit_sz <= SMALL_BITS) {
+    bitarray_t* const bitarray = malloc(sizeof(struct bitarray));
+    if (bitarray == NULL) {
+      return NULL;
+    }
+    bitarray_init(bitarray, bit_sz, NULL, 0, false, NULL);
+    return bitarray;
+  }
+
+  // Allocate an underlying buffer of ceil(bit_sz/64) words plus slack.
+  size_t capacity = buf_bytes(bit_sz);
+  bool mapped;
+  char* const buf = buf_alloc(&capacity, &mapped);
   if (buf == NULL) {
     return NULL;
   }
@@ -109,12 +657,10 @@ bitarray_t* bitarray_new(const size_t bit_sz) {
   // Allocate space for the struct.
   bitarray_t* const bitarray = malloc(sizeof(struct bitarray));
   if (bitarray == NULL) {
-    free(buf);
+    buf_free(buf, capacity, mapped);
     return NULL;
   }
-
-  bitarray->buf = buf;
-  bitarray->bit_sz = bit_sz;
+  bitarray_init(bitarray, bit_sz, buf, capacity, mapped, NULL);
   return bitarray;
 }
 
@@ -122,15 +668,424 @@ void bitarray_free(bitarray_t* const bitarray) {
   if (bitarray == NULL) {
     return;
   }
-  free(bitarray->buf);
-  bitarray->buf = NULL;
-  free(bitarray);
+  bitarray_arena_t* const arena = bitarray->arena;
+  if (arena == NULL) {
+    release_storage(bitarray);
+    bitarray->buf = NULL;
+    free(bitarray);
+    return;
+  }
+
+  // Blocks can be reused unless snapshots still read bits in them.  Once
+  // the bit array has grown, its bits are in a block of their own.
+  const size_t header = arena_round(sizeof(struct bitarray));
+  const bool in_block = storage_small(bitarray) ||
+                        bitarray->buf == (char*)bitarray + header;
+  const bool shared = bitarray->storage != NULL;
+  char* const buf = bitarray->buf;
+  const size_t capacity = bitarray->capacity;
+  const bool recycle = !bitarray->arena_pinned && !(in_block && shared);
+  const size_t bytes = bitarray->arena_bytes;
+  release_storage(bitarray);
+  if (!in_block && !shared) {
+    arena_recycle(arena, buf, capacity);
+  }
+  if (recycle) {
+    arena_recycle(arena, (char*)bitarray, bytes);
+  }
+}
+
+bitarray_arena_t* bitarray_arena_new(void) {
+  // Zeroing leaves every free list empty and no chunk to carve up.
+  return calloc(1, sizeof(struct bitarray_arena));
+}
+
+bitarray_t* bitarray_arena_alloc(bitarray_arena_t* const arena,
+                                 const size_t bit_sz) {
+  // A small bit array's block is just the struct; a larger one's bits
+  // follow it.
+  const size_t header = arena_round(sizeof(struct bitarray));
+  const size_t capacity = bit_sz <= SMALL_BITS ? 0 : buf_bytes(bit_sz);
+  char* const block = arena_alloc(arena, header + capacity);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  bitarray_t* const bitarray = (bitarray_t*)block;
+  char* const buf = capacity > 0 ? block + header : NULL;
+  if (buf != NULL) {
+    memset(buf, 0, capacity);
+  }
+  bitarray_init(bitarray, bit_sz, buf, capacity, false, arena);
+  bitarray->arena_bytes = header + capacity;
+  return bitarray;
+}
+
+void bitarray_arena_free(bitarray_arena_t* const arena) {
+  if (arena == NULL) {
+    return;
+  }
+  arena_chunk_t* chunk = arena->chunks;
+  while (chunk != NULL) {
+    arena_chunk_t* const next = chunk->next;
+    buf_free((char*)chunk, chunk->bytes, chunk->mapped);
+    chunk = next;
+  }
+  free(arena);
+}
+
+size_t bitarray_get_capacity(const bitarray_t* const bitarray) {
+  return (bitarray->capacity / sizeof(uint64_t) - 1) * WORD_BITS;
+}
+
+bool bitarray_reserve(bitarray_t* const bitarray, const size_t bit_capacity) {
+  if (buf_bytes(bit_capacity) <= bitarray->capacity) {
+    return true;
+  }
+  return resize_storage(bitarray, buf_bytes(bit_capacity));
+}
+
+bool bitarray_append(bitarray_t* const bitarray, const bool value) {
+  if (!ensure_capacity(bitarray, bitarray->bit_sz + 1)) {
+    return false;
+  }
+  bitarray->bit_sz++;
+  bitarray_set(bitarray, bitarray->bit_sz - 1, value);
+  return true;
+}
+
+bool bitarray_append_bits(bitarray_t* const bitarray,
+                          const uint64_t* const words,
+                          const size_t bit_length) {
+  if (!ensure_capacity(bitarray, bitarray->bit_sz + bit_length)) {
+    return false;
+  }
+  const size_t first_word = bitarray->bit_sz / WORD_BITS;
+  const size_t shift = bitarray->bit_sz % WORD_BITS;
+  const size_t nwords = (bit_length + WORD_BITS - 1) / WORD_BITS;
+  cow_touch(bitarray, first_word * sizeof(uint64_t),
+            (first_word + nwords + 1) * sizeof(uint64_t));
+  bitarray->bit_sz += bit_length;
+  if (shift == 0) {
+    memcpy(bitarray->buf + first_word * sizeof(uint64_t), words,
+           nwords * sizeof(uint64_t));
+    return true;
+  }
+
+  // Splice each word across two words of the buffer.  The last store lands
+  // at most in the slack word, and whatever it puts past the new end is
+  // unspecified anyway.
+  uint64_t carry = load_word(bitarray->buf, first_word) & ((1ULL << shift) - 1);
+  for (size_t i = 0; i < nwords; i++) {
+    store_word(bitarray->buf, first_word + i, carry | (words[i] << shift));
+    carry = words[i] >> (WORD_BITS - shift);
+  }
+  store_word(bitarray->buf, first_word + nwords, carry);
+  return true;
+}
+
+void bitarray_truncate(bitarray_t* const bitarray, const size_t bit_sz) {
+  assert(bit_sz <= bitarray->bit_sz);
+  bitarray->bit_sz = bit_sz;
+}
+
+bool bitarray_shrink_to_fit(bitarray_t* const bitarray) {
+  if (buf_bytes(bitarray->bit_sz) >= bitarray->capacity) {
+    return true;
+  }
+  return resize_storage(bitarray, buf_bytes(bitarray->bit_sz));
 }
 
 size_t bitarray_get_bit_sz(const bitarray_t* const bitarray) {
   return bitarray->bit_sz;
 }
 
+const char* bitarray_get_buf(const bitarray_t* const bitarray) {
+  return bitarray->buf;
+}
+
+bool bitarray_write(const bitarray_t* const bitarray, const int fd) {
+  file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+  header.version = FILE_VERSION;
+  header.flags = FILE_FLAG_CHECKSUM;
+  header.bit_sz = bitarray->bit_sz;
+  header.checksum = bitarray_hash_range(bitarray, 0, bitarray->bit_sz);
+
+  // Whole words go out from the buffer itself; a partial last word is
+  // cleared past bit_sz, and the slack word written as zero, from a copy.
+  const size_t whole_words = bitarray->bit_sz / WORD_BITS;
+  const size_t tail_bits = bitarray->bit_sz % WORD_BITS;
+  uint64_t tail[2] = {0, 0};
+  if (tail_bits != 0) {
+    tail[0] = load_word(bitarray->buf, whole_words) & ((1ULL << tail_bits) - 1);
+  }
+  struct iovec iov[3] = {
+    {&header, sizeof(header)},
+    {bitarray->buf, whole_words * sizeof(uint64_t)},
+    {tail, (tail_bits != 0 ? 2 : 1) * sizeof(uint64_t)},
+  };
+  return write_all(fd, iov, 3);
+}
+
+bitarray_t* bitarray_read(const int fd) {
+  file_header_t header;
+  if (!read_all(fd, (char*)&header, sizeof(header)) || !header_valid(&header)) {
+    return NULL;
+  }
+  bitarray_t* const bitarray = bitarray_new(header.bit_sz);
+  if (bitarray == NULL) {
+    return NULL;
+  }
+  if (!read_all(fd, bitarray->buf, buf_bytes(header.bit_sz)) ||
+      !checksum_matches(bitarray, &header)) {
+    bitarray_free(bitarray);
+    return NULL;
+  }
+  return bitarray;
+}
+
+bitarray_t* bitarray_map(const int fd, const bool verify) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(file_header_t)) {
+    return NULL;
+  }
+  const size_t bytes = st.st_size;
+  // A private mapping lets the bit array be written without touching the
+  // file.
+  char* const file_map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (file_map == MAP_FAILED) {
+    return NULL;
+  }
+  file_header_t header;
+  memcpy(&header, file_map, sizeof(header));
+  bitarray_t* const bitarray = malloc(sizeof(struct bitarray));
+  if (!header_valid(&header) ||
+      bytes - sizeof(header) < buf_bytes(header.bit_sz) ||
+      bitarray == NULL) {
+    free(bitarray);
+    munmap(file_map, bytes);
+    return NULL;
+  }
+
+  bitarray_init(bitarray, header.bit_sz, file_map + sizeof(header),
+                buf_bytes(header.bit_sz), false, NULL);
+  bitarray->file_map = file_map;
+  bitarray->file_map_bytes = bytes;
+  if (verify && !checksum_matches(bitarray, &header)) {
+    bitarray_free(bitarray);
+    return NULL;
+  }
+  return bitarray;
+}
+
+bitarray_t* bitarray_from_string(const char* const string) {
+  const size_t length = strlen(string);
+  bitarray_t* const bitarray = bitarray_new(length);
+  if (bitarray == NULL) {
+    return NULL;
+  }
+
+  // Whole words go through the kernel; the last few characters are packed
+  // one at a time into the word after them.
+  const size_t nwords = length / WORD_BITS;
+  bool valid = parse_words(string, nwords, bitarray->buf);
+  uint64_t tail = 0;
+  for (size_t i = nwords * WORD_BITS; i < length; i++) {
+    valid = valid && (string[i] == '0' || string[i] == '1');
+    tail |= (uint64_t)(string[i] == '1') << (i % WORD_BITS);
+  }
+  store_word(bitarray->buf, nwords, tail);
+
+  if (!valid) {
+    bitarray_free(bitarray);
+    return NULL;
+  }
+  return bitarray;
+}
+
+void bitarray_to_string(const bitarray_t* const bitarray,
+                        const size_t bit_offset,
+                        const size_t bit_length,
+                        char* const string) {
+  assert(bit_offset + bit_length <= bitarray->bit_sz);
+
+  // The subarray's whole words never read past the word after the last bit,
+  // which the slack word keeps inside the buffer.
+  const size_t nwords = bit_length / WORD_BITS;
+  format_words(bitarray->buf + bit_offset / WORD_BITS * sizeof(uint64_t),
+               bit_offset % WORD_BITS, nwords, string);
+  for (size_t i = nwords * WORD_BITS; i < bit_length; i++) {
+    string[i] = bitarray_get(bitarray, bit_offset + i) ? '1' : '0';
+  }
+  string[bit_length] = '\0';
+}
+
+bitarray_snapshot_t* bitarray_snapshot(bitarray_t* const bitarray) {
+  // Snapshots can outlive the struct, so bits kept in it move out first.
+  // An arena's block stays allocated while snapshots share it.
+  if (storage_small(bitarray) && bitarray->arena == NULL &&
+      !move_storage(bitarray, bitarray->capacity)) {
+    return NULL;
+  }
+  const size_t bytes = buf_bytes(bitarray->bit_sz);
+  const size_t nchunks = (bytes + SNAPSHOT_CHUNK_BYTES - 1) / SNAPSHOT_CHUNK_BYTES;
+
+  bitarray_snapshot_t* const snapshot = malloc(sizeof(bitarray_snapshot_t));
+  atomic_uchar* const copied = calloc(nchunks, sizeof(atomic_uchar));
+  // Reserve room for a copy of every chunk without committing memory to
+  // it; pages only materialize as writes copy chunks into them.
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  char* const copies = mmap(NULL, nchunks * SNAPSHOT_CHUNK_BYTES,
+                            PROT_READ | PROT_WRITE, flags, -1, 0);
+  shared_storage_t* const storage = bitarray->storage != NULL ?
+                                    bitarray->storage : calloc(1, sizeof(shared_storage_t));
+  atomic_uchar* shared = NULL;
+  if (snapshot != NULL && copied != NULL && copies != MAP_FAILED && storage != NULL) {
+    shared = nchunks > bitarray->shared_chunks ?
+             realloc(bitarray->shared, nchunks * sizeof(atomic_uchar)) : bitarray->shared;
+  }
+  if (shared == NULL) {
+    free(snapshot);
+    free(copied);
+    if (copies != MAP_FAILED) {
+      munmap(copies, nchunks * SNAPSHOT_CHUNK_BYTES);
+    }
+    if (storage != bitarray->storage) {
+      free(storage);
+    }
+    return NULL;
+  }
+
+  // Every chunk is shared again, at least with the new snapshot.
+  for (size_t c = 0; c < nchunks; c++) {
+    atomic_init(&copied[c], CHUNK_SHARED);
+    atomic_init(&shared[c], 1);
+  }
+  if (nchunks > bitarray->shared_chunks) {
+    bitarray->shared_chunks = nchunks;
+  }
+  bitarray->shared = shared;
+  bitarray->storage = storage;
+  storage->refs++;
+
+  snapshot->source = bitarray;
+  snapshot->prev = NULL;
+  snapshot->next = bitarray->snapshots;
+  if (bitarray->snapshots != NULL) {
+    bitarray->snapshots->prev = snapshot;
+  }
+  bitarray->snapshots = snapshot;
+  snapshot->storage = storage;
+  snapshot->live = bitarray->buf;
+  snapshot->copies = copies;
+  snapshot->copied = copied;
+  snapshot->nchunks = nchunks;
+  snapshot->bytes = bytes;
+  snapshot->bit_sz = bitarray->bit_sz;
+  return snapshot;
+}
+
+void bitarray_snapshot_free(bitarray_snapshot_t* const snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+  bitarray_t* const source = snapshot->source;
+  if (source != NULL) {
+    if (snapshot->prev != NULL) {
+      snapshot->prev->next = snapshot->next;
+    } else {
+      source->snapshots = snapshot->next;
+    }
+    if (snapshot->next != NULL) {
+      snapshot->next->prev = snapshot->prev;
+    }
+    if (source->snapshots == NULL) {
+      free(source->shared);
+      source->shared = NULL;
+      source->shared_chunks = 0;
+      source->storage = NULL;
+    }
+  }
+
+  shared_storage_t* const storage = snapshot->storage;
+  if (--storage->refs == 0) {
+    if (storage->retired && !storage->borrowed) {
+      storage_free(storage->buf, storage->capacity, storage->mapped,
+                   storage->file_map, storage->file_map_bytes);
+    }
+    free(storage);
+  }
+  munmap(snapshot->copies, snapshot->nchunks * SNAPSHOT_CHUNK_BYTES);
+  free(snapshot->copied);
+  free(snapshot);
+}
+
+size_t bitarray_snapshot_get_bit_sz(const bitarray_snapshot_t* const snapshot) {
+  return snapshot->bit_sz;
+}
+
+size_t bitarray_snapshot_get_space(const bitarray_snapshot_t* const snapshot) {
+  size_t copied = 0;
+  for (size_t c = 0; c < snapshot->nchunks; c++) {
+    copied += atomic_load_explicit(&snapshot->copied[c], memory_order_relaxed) == CHUNK_COPIED;
+  }
+  return sizeof(bitarray_snapshot_t) + snapshot->nchunks * sizeof(atomic_uchar) +
+         copied * SNAPSHOT_CHUNK_BYTES;
+}
+
+bool bitarray_snapshot_get(const bitarray_snapshot_t* const snapshot,
+                           const size_t bit_index) {
+  assert(bit_index < snapshot->bit_sz);
+  char byte;
+  snapshot_read(snapshot, bit_index / 8, &byte, 1);
+  return (byte & bitmask(bit_index)) != 0;
+}
+
+size_t bitarray_snapshot_count(const bitarray_snapshot_t* const snapshot,
+                               const size_t bit_offset,
+                               const size_t bit_length) {
+  assert(bit_offset + bit_length <= snapshot->bit_sz);
+  const size_t chunk_bits = SNAPSHOT_CHUNK_BYTES * 8;
+  // A chunk is read whole into a buffer with a spare zero word, so the word
+  // loads of count_bits stay inside it.
+  uint64_t chunk[SNAPSHOT_CHUNK_BYTES / sizeof(uint64_t) + 1];
+  size_t count = 0;
+  size_t done = 0;
+  while (done < bit_length) {
+    const size_t bit_index = bit_offset + done;
+    const size_t c = bit_index / chunk_bits;
+    const size_t at = c * SNAPSHOT_CHUNK_BYTES;
+    const size_t n = snapshot->bytes - at < SNAPSHOT_CHUNK_BYTES ?
+                     snapshot->bytes - at : SNAPSHOT_CHUNK_BYTES;
+    memset(chunk, 0, sizeof(chunk));
+    snapshot_read(snapshot, at, (char*)chunk, n);
+    const size_t start = bit_index - c * chunk_bits;
+    const size_t len = bit_length - done < chunk_bits - start ?
+                       bit_length - done : chunk_bits - start;
+    count += count_bits((const char*)chunk, start, len);
+    done += len;
+  }
+  return count;
+}
+
+bitarray_t* bitarray_snapshot_copy(const bitarray_snapshot_t* const snapshot) {
+  bitarray_t* const bitarray = bitarray_new(snapshot->bit_sz);
+  if (bitarray == NULL) {
+    return NULL;
+  }
+  for (size_t at = 0; at < snapshot->bytes; at += SNAPSHOT_CHUNK_BYTES) {
+    const size_t n = snapshot->bytes - at < SNAPSHOT_CHUNK_BYTES ?
+                     snapshot->bytes - at : SNAPSHOT_CHUNK_BYTES;
+    snapshot_read(snapshot, at, bitarray->buf + at, n);
+  }
+  return bitarray;
+}
+
 inline bool bitarray_get(const bitarray_t* const restrict bitarray, const size_t bit_index) {
   assert(bit_index < bitarray->bit_sz);
 
@@ -150,6 +1105,7 @@ inline void bitarray_set(bitarray_t* const restrict bitarray,
                   const size_t bit_index,
                   const bool value) {
   assert(bit_index < bitarray->bit_sz);
+  cow_touch(bitarray, bit_index / 8, bit_index / 8 + 1);
 
   // We're storing bits in packed form, 8 per byte.  So to set the nth
   // bit, we want to set the (n mod 8)th bit of the (floor(n/8)th) byte.
@@ -163,13 +1119,59 @@ inline void bitarray_set(bitarray_t* const restrict bitarray,
     (value ? bitmask(bit_index) : 0);
 }
 
-void bitarray_randfill(bitarray_t* const bitarray){
-  int32_t *ptr = (int32_t *)bitarray->buf;
-  for (int64_t i=0; i<bitarray->bit_sz/32 + 1; i++){
-    ptr[i] = rand();
+void bitarray_randfill(bitarray_t* const bitarray, const uint64_t seed) {
+  const randfill_chunk_t proto = {.seed = seed};
+  randfill_chunk_t chunks[MAX_THREADS];
+  randfill_parallel(bitarray, randfill_worker, &proto, chunks);
+}
+
+void bitarray_randfill_density(bitarray_t* const bitarray,
+                               const double density,
+                               const uint64_t seed) {
+  const randfill_chunk_t proto = {.seed = seed, .param = density_fixed(density)};
+  randfill_chunk_t chunks[MAX_THREADS];
+  randfill_parallel(bitarray, density_worker, &proto, chunks);
+}
+
+void bitarray_randfill_runs(bitarray_t* const bitarray,
+                            const double mean_run,
+                            const uint64_t seed) {
+  assert(mean_run >= 1);
+  // A run ends wherever a bit of a fill of density 1 / mean_run is set, so
+  // each chunk is the running XOR of such a fill.  The chunks are filled
+  // from 0, except the first, and then those after an odd number of flips
+  // in total are inverted.
+  const randfill_chunk_t proto = {.seed = seed, .param = density_fixed(1 / mean_run),
+                                  .carry = -(randfill_word(~seed, 0) & 1)};
+  randfill_chunk_t chunks[MAX_THREADS];
+  const size_t njobs = randfill_parallel(bitarray, runs_worker, &proto, chunks);
+  bool invert = false;
+  uint64_t ended = njobs > 0 ? chunks[0].carry : 0;
+  for (size_t c = 1; c < njobs; c++) {
+    invert ^= ended != 0;
+    ended = chunks[c].carry;
+    chunks[c].carry = invert ? ~0ULL : 0;
+  }
+  if (njobs > 1) {
+    run_parallel(invert_worker, chunks + 1, sizeof(randfill_chunk_t), njobs - 1);
   }
 }
 
+void bitarray_randfill_periodic(bitarray_t* const bitarray,
+                                const size_t period,
+                                const uint64_t seed) {
+  assert(period >= 1);
+  const randfill_chunk_t proto = {.seed = seed, .param = period};
+  randfill_chunk_t chunks[MAX_THREADS];
+  randfill_parallel(bitarray, periodic_worker, &proto, chunks);
+}
+
+void bitarray_randfill_adversarial(bitarray_t* const bitarray, const uint64_t seed) {
+  const randfill_chunk_t proto = {.seed = seed};
+  randfill_chunk_t chunks[MAX_THREADS];
+  randfill_parallel(bitarray, adversarial_worker, &proto, chunks);
+}
+
 // Get 64 bits from bitstring
 inline uint64_t bitarray_get_u64(const bitarray_t *b, size_t bit_index) {
     size_t byte_idx = bit_index / 8;
@@ -190,6 +1192,7 @@ inline uint64_t bitarray_get_u64(const bitarray_t *b, size_t bit_index) {
 inline void bitarray_set_u64(bitarray_t *b, size_t bit_index, uint64_t value) {
     size_t byte_idx = bit_index / 8;
     size_t bit_off  = bit_index % 8;
+    cow_touch(b, byte_idx, byte_idx + sizeof(uint64_t) + 1);
 
     if (bit_off == 0) {
         memcpy(b -> buf + byte_idx, &value, sizeof(uint64_t));
@@ -211,6 +1214,76 @@ inline void bitarray_set_u64(bitarray_t *b, size_t bit_index, uint64_t value) {
     b -> buf[byte_idx + sizeof(uint64_t)] = (char) new_byte;
 }
 
+bool bitarray_atomic_get(const bitarray_t* const bitarray,
+                         const size_t bit_index,
+                         const bitarray_order_t order) {
+  assert(bit_index < bitarray->bit_sz);
+  const uint64_t word = atomic_load_explicit(
+      atomic_word(bitarray, bit_index / WORD_BITS),
+      order == BITARRAY_ACQ_REL ? memory_order_acquire : memory_order_relaxed);
+  return (word >> (bit_index % WORD_BITS)) & 1;
+}
+
+void bitarray_atomic_set(bitarray_t* const bitarray,
+                         const size_t bit_index,
+                         const bitarray_order_t order) {
+  assert(bit_index < bitarray->bit_sz);
+  cow_touch(bitarray, bit_index / 8, bit_index / 8 + 1);
+  atomic_fetch_or_explicit(atomic_word(bitarray, bit_index / WORD_BITS),
+                           1ULL << (bit_index % WORD_BITS), rmw_order(order));
+}
+
+void bitarray_atomic_clear(bitarray_t* const bitarray,
+                           const size_t bit_index,
+                           const bitarray_order_t order) {
+  assert(bit_index < bitarray->bit_sz);
+  cow_touch(bitarray, bit_index / 8, bit_index / 8 + 1);
+  atomic_fetch_and_explicit(atomic_word(bitarray, bit_index / WORD_BITS),
+                            ~(1ULL << (bit_index % WORD_BITS)), rmw_order(order));
+}
+
+bool bitarray_atomic_test_and_set(bitarray_t* const bitarray,
+                                  const size_t bit_index,
+                                  const bitarray_order_t order) {
+  assert(bit_index < bitarray->bit_sz);
+  cow_touch(bitarray, bit_index / 8, bit_index / 8 + 1);
+  const uint64_t bit = 1ULL << (bit_index % WORD_BITS);
+  _Atomic uint64_t* const word = atomic_word(bitarray, bit_index / WORD_BITS);
+  // A plain load first keeps bits that are already set from taking the
+  // cache line exclusive, which matters when many threads hit the same bits.
+  if (atomic_load_explicit(word, memory_order_relaxed) & bit) {
+    if (order == BITARRAY_ACQ_REL) {
+      atomic_thread_fence(memory_order_acquire);
+    }
+    return true;
+  }
+  return (atomic_fetch_or_explicit(word, bit, rmw_order(order)) & bit) != 0;
+}
+
+uint64_t bitarray_atomic_fetch_or(bitarray_t* const bitarray,
+                                  const size_t word_index,
+                                  const uint64_t mask,
+                                  const bitarray_order_t order) {
+  assert(word_index < (bitarray->bit_sz + WORD_BITS - 1) / WORD_BITS);
+  cow_touch(bitarray, word_index * sizeof(uint64_t), (word_index + 1) * sizeof(uint64_t));
+  return atomic_fetch_or_explicit(atomic_word(bitarray, word_index), mask,
+                                  rmw_order(order));
+}
+
+inline static uint64_t reverse_word(uint64_t word) {
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_bitreverse64)
+  return __builtin_bitreverse64(word);
+#endif
+#endif
+  // Swap adjacent bits, then pairs, then nibbles, then let bswap reverse
+  // the bytes.
+  word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+  word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+  word = ((word >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((word & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  return __builtin_bswap64(word);
+}
+
 static inline void 
 bitarray_reverse_range(bitarray_t* const restrict bitarray, const size_t start, const size_t length) 
 {
@@ -223,8 +1296,8 @@ bitarray_reverse_range(bitarray_t* const restrict bitarray, const size_t start,
         uint64_t left_val = bitarray_get_u64(bitarray, left);
         uint64_t right_val = bitarray_get_u64(bitarray, right - 64);
 
-        left_val = __builtin_bitreverse64(left_val);
-        right_val = __builtin_bitreverse64(right_val);
+        left_val = reverse_word(left_val);
+        right_val = reverse_word(right_val);
 
         bitarray_set_u64(bitarray, right - 64, left_val);
         bitarray_set_u64(bitarray, left, right_val);
@@ -245,6 +1318,14 @@ bitarray_reverse_range(bitarray_t* const restrict bitarray, const size_t start,
 }
 
 
+void bitarray_reverse(bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length) {
+  assert(bit_offset + bit_length <= bitarray->bit_sz);
+  cow_touch(bitarray, bit_offset / 8, (bit_offset + bit_length) / 8 + 1);
+  bitarray_reverse_range(bitarray, bit_offset, bit_length);
+}
+
 void bitarray_rotate(bitarray_t* const restrict bitarray,
                      const size_t bit_offset,
                      const size_t bit_length,
@@ -264,12 +1345,228 @@ void bitarray_rotate(bitarray_t* const restrict bitarray,
       return;
     }
     
+    // Copy out the whole range up front, rather than a chunk at a time
+    // from inside the reversals.
+    cow_touch(bitarray, bit_offset / 8, (bit_offset + bit_length) / 8 + 1);
     const size_t split_idx = bit_length - bit_right_amount;
     bitarray_reverse_range(bitarray, bit_offset, split_idx);
     bitarray_reverse_range(bitarray, bit_offset + split_idx, bit_right_amount);
     bitarray_reverse_range(bitarray, bit_offset, bit_length);
 }
 
+void bitarray_fill_range(bitarray_t* const bitarray,
+                         const size_t bit_offset,
+                         const size_t bit_length,
+                         const bool value) {
+  assert(bit_offset + bit_length <= bitarray->bit_sz);
+  if (bit_length == 0) {
+    return;
+  }
+
+  const size_t first_word = bit_offset / WORD_BITS;
+  const size_t last_word = (bit_offset + bit_length - 1) / WORD_BITS;
+  const uint64_t head_mask = ~0ULL << (bit_offset % WORD_BITS);
+  const uint64_t tail_mask =
+    ~0ULL >> (WORD_BITS - 1 - (bit_offset + bit_length - 1) % WORD_BITS);
+  const uint64_t fill = value ? ~0ULL : 0;
+  cow_touch(bitarray, first_word * sizeof(uint64_t), (last_word + 1) * sizeof(uint64_t));
+
+  if (first_word == last_word) {
+    const uint64_t mask = head_mask & tail_mask;
+    const uint64_t word = load_word(bitarray->buf, first_word);
+    store_word(bitarray->buf, first_word, (word & ~mask) | (fill & mask));
+    return;
+  }
+
+  // Partial head and tail words are read-modify-written; everything in
+  // between is whole words and goes straight to memset.
+  const uint64_t head = load_word(bitarray->buf, first_word);
+  store_word(bitarray->buf, first_word, (head & ~head_mask) | (fill & head_mask));
+  const uint64_t tail = load_word(bitarray->buf, last_word);
+  store_word(bitarray->buf, last_word, (tail & ~tail_mask) | (fill & tail_mask));
+
+  parallel_memset(bitarray->buf + (first_word + 1) * sizeof(uint64_t),
+                  value ? 0xff : 0x00,
+                  (last_word - first_word - 1) * sizeof(uint64_t));
+}
+
+size_t bitarray_count(const bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length) {
+  assert(bit_offset + bit_length <= bitarray->bit_sz);
+  return count_bits(bitarray->buf, bit_offset, bit_length);
+}
+
+size_t bitarray_find_next_set(const bitarray_t* const bitarray,
+                              const size_t bit_index) {
+  return find_next(bitarray, bit_index, bitarray->bit_sz, 0);
+}
+
+size_t bitarray_find_next_clear(const bitarray_t* const bitarray,
+                                const size_t bit_index) {
+  return find_next(bitarray, bit_index, bitarray->bit_sz, ~0ULL);
+}
+
+size_t bitarray_find_next_set_until(const bitarray_t* const bitarray,
+                                    const size_t bit_index,
+                                    const size_t bit_end) {
+  return find_next(bitarray, bit_index, bit_end, 0);
+}
+
+size_t bitarray_find_next_clear_until(const bitarray_t* const bitarray,
+                                      const size_t bit_index,
+                                      const size_t bit_end) {
+  return find_next(bitarray, bit_index, bit_end, ~0ULL);
+}
+
+void bitarray_iter_init(bitarray_iter_t* const iter,
+                        const bitarray_t* const bitarray,
+                        const size_t bit_index) {
+  iter->bitarray = bitarray;
+  iter->next = bitarray_find_next_set(bitarray, bit_index);
+  if (iter->next < bitarray->bit_sz) {
+    // Keep the rest of the current word so the next few calls are a
+    // ctz and a clear-lowest-bit each.
+    iter->word_index = iter->next / WORD_BITS;
+    iter->word = load_word(bitarray->buf, iter->word_index) &
+                 (~0ULL << (iter->next % WORD_BITS));
+  }
+}
+
+bool bitarray_iter_next(bitarray_iter_t* const iter, size_t* const bit_index) {
+  const bitarray_t* const bitarray = iter->bitarray;
+  if (iter->next >= bitarray->bit_sz) {
+    return false;
+  }
+  *bit_index = iter->next;
+
+  iter->word &= iter->word - 1;
+  if (iter->word == 0) {
+    const size_t nwords = (bitarray->bit_sz + WORD_BITS - 1) / WORD_BITS;
+    iter->word_index = skip_words(bitarray->buf, iter->word_index + 1, nwords, 0);
+    if (iter->word_index == nwords) {
+      iter->next = bitarray->bit_sz;
+      return true;
+    }
+    iter->word = load_word(bitarray->buf, iter->word_index);
+  }
+  const size_t next = iter->word_index * WORD_BITS + __builtin_ctzll(iter->word);
+  iter->next = next < bitarray->bit_sz ? next : bitarray->bit_sz;
+  return true;
+}
+
+void bitarray_logic3_range(bitarray_t* const dst,
+                           const size_t dst_offset,
+                           const bitarray_t* const a,
+                           const size_t a_offset,
+                           const bitarray_t* const b,
+                           const size_t b_offset,
+                           const size_t bit_length,
+                           const bitarray_logic_t op) {
+  assert(dst != NULL);
+  logic_range(dst, dst_offset, a, a_offset, b, b_offset, bit_length, op);
+}
+
+void bitarray_logic_range(bitarray_t* const dst,
+                          const size_t dst_offset,
+                          const bitarray_t* const src,
+                          const size_t src_offset,
+                          const size_t bit_length,
+                          const bitarray_logic_t op) {
+  logic_range(dst, dst_offset, dst, dst_offset, src, src_offset, bit_length, op);
+}
+
+void bitarray_logic3(bitarray_t* const dst,
+                     const bitarray_t* const a,
+                     const bitarray_t* const b,
+                     const bitarray_logic_t op) {
+  assert(a->bit_sz == dst->bit_sz && b->bit_sz == dst->bit_sz);
+  logic_range(dst, 0, a, 0, b, 0, dst->bit_sz, op);
+}
+
+void bitarray_logic(bitarray_t* const dst,
+                    const bitarray_t* const src,
+                    const bitarray_logic_t op) {
+  assert(src->bit_sz == dst->bit_sz);
+  logic_range(dst, 0, dst, 0, src, 0, dst->bit_sz, op);
+}
+
+size_t bitarray_logic_count(const bitarray_t* const a,
+                            const size_t a_offset,
+                            const bitarray_t* const b,
+                            const size_t b_offset,
+                            const size_t bit_length,
+                            const bitarray_logic_t op) {
+  return logic_range(NULL, 0, a, a_offset, b, b_offset, bit_length, op);
+}
+
+bool bitarray_equal_range(const bitarray_t* const a,
+                          const size_t a_offset,
+                          const bitarray_t* const b,
+                          const size_t b_offset,
+                          const size_t bit_length) {
+  return range_difference(a, a_offset, b, b_offset, bit_length) == bit_length;
+}
+
+int bitarray_compare_range(const bitarray_t* const a,
+                           const size_t a_offset,
+                           const bitarray_t* const b,
+                           const size_t b_offset,
+                           const size_t bit_length) {
+  const size_t i = range_difference(a, a_offset, b, b_offset, bit_length);
+  if (i == bit_length) {
+    return 0;
+  }
+  return bitarray_get(a, a_offset + i) ? 1 : -1;
+}
+
+uint64_t bitarray_hash_range(const bitarray_t* const bitarray,
+                             const size_t bit_offset,
+                             const size_t bit_length) {
+  assert(bit_offset + bit_length <= bitarray->bit_sz);
+  const char* const buf = bitarray->buf + (bit_offset / WORD_BITS) * sizeof(uint64_t);
+  const size_t shift = bit_offset % WORD_BITS;
+  const size_t nwords = bit_length / WORD_BITS;
+
+  // The range is hashed as the sequence of 64-bit words it would occupy if
+  // it started at bit 0, so the result does not depend on bit_offset.  Four
+  // independent lanes keep the multipliers busy.
+  uint64_t v1 = HASH_PRIME1 + HASH_PRIME2;
+  uint64_t v2 = HASH_PRIME2;
+  uint64_t v3 = 0;
+  uint64_t v4 = -HASH_PRIME1;
+  size_t i = 0;
+  for (; i + 4 <= nwords; i += 4) {
+    v1 = hash_round(v1, funnel(load_word(buf, i), load_word(buf, i + 1), shift));
+    v2 = hash_round(v2, funnel(load_word(buf, i + 1), load_word(buf, i + 2), shift));
+    v3 = hash_round(v3, funnel(load_word(buf, i + 2), load_word(buf, i + 3), shift));
+    v4 = hash_round(v4, funnel(load_word(buf, i + 3), load_word(buf, i + 4), shift));
+  }
+  uint64_t h = ((v1 << 1) | (v1 >> 63)) + ((v2 << 7) | (v2 >> 57)) +
+               ((v3 << 12) | (v3 >> 52)) + ((v4 << 18) | (v4 >> 46));
+  h += bit_length;
+
+  // Then the remaining whole words and the masked partial word.
+  for (; i < nwords; i++) {
+    h ^= hash_round(0, funnel(load_word(buf, i), load_word(buf, i + 1), shift));
+    h = ((h << 27) | (h >> 37)) * HASH_PRIME1 + HASH_PRIME4;
+  }
+  const size_t tail = bit_length % WORD_BITS;
+  if (tail != 0) {
+    const uint64_t word = funnel(load_word(buf, i), load_word(buf, i + 1), shift);
+    h ^= hash_round(0, word & ((1ULL << tail) - 1));
+    h = ((h << 27) | (h >> 37)) * HASH_PRIME1 + HASH_PRIME4;
+  }
+
+  // Final avalanche.
+  h ^= h >> 33;
+  h *= HASH_PRIME2;
+  h ^= h >> 29;
+  h *= HASH_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
 inline static size_t modulo(const ssize_t n, const size_t m) {
   const ssize_t signed_m = (ssize_t)m;
   assert(signed_m > 0);
@@ -282,3 +1579,1161 @@ inline static char bitmask(const size_t bit_index) {
   return 1 << (bit_index % 8);
 }
 
+inline static size_t buf_bytes(const size_t bit_sz) {
+  return ((bit_sz + WORD_BITS - 1) / WORD_BITS + 1) * sizeof(uint64_t);
+}
+
+inline static uint64_t load_word(const char* const buf, const size_t word_index) {
+  return bitarray_load_word(buf, word_index);
+}
+
+inline static void store_word(char* const buf,
+                              const size_t word_index,
+                              const uint64_t word) {
+  memcpy(buf + word_index * sizeof(uint64_t), &word, sizeof(uint64_t));
+}
+
+static char* buf_alloc(size_t* const bytes, bool* const mapped) {
+  if (*bytes < MMAP_THRESHOLD_BYTES) {
+    *mapped = false;
+    return calloc(1, *bytes);
+  }
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  *bytes = (*bytes + page - 1) / page * page;
+  *mapped = true;
+  // Anonymous mappings start out zeroed.
+  char* const buf = mmap(NULL, *bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return buf == MAP_FAILED ? NULL : buf;
+}
+
+static char* buf_resize(char* const buf,
+                        const size_t old_bytes,
+                        size_t* const bytes,
+                        bool* const mapped) {
+  if (!*mapped && *bytes < MMAP_THRESHOLD_BYTES) {
+    return realloc(buf, *bytes);
+  }
+#if defined(__linux__)
+  if (*mapped && *bytes >= MMAP_THRESHOLD_BYTES) {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    *bytes = (*bytes + page - 1) / page * page;
+    char* const new_buf = mremap(buf, old_bytes, *bytes, MREMAP_MAYMOVE);
+    return new_buf == MAP_FAILED ? NULL : new_buf;
+  }
+#endif
+
+  // Otherwise the buffer changes allocator, or there is no mremap: copy.
+  bool new_mapped;
+  char* const new_buf = buf_alloc(bytes, &new_mapped);
+  if (new_buf == NULL) {
+    return NULL;
+  }
+  memcpy(new_buf, buf, old_bytes < *bytes ? old_bytes : *bytes);
+  buf_free(buf, old_bytes, *mapped);
+  *mapped = new_mapped;
+  return new_buf;
+}
+
+static void buf_free(char* const buf, const size_t bytes, const bool mapped) {
+  if (mapped) {
+    munmap(buf, bytes);
+  } else {
+    free(buf);
+  }
+}
+
+inline static size_t arena_round(const size_t bytes) {
+  return (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+}
+
+static char* arena_alloc(bitarray_arena_t* const arena, const size_t bytes) {
+  const size_t rounded = arena_round(bytes);
+  if (rounded <= ARENA_MAX_RECYCLED) {
+    char** const free_list = &arena->free_blocks[rounded / ARENA_ALIGN];
+    char* const block = *free_list;
+    if (block != NULL) {
+      memcpy(free_list, block, sizeof(char*));
+      return block;
+    }
+  }
+  if (rounded <= (size_t)(arena->end - arena->next)) {
+    char* const block = arena->next;
+    arena->next += rounded;
+    return block;
+  }
+
+  // A block too big to share a chunk gets one of its own, and carving
+  // carries on from the current chunk.  Otherwise whatever is left of the
+  // current chunk is abandoned for a new one.
+  const size_t header = arena_round(sizeof(arena_chunk_t));
+  const bool own = rounded > ARENA_CHUNK_BYTES / 4;
+  size_t chunk_bytes = header + (own ? rounded : ARENA_CHUNK_BYTES);
+  bool mapped;
+  char* const chunk_buf = buf_alloc(&chunk_bytes, &mapped);
+  if (chunk_buf == NULL) {
+    return NULL;
+  }
+  arena_chunk_t* const chunk = (arena_chunk_t*)chunk_buf;
+  chunk->next = arena->chunks;
+  chunk->bytes = chunk_bytes;
+  chunk->mapped = mapped;
+  arena->chunks = chunk;
+  char* const block = chunk_buf + header;
+  if (!own) {
+    arena->next = block + rounded;
+    arena->end = chunk_buf + chunk_bytes;
+  }
+  return block;
+}
+
+static void arena_recycle(bitarray_arena_t* const arena,
+                          char* const block,
+                          const size_t bytes) {
+  const size_t rounded = arena_round(bytes);
+  if (rounded > ARENA_MAX_RECYCLED) {
+    return;
+  }
+  char** const free_list = &arena->free_blocks[rounded / ARENA_ALIGN];
+  memcpy(block, free_list, sizeof(char*));
+  *free_list = block;
+}
+
+static bool resize_storage(bitarray_t* const bitarray, size_t capacity) {
+  bool mapped = bitarray->mapped;
+  char* buf;
+  if (storage_small(bitarray) && capacity <= bitarray->capacity) {
+    return true;
+  }
+  if (bitarray->arena != NULL) {
+    // The struct's block keeps its size until the bit array is freed, so
+    // there is nothing to gain by shrinking into a new one.
+    if (capacity <= bitarray->capacity) {
+      return true;
+    }
+    buf = arena_alloc(bitarray->arena, capacity);
+    if (buf == NULL) {
+      return false;
+    }
+    char* const old_buf = bitarray->buf;
+    const size_t old_capacity = bitarray->capacity;
+    const bool in_block = storage_small(bitarray) ||
+                          old_buf == (char*)bitarray + arena_round(sizeof(struct bitarray));
+    const bool shared = bitarray->storage != NULL;
+    memcpy(buf, old_buf, buf_bytes(bitarray->bit_sz));
+    release_storage(bitarray);
+    // A block the bits had to themselves goes back to the arena, unless
+    // snapshots still read it.
+    if (shared) {
+      bitarray->arena_pinned |= in_block;
+    } else if (!in_block) {
+      arena_recycle(bitarray->arena, old_buf, old_capacity);
+    }
+  } else if (bitarray->file_map != NULL || bitarray->storage != NULL ||
+             storage_small(bitarray)) {
+    // A file mapping cannot grow, storage that snapshots share must stay
+    // where it is, and the struct cannot grow either, so copy into new
+    // storage instead.
+    return move_storage(bitarray, capacity);
+  } else {
+    buf = buf_resize(bitarray->buf, bitarray->capacity, &capacity, &mapped);
+    if (buf == NULL) {
+      return false;
+    }
+  }
+  bitarray->buf = buf;
+  bitarray->capacity = capacity;
+  bitarray->mapped = mapped;
+  return true;
+}
+
+static bool move_storage(bitarray_t* const bitarray, size_t capacity) {
+  bool mapped;
+  char* const buf = buf_alloc(&capacity, &mapped);
+  if (buf == NULL) {
+    return false;
+  }
+  const size_t bytes = buf_bytes(bitarray->bit_sz);
+  memcpy(buf, bitarray->buf, bytes < capacity ? bytes : capacity);
+  release_storage(bitarray);
+  bitarray->buf = buf;
+  bitarray->capacity = capacity;
+  bitarray->mapped = mapped;
+  return true;
+}
+
+inline static bool storage_small(const bitarray_t* const bitarray) {
+  return bitarray->buf == (const char*)bitarray->small;
+}
+
+static void bitarray_init(bitarray_t* const bitarray,
+                          const size_t bit_sz,
+                          char* const buf,
+                          const size_t capacity,
+                          const bool mapped,
+                          bitarray_arena_t* const arena) {
+  if (buf == NULL) {
+    memset(bitarray->small, 0, sizeof(bitarray->small));
+    bitarray->buf = (char*)bitarray->small;
+    bitarray->capacity = sizeof(bitarray->small);
+  } else {
+    bitarray->buf = buf;
+    bitarray->capacity = capacity;
+  }
+  bitarray->bit_sz = bit_sz;
+  bitarray->mapped = mapped;
+  bitarray->file_map = NULL;
+  bitarray->file_map_bytes = 0;
+  bitarray->snapshots = NULL;
+  bitarray->storage = NULL;
+  bitarray->shared = NULL;
+  bitarray->shared_chunks = 0;
+  bitarray->arena = arena;
+  bitarray->arena_bytes = 0;
+  bitarray->arena_pinned = false;
+}
+
+static bool header_valid(const file_header_t* const header) {
+  // The bound on bit_sz keeps buf_bytes from overflowing.
+  return memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0 &&
+         header->version == FILE_VERSION &&
+         (header->flags & ~FILE_FLAG_CHECKSUM) == 0 &&
+         header->bit_sz <= SIZE_MAX / 2;
+}
+
+static bool checksum_matches(const bitarray_t* const bitarray,
+                             const file_header_t* const header) {
+  return (header->flags & FILE_FLAG_CHECKSUM) == 0 ||
+         bitarray_hash_range(bitarray, 0, bitarray->bit_sz) == header->checksum;
+}
+
+static bool write_all(const int fd, struct iovec* iov, int iovcnt) {
+  while (iovcnt > 0) {
+    ssize_t written = writev(fd, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    // Skip the buffers written in full, then the written part of the next.
+    while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+static bool read_all(const int fd, char* const dst, const size_t n) {
+  size_t done = 0;
+  while (done < n) {
+    const ssize_t got = read(fd, dst + done, n - done);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    done += got;
+  }
+  return true;
+}
+
+static bool ensure_capacity(bitarray_t* const bitarray, const size_t bit_sz) {
+  if (buf_bytes(bit_sz) <= bitarray->capacity) {
+    return true;
+  }
+  const size_t doubled = (bitarray_get_capacity(bitarray) + WORD_BITS) * 2;
+  return bitarray_reserve(bitarray, bit_sz > doubled ? bit_sz : doubled);
+}
+
+static size_t thread_count(const size_t n) {
+  if (n < PARALLEL_THRESHOLD_BYTES) {
+    return 1;
+  }
+  const long online = sysconf(_SC_NPROCESSORS_ONLN);
+  if (online <= 1) {
+    return 1;
+  }
+  return online < MAX_THREADS ? (size_t)online : MAX_THREADS;
+}
+
+static void* memset_worker(void* const arg) {
+  const memset_chunk_t* const chunk = arg;
+  memset(chunk->dst, chunk->value, chunk->n);
+  return NULL;
+}
+
+static void run_parallel(void* (*worker)(void*),
+                         void* const args,
+                         const size_t arg_size,
+                         const size_t njobs) {
+  assert(njobs <= MAX_THREADS);
+  pthread_t threads[MAX_THREADS];
+  bool created[MAX_THREADS];
+  for (size_t t = 1; t < njobs; t++) {
+    created[t] = pthread_create(&threads[t], NULL, worker,
+                                (char*)args + t * arg_size) == 0;
+    if (!created[t]) {
+      // Couldn't get a thread; do its share inline instead.
+      worker((char*)args + t * arg_size);
+    }
+  }
+  if (njobs > 0) {
+    worker(args);
+  }
+  for (size_t t = 1; t < njobs; t++) {
+    if (created[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+}
+
+static void parallel_memset(char* const dst, const int value, const size_t n) {
+  const size_t nthreads = thread_count(n);
+  if (nthreads == 1) {
+    memset(dst, value, n);
+    return;
+  }
+
+  // Split on 4KB boundaries so no two threads ever share a page.
+  const size_t page = 4096;
+  const size_t per_thread = ((n / nthreads + page - 1) / page) * page;
+
+  memset_chunk_t chunks[MAX_THREADS];
+  size_t njobs = 0;
+  for (size_t begin = 0; begin < n; begin += per_thread, njobs++) {
+    chunks[njobs].dst = dst + begin;
+    chunks[njobs].value = value;
+    chunks[njobs].n = (n - begin < per_thread) ? n - begin : per_thread;
+  }
+  run_parallel(memset_worker, chunks, sizeof(memset_chunk_t), njobs);
+}
+
+inline static uint64_t randfill_word(const uint64_t seed, const size_t word_index) {
+  uint64_t z = seed + (word_index + 1) * RANDFILL_GAMMA;
+  z = (z ^ (z >> 30)) * RANDFILL_MIX1;
+  z = (z ^ (z >> 27)) * RANDFILL_MIX2;
+  return z ^ (z >> 31);
+}
+
+inline static uint64_t density_word(const uint64_t seed,
+                                    const size_t word_index,
+                                    const uint64_t density) {
+  if (density >> DENSITY_BITS) {
+    return ~0ULL;
+  }
+  uint64_t word = 0;
+  for (size_t k = density != 0 ? __builtin_ctzll(density) : DENSITY_BITS;
+       k < DENSITY_BITS; k++) {
+    const uint64_t r = randfill_word(seed, word_index * DENSITY_BITS + k);
+    word = (density >> k) & 1 ? word | r : word & r;
+  }
+  return word;
+}
+
+inline static uint64_t randfill_bits(const uint64_t seed,
+                                     const size_t bit_index,
+                                     const size_t bit_length) {
+  const size_t w = bit_index / WORD_BITS;
+  const uint64_t bits = funnel(randfill_word(seed, w), randfill_word(seed, w + 1),
+                               bit_index % WORD_BITS);
+  return bit_length < WORD_BITS ? bits & ((1ULL << bit_length) - 1) : bits;
+}
+
+static size_t randfill_parallel(bitarray_t* const bitarray,
+                                void* (*worker)(void*),
+                                const randfill_chunk_t* const proto,
+                                randfill_chunk_t chunks[MAX_THREADS]) {
+  const size_t nwords = (bitarray->bit_sz + WORD_BITS - 1) / WORD_BITS;
+  cow_touch(bitarray, 0, nwords * sizeof(uint64_t));
+  const size_t nthreads = thread_count(nwords * sizeof(uint64_t));
+
+  // Split on 4KB boundaries, as parallel_memset does.  Since every word is
+  // drawn on its own, the split does not change the bits.
+  const size_t page_words = 4096 / sizeof(uint64_t);
+  const size_t per_thread = (nwords / nthreads + page_words - 1) / page_words * page_words;
+  size_t njobs = 0;
+  for (size_t begin = 0; begin < nwords; begin += per_thread, njobs++) {
+    chunks[njobs] = *proto;
+    chunks[njobs].buf = bitarray->buf;
+    chunks[njobs].begin = begin;
+    chunks[njobs].end = nwords - begin < per_thread ? nwords : begin + per_thread;
+    chunks[njobs].carry = njobs == 0 ? proto->carry : 0;
+  }
+  run_parallel(worker, chunks, sizeof(randfill_chunk_t), njobs);
+  return njobs;
+}
+
+static void* randfill_worker(void* const arg) {
+  const randfill_chunk_t* const chunk = arg;
+  // No word depends on another, so the compiler is free to vectorize.
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    store_word(chunk->buf, i, randfill_word(chunk->seed, i));
+  }
+  return NULL;
+}
+
+static void* density_worker(void* const arg) {
+  const randfill_chunk_t* const chunk = arg;
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    store_word(chunk->buf, i, density_word(chunk->seed, i, chunk->param));
+  }
+  return NULL;
+}
+
+static void* runs_worker(void* const arg) {
+  randfill_chunk_t* const chunk = arg;
+  uint64_t carry = chunk->carry;
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    // Bit j of the prefix XOR is the parity of the flips at bits 0..j.
+    uint64_t word = density_word(chunk->seed, i, chunk->param);
+    word ^= word << 1;
+    word ^= word << 2;
+    word ^= word << 4;
+    word ^= word << 8;
+    word ^= word << 16;
+    word ^= word << 32;
+    word ^= carry;
+    store_word(chunk->buf, i, word);
+    carry = -(word >> (WORD_BITS - 1));
+  }
+  chunk->carry = carry;
+  return NULL;
+}
+
+static void* invert_worker(void* const arg) {
+  const randfill_chunk_t* const chunk = arg;
+  if (chunk->carry == 0) {
+    return NULL;
+  }
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    store_word(chunk->buf, i, ~load_word(chunk->buf, i));
+  }
+  return NULL;
+}
+
+static void* periodic_worker(void* const arg) {
+  const randfill_chunk_t* const chunk = arg;
+  const size_t period = chunk->param;
+  size_t at = chunk->begin * WORD_BITS % period;
+  if (period >= WORD_BITS) {
+    for (size_t i = chunk->begin; i < chunk->end; i++) {
+      store_word(chunk->buf, i, periodic_word(chunk->seed, period, &at));
+    }
+    return NULL;
+  }
+
+  // A short pattern wraps many times per word, but it only has period
+  // places to start from, so each word it can start a word with is made
+  // once.
+  uint64_t words[WORD_BITS];
+  for (size_t start = 0; start < period; start++) {
+    size_t next = start;
+    words[start] = periodic_word(chunk->seed, period, &next);
+  }
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    store_word(chunk->buf, i, words[at]);
+    at = (at + WORD_BITS) % period;
+  }
+  return NULL;
+}
+
+static uint64_t periodic_word(const uint64_t seed, const size_t period, size_t* const at) {
+  // The pattern is the first period bits of the uniform fill.  The word is
+  // pieced together from where the pattern is at its first bit, wrapping
+  // around as often as it takes.
+  uint64_t word = 0;
+  for (size_t filled = 0; filled < WORD_BITS;) {
+    const size_t left = period - *at;
+    const size_t n = left < WORD_BITS - filled ? left : WORD_BITS - filled;
+    word |= randfill_bits(seed, *at, n) << filled;
+    filled += n;
+    *at = n == left ? 0 : *at + n;
+  }
+  return word;
+}
+
+static void* adversarial_worker(void* const arg) {
+  const randfill_chunk_t* const chunk = arg;
+  for (size_t i = chunk->begin; i < chunk->end; i++) {
+    store_word(chunk->buf, i, 1ULL << (randfill_word(chunk->seed, i) >> (WORD_BITS - 6)));
+  }
+  return NULL;
+}
+
+static uint64_t density_fixed(const double density) {
+  assert(density >= 0 && density <= 1);
+  return (uint64_t)(density * (double)(1ULL << DENSITY_BITS) + 0.5);
+}
+
+static size_t count_bits(const char* const buf,
+                         const size_t bit_offset,
+                         const size_t bit_length) {
+  if (bit_length == 0) {
+    return 0;
+  }
+
+  const size_t first_word = bit_offset / WORD_BITS;
+  const size_t last_word = (bit_offset + bit_length - 1) / WORD_BITS;
+  const uint64_t head_mask = ~0ULL << (bit_offset % WORD_BITS);
+  const uint64_t tail_mask =
+    ~0ULL >> (WORD_BITS - 1 - (bit_offset + bit_length - 1) % WORD_BITS);
+
+  if (first_word == last_word) {
+    return __builtin_popcountll(load_word(buf, first_word) & head_mask & tail_mask);
+  }
+
+  return __builtin_popcountll(load_word(buf, first_word) & head_mask) +
+         popcount_words(buf + (first_word + 1) * sizeof(uint64_t),
+                        last_word - first_word - 1) +
+         __builtin_popcountll(load_word(buf, last_word) & tail_mask);
+}
+
+static size_t popcount_words_scalar(const char* buf, size_t nwords) {
+  // Four independent accumulators keep the popcnt units busy instead of
+  // serializing on a single add chain.
+  size_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+  size_t i = 0;
+  for (; i + 4 <= nwords; i += 4) {
+    c0 += __builtin_popcountll(load_word(buf, i));
+    c1 += __builtin_popcountll(load_word(buf, i + 1));
+    c2 += __builtin_popcountll(load_word(buf, i + 2));
+    c3 += __builtin_popcountll(load_word(buf, i + 3));
+  }
+  for (; i < nwords; i++) {
+    c0 += __builtin_popcountll(load_word(buf, i));
+  }
+  return c0 + c1 + c2 + c3;
+}
+
+#if defined(__x86_64__)
+
+// Per-byte popcount of a 256-bit vector via nibble lookup (Mula), summed
+// into four 64-bit lanes.
+__attribute__((target("avx2")))
+static inline __m256i popcount256(const __m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_and_si256(v, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+// Carry-save adder: (*h, *l) = a + b + c, bitwise.
+__attribute__((target("avx2")))
+static inline void csa256(__m256i* const h, __m256i* const l,
+                          const __m256i a, const __m256i b, const __m256i c) {
+  const __m256i u = _mm256_xor_si256(a, b);
+  *h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+  *l = _mm256_xor_si256(u, c);
+}
+
+// Harley-Seal: a tree of carry-save adders reduces 16 vectors to one
+// "sixteens" vector per iteration, so the expensive popcount runs once per
+// 512 bytes instead of once per 32.
+__attribute__((target("avx2")))
+static size_t popcount_words_avx2(const char* buf, size_t nwords) {
+  const __m256i* const data = (const __m256i*)buf;
+  const size_t nvec = nwords / 4;
+  __m256i total = _mm256_setzero_si256();
+  __m256i ones = _mm256_setzero_si256();
+  __m256i twos = _mm256_setzero_si256();
+  __m256i fours = _mm256_setzero_si256();
+  __m256i eights = _mm256_setzero_si256();
+  __m256i sixteens;
+  __m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+
+  size_t i = 0;
+  for (; i + 16 <= nvec; i += 16) {
+    csa256(&twos_a, &ones, ones, _mm256_loadu_si256(data + i),
+           _mm256_loadu_si256(data + i + 1));
+    csa256(&twos_b, &ones, ones, _mm256_loadu_si256(data + i + 2),
+           _mm256_loadu_si256(data + i + 3));
+    csa256(&fours_a, &twos, twos, twos_a, twos_b);
+    csa256(&twos_a, &ones, ones, _mm256_loadu_si256(data + i + 4),
+           _mm256_loadu_si256(data + i + 5));
+    csa256(&twos_b, &ones, ones, _mm256_loadu_si256(data + i + 6),
+           _mm256_loadu_si256(data + i + 7));
+    csa256(&fours_b, &twos, twos, twos_a, twos_b);
+    csa256(&eights_a, &fours, fours, fours_a, fours_b);
+    csa256(&twos_a, &ones, ones, _mm256_loadu_si256(data + i + 8),
+           _mm256_loadu_si256(data + i + 9));
+    csa256(&twos_b, &ones, ones, _mm256_loadu_si256(data + i + 10),
+           _mm256_loadu_si256(data + i + 11));
+    csa256(&fours_a, &twos, twos, twos_a, twos_b);
+    csa256(&twos_a, &ones, ones, _mm256_loadu_si256(data + i + 12),
+           _mm256_loadu_si256(data + i + 13));
+    csa256(&twos_b, &ones, ones, _mm256_loadu_si256(data + i + 14),
+           _mm256_loadu_si256(data + i + 15));
+    csa256(&fours_b, &twos, twos, twos_a, twos_b);
+    csa256(&eights_b, &fours, fours, fours_a, fours_b);
+    csa256(&sixteens, &eights, eights, eights_a, eights_b);
+    total = _mm256_add_epi64(total, popcount256(sixteens));
+  }
+
+  total = _mm256_slli_epi64(total, 4);
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+  total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+  total = _mm256_add_epi64(total, popcount256(ones));
+  for (; i < nvec; i++) {
+    total = _mm256_add_epi64(total, popcount256(_mm256_loadu_si256(data + i)));
+  }
+
+  size_t count = (size_t)_mm256_extract_epi64(total, 0) +
+                 (size_t)_mm256_extract_epi64(total, 1) +
+                 (size_t)_mm256_extract_epi64(total, 2) +
+                 (size_t)_mm256_extract_epi64(total, 3);
+  return count + popcount_words_scalar(buf + nvec * 32, nwords % 4);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t popcount_words_avx512(const char* buf, size_t nwords) {
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 16 <= nwords; i += 16) {
+    acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(_mm512_loadu_si512(buf + i * 8)));
+    acc1 = _mm512_add_epi64(acc1, _mm512_popcnt_epi64(_mm512_loadu_si512(buf + i * 8 + 64)));
+  }
+  size_t count = (size_t)_mm512_reduce_add_epi64(_mm512_add_epi64(acc0, acc1));
+  return count + popcount_words_scalar(buf + i * 8, nwords - i);
+}
+
+#endif  // defined(__x86_64__)
+
+static size_t popcount_words(const char* const buf, const size_t nwords) {
+  static popcount_kernel_t simd_kernel = NULL;
+  if (nwords < SIMD_COUNT_MIN_WORDS) {
+    return popcount_words_scalar(buf, nwords);
+  }
+  if (simd_kernel == NULL) {
+    // Every thread that races here picks the same kernel, so the unguarded
+    // store is harmless.
+    popcount_kernel_t kernel = popcount_words_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+      kernel = popcount_words_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+      kernel = popcount_words_avx2;
+    }
+#endif
+    simd_kernel = kernel;
+  }
+  return simd_kernel(buf, nwords);
+}
+
+static size_t find_next(const bitarray_t* const bitarray,
+                        const size_t bit_index,
+                        const size_t bit_end,
+                        const uint64_t skip) {
+  assert(bit_end <= bitarray->bit_sz);
+  if (bit_index >= bit_end) {
+    return bit_end;
+  }
+
+  // Flip the words so that the bits we're after are always the ones, and
+  // drop the bits below bit_index from the first word.
+  size_t w = bit_index / WORD_BITS;
+  uint64_t word = (load_word(bitarray->buf, w) ^ skip) & (~0ULL << (bit_index % WORD_BITS));
+  if (word == 0) {
+    const size_t nwords = (bit_end + WORD_BITS - 1) / WORD_BITS;
+    w = skip_words(bitarray->buf, w + 1, nwords, skip);
+    if (w == nwords) {
+      return bit_end;
+    }
+    word = load_word(bitarray->buf, w) ^ skip;
+  }
+
+  // The last word may have bits past bit_end in it.
+  const size_t found = w * WORD_BITS + __builtin_ctzll(word);
+  return found < bit_end ? found : bit_end;
+}
+
+static size_t skip_words_scalar(const char* buf, size_t begin, size_t end, uint64_t skip) {
+  size_t w = begin;
+  // Compare four words per iteration so that long gaps cost one branch per
+  // 32 bytes rather than per word.
+  for (; w + 4 <= end; w += 4) {
+    if (((load_word(buf, w) ^ skip) | (load_word(buf, w + 1) ^ skip) |
+         (load_word(buf, w + 2) ^ skip) | (load_word(buf, w + 3) ^ skip)) != 0) {
+      break;
+    }
+  }
+  for (; w < end; w++) {
+    if (load_word(buf, w) != skip) {
+      return w;
+    }
+  }
+  return end;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static size_t skip_words_avx2(const char* buf, size_t begin, size_t end, uint64_t skip) {
+  const __m256i pattern = _mm256_set1_epi64x((long long)skip);
+  size_t w = begin;
+  // 128 bytes per iteration: XOR each vector against the skipped pattern and
+  // OR the results; one vptest then says whether anything differed.
+  for (; w + 16 <= end; w += 16) {
+    const char* const p = buf + w * sizeof(uint64_t);
+    const __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), pattern);
+    const __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p + 32)), pattern);
+    const __m256i c = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p + 64)), pattern);
+    const __m256i d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p + 96)), pattern);
+    const __m256i any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+    if (!_mm256_testz_si256(any, any)) {
+      break;
+    }
+  }
+  return skip_words_scalar(buf, w, end, skip);
+}
+
+#endif  // defined(__x86_64__)
+
+static size_t skip_words(const char* const buf,
+                         const size_t begin,
+                         const size_t end,
+                         const uint64_t skip) {
+  static skip_kernel_t simd_kernel = NULL;
+
+  // Most gaps are short; only go wide once the first few words are all
+  // skippable.
+  const size_t probe_end = (end - begin > SIMD_SKIP_MIN_WORDS) ?
+                           begin + SIMD_SKIP_MIN_WORDS : end;
+  const size_t w = skip_words_scalar(buf, begin, probe_end, skip);
+  if (w < probe_end || probe_end == end) {
+    return w;
+  }
+
+  if (simd_kernel == NULL) {
+    skip_kernel_t kernel = skip_words_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      kernel = skip_words_avx2;
+    }
+#endif
+    simd_kernel = kernel;
+  }
+  return simd_kernel(buf, probe_end, end, skip);
+}
+
+static bool parse_words_scalar(const char* string, size_t nwords, char* buf) {
+  uint64_t digits_seen = 0;
+  for (size_t w = 0; w < nwords; w++) {
+    uint64_t word = 0;
+    for (size_t b = 0; b < sizeof(uint64_t); b++) {
+      uint64_t chars;
+      memcpy(&chars, string + w * WORD_BITS + b * 8, sizeof(chars));
+      const uint64_t digits = chars ^ TEXT_ZEROS;
+      digits_seen |= digits;
+      word |= ((digits * TEXT_GATHER) >> 56) << (b * 8);
+    }
+    store_word(buf, w, word);
+  }
+  return (digits_seen & ~TEXT_LOW_BITS) == 0;
+}
+
+static void format_words_scalar(const char* buf, size_t shift, size_t nwords, char* string) {
+  for (size_t w = 0; w < nwords; w++) {
+    const uint64_t word = funnel(load_word(buf, w), load_word(buf, w + 1), shift);
+    for (size_t b = 0; b < sizeof(uint64_t); b++) {
+      // Copy the byte into every byte, keep bit i in byte i, and carry any
+      // kept bit up into the byte's top bit to read it back as 0 or 1.
+      const uint64_t kept = (((word >> (b * 8)) & 0xff) * TEXT_LOW_BITS) & TEXT_SPREAD_MASK;
+      const uint64_t chars = (((kept + 0x7f * TEXT_LOW_BITS) >> 7) & TEXT_LOW_BITS) | TEXT_ZEROS;
+      memcpy(string + w * WORD_BITS + b * 8, &chars, sizeof(chars));
+    }
+  }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static bool parse_words_avx2(const char* string, size_t nwords, char* buf) {
+  const __m256i zeros = _mm256_set1_epi8('0');
+  __m256i digits_seen = _mm256_setzero_si256();
+  for (size_t w = 0; w < nwords; w++) {
+    const char* const p = string + w * WORD_BITS;
+    const __m256i lo = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)p), zeros);
+    const __m256i hi = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(p + 32)), zeros);
+    digits_seen = _mm256_or_si256(digits_seen, _mm256_or_si256(lo, hi));
+    // Move each digit up to its byte's top bit, where movemask reads it.
+    const uint32_t lo_bits = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(lo, 7));
+    const uint32_t hi_bits = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(hi, 7));
+    store_word(buf, w, lo_bits | (uint64_t)hi_bits << 32);
+  }
+  return _mm256_testz_si256(digits_seen, _mm256_set1_epi8((char)0xfe));
+}
+
+__attribute__((target("avx2")))
+static void format_words_avx2(const char* buf, size_t shift, size_t nwords, char* string) {
+  // Byte j of a half takes byte j / 8 of its 32 bits and keeps bit j % 8;
+  // the shuffle works within 128-bit lanes, so the high lane indexes bytes
+  // 2 and 3 of the broadcast.
+  const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                          2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i mask = _mm256_set1_epi64x((long long)TEXT_SPREAD_MASK);
+  const __m256i zeros = _mm256_set1_epi8('0');
+  for (size_t w = 0; w < nwords; w++) {
+    const uint64_t word = funnel(load_word(buf, w), load_word(buf, w + 1), shift);
+    for (size_t half = 0; half < 2; half++) {
+      const __m256i bits = _mm256_shuffle_epi8(
+          _mm256_set1_epi32((int)(uint32_t)(word >> (half * 32))), spread);
+      const __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(bits, mask), mask);
+      // set is -1 where the bit is set, so subtracting it makes '1'.
+      _mm256_storeu_si256((__m256i*)(string + w * WORD_BITS + half * 32),
+                          _mm256_sub_epi8(zeros, set));
+    }
+  }
+}
+
+#endif  // defined(__x86_64__)
+
+static bool parse_words(const char* const string, const size_t nwords, char* const buf) {
+  static parse_kernel_t simd_kernel = NULL;
+  if (simd_kernel == NULL) {
+    parse_kernel_t kernel = parse_words_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      kernel = parse_words_avx2;
+    }
+#endif
+    simd_kernel = kernel;
+  }
+  return simd_kernel(string, nwords, buf);
+}
+
+static void format_words(const char* const buf,
+                         const size_t shift,
+                         const size_t nwords,
+                         char* const string) {
+  static format_kernel_t simd_kernel = NULL;
+  if (simd_kernel == NULL) {
+    format_kernel_t kernel = format_words_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      kernel = format_words_avx2;
+    }
+#endif
+    simd_kernel = kernel;
+  }
+  simd_kernel(buf, shift, nwords, string);
+}
+
+inline static uint64_t funnel(const uint64_t lo, const uint64_t hi, const size_t shift) {
+  return (lo >> shift) | ((hi << 1) << (WORD_BITS - 1 - shift));
+}
+
+static size_t logic_words(char* const dst,
+                          const char* const a,
+                          const size_t a_shift,
+                          const char* const b,
+                          const size_t b_shift,
+                          const size_t nwords,
+                          const bitarray_logic_t op) {
+  // One loop per operation, so that the switch is out of the loop body and
+  // each loop vectorizes on its own.
+#define LOGIC_LOOP(expr)                                             \
+  do {                                                               \
+    if (dst == NULL) {                                               \
+      size_t count = 0;                                              \
+      for (size_t i = 0; i < nwords; i++) {                          \
+        const uint64_t x = funnel(load_word(a, i), load_word(a, i + 1), a_shift); \
+        const uint64_t y = funnel(load_word(b, i), load_word(b, i + 1), b_shift); \
+        count += __builtin_popcountll(expr);                         \
+      }                                                              \
+      return count;                                                  \
+    }                                                                \
+    for (size_t i = 0; i < nwords; i++) {                            \
+      const uint64_t x = funnel(load_word(a, i), load_word(a, i + 1), a_shift); \
+      const uint64_t y = funnel(load_word(b, i), load_word(b, i + 1), b_shift); \
+      store_word(dst, i, (expr));                                    \
+    }                                                                \
+    return 0;                                                        \
+  } while (0)
+
+  switch (op) {
+  case BITARRAY_AND:
+    LOGIC_LOOP(x & y);
+  case BITARRAY_OR:
+    LOGIC_LOOP(x | y);
+  case BITARRAY_XOR:
+    LOGIC_LOOP(x ^ y);
+  case BITARRAY_ANDNOT:
+    LOGIC_LOOP(x & ~y);
+  }
+#undef LOGIC_LOOP
+  assert(false);
+  return 0;
+}
+
+static size_t logic_range(bitarray_t* const dst,
+                          const size_t dst_offset,
+                          const bitarray_t* const a,
+                          const size_t a_offset,
+                          const bitarray_t* const b,
+                          const size_t b_offset,
+                          const size_t bit_length,
+                          const bitarray_logic_t op) {
+  assert(a_offset + bit_length <= a->bit_sz);
+  assert(b_offset + bit_length <= b->bit_sz);
+  assert(dst == NULL || dst_offset + bit_length <= dst->bit_sz);
+  if (bit_length == 0) {
+    return 0;
+  }
+
+  // Words are walked along the destination, or along a when only counting.
+  const size_t base = dst != NULL ? dst_offset : a_offset;
+  const size_t end = base + bit_length;
+  const size_t first_word = base / WORD_BITS;
+  const size_t last_word = (end - 1) / WORD_BITS;
+
+  if (dst != NULL) {
+    cow_touch(dst, first_word * sizeof(uint64_t), (last_word + 1) * sizeof(uint64_t));
+  }
+
+  // Like memmove: if an operand shares the destination's buffer and starts
+  // before it, go from the top down so nothing is overwritten before it is
+  // read.
+  const bool backward = dst != NULL &&
+                        ((dst == a && a_offset < dst_offset) ||
+                         (dst == b && b_offset < dst_offset));
+
+  // The words strictly between the first and last are whole, so they go
+  // through the word kernel; when the operands line up with the destination
+  // modulo 64 its funnel shifts are by zero.
+  if (!backward && last_word > first_word + 1) {
+    // Head word, whole middle words, then tail word, in that order so that
+    // overlapping operands ahead of the destination are read before they
+    // are overwritten.
+    size_t count = logic_range(dst, dst_offset, a, a_offset, b, b_offset,
+                               (first_word + 1) * WORD_BITS - base, op);
+    const size_t nwords = last_word - first_word - 1;
+    const size_t middle = (first_word + 1) * WORD_BITS - base;
+    const size_t a_bit = a_offset + middle;
+    const size_t b_bit = b_offset + middle;
+    count += logic_words(dst != NULL ? dst->buf + (first_word + 1) * sizeof(uint64_t) : NULL,
+                         a->buf + (a_bit / WORD_BITS) * sizeof(uint64_t), a_bit % WORD_BITS,
+                         b->buf + (b_bit / WORD_BITS) * sizeof(uint64_t), b_bit % WORD_BITS,
+                         nwords, op);
+    const size_t done = (last_word * WORD_BITS) - base;
+    count += logic_range(dst, dst_offset + (dst != NULL ? done : 0),
+                         a, a_offset + done, b, b_offset + done,
+                         bit_length - done, op);
+    return count;
+  }
+
+  size_t count = 0;
+  for (size_t k = 0; k <= last_word - first_word; k++) {
+    const size_t w = backward ? last_word - k : first_word + k;
+
+    // The part of this word inside the range, as absolute bit indices.
+    const size_t start = (w * WORD_BITS > base) ? w * WORD_BITS : base;
+    const size_t stop = ((w + 1) * WORD_BITS < end) ? (w + 1) * WORD_BITS : end;
+    const size_t shift = start - w * WORD_BITS;
+    const uint64_t mask = (~0ULL >> (WORD_BITS - (stop - start))) << shift;
+
+    // Operand bits for [start, stop), moved into place within the word.
+    const uint64_t x = bitarray_get_u64(a, a_offset + (start - base)) << shift;
+    const uint64_t y = bitarray_get_u64(b, b_offset + (start - base)) << shift;
+    const uint64_t result = bitarray_logic_word(op, x, y) & mask;
+
+    if (dst == NULL) {
+      count += __builtin_popcountll(result);
+    } else {
+      store_word(dst->buf, w, (load_word(dst->buf, w) & ~mask) | result);
+    }
+  }
+  return count;
+}
+
+static size_t first_difference(const char* const a,
+                               const size_t a_shift,
+                               const char* const b,
+                               const size_t b_shift,
+                               const size_t nwords) {
+  size_t i = 0;
+  // Whole blocks first, with a single test per block.
+  for (; i + COMPARE_BLOCK_WORDS <= nwords; i += COMPARE_BLOCK_WORDS) {
+    uint64_t diff = 0;
+    for (size_t k = i; k < i + COMPARE_BLOCK_WORDS; k++) {
+      diff |= funnel(load_word(a, k), load_word(a, k + 1), a_shift) ^
+              funnel(load_word(b, k), load_word(b, k + 1), b_shift);
+    }
+    if (diff != 0) {
+      break;
+    }
+  }
+  for (; i < nwords; i++) {
+    if (funnel(load_word(a, i), load_word(a, i + 1), a_shift) !=
+        funnel(load_word(b, i), load_word(b, i + 1), b_shift)) {
+      return i;
+    }
+  }
+  return nwords;
+}
+
+static size_t range_difference(const bitarray_t* const a,
+                               const size_t a_offset,
+                               const bitarray_t* const b,
+                               const size_t b_offset,
+                               const size_t bit_length) {
+  assert(a_offset + bit_length <= a->bit_sz);
+  assert(b_offset + bit_length <= b->bit_sz);
+  const char* const a_buf = a->buf + (a_offset / WORD_BITS) * sizeof(uint64_t);
+  const char* const b_buf = b->buf + (b_offset / WORD_BITS) * sizeof(uint64_t);
+  const size_t a_shift = a_offset % WORD_BITS;
+  const size_t b_shift = b_offset % WORD_BITS;
+  const size_t nwords = bit_length / WORD_BITS;
+
+  // Both reads of the last, partial word stay within the slack word.
+  const size_t i = first_difference(a_buf, a_shift, b_buf, b_shift, nwords);
+  const size_t tail = i < nwords ? WORD_BITS : bit_length % WORD_BITS;
+  if (tail == 0) {
+    return bit_length;
+  }
+  uint64_t diff = funnel(load_word(a_buf, i), load_word(a_buf, i + 1), a_shift) ^
+                  funnel(load_word(b_buf, i), load_word(b_buf, i + 1), b_shift);
+  if (tail < WORD_BITS) {
+    diff &= (1ULL << tail) - 1;
+  }
+  return diff != 0 ? i * WORD_BITS + __builtin_ctzll(diff) : bit_length;
+}
+
+static void storage_free(char* const buf,
+                         const size_t capacity,
+                         const bool mapped,
+                         char* const file_map,
+                         const size_t file_map_bytes) {
+  if (file_map != NULL) {
+    munmap(file_map, file_map_bytes);
+  } else {
+    buf_free(buf, capacity, mapped);
+  }
+}
+
+static void release_storage(bitarray_t* const bitarray) {
+  shared_storage_t* const storage = bitarray->storage;
+  if (storage == NULL) {
+    if (bitarray->arena == NULL && !storage_small(bitarray)) {
+      storage_free(bitarray->buf, bitarray->capacity, bitarray->mapped,
+                   bitarray->file_map, bitarray->file_map_bytes);
+    }
+  } else {
+    // The snapshots keep reading the old storage, which nothing writes to
+    // any more, until the last of them lets go of it.
+    storage->retired = true;
+    storage->buf = bitarray->buf;
+    storage->capacity = bitarray->capacity;
+    storage->mapped = bitarray->mapped;
+    storage->file_map = bitarray->file_map;
+    storage->file_map_bytes = bitarray->file_map_bytes;
+    storage->borrowed = bitarray->arena != NULL;
+    for (bitarray_snapshot_t* s = bitarray->snapshots; s != NULL; s = s->next) {
+      s->source = NULL;
+    }
+    bitarray->snapshots = NULL;
+    bitarray->storage = NULL;
+    free(bitarray->shared);
+    bitarray->shared = NULL;
+    bitarray->shared_chunks = 0;
+  }
+  bitarray->file_map = NULL;
+  bitarray->file_map_bytes = 0;
+}
+
+inline static void cow_touch(bitarray_t* const bitarray,
+                             const size_t byte_begin,
+                             const size_t byte_end) {
+  if (bitarray->shared != NULL) {
+    cow_copy_chunks(bitarray, byte_begin, byte_end);
+  }
+}
+
+static void cow_copy_chunks(bitarray_t* const bitarray,
+                            const size_t byte_begin,
+                            const size_t byte_end) {
+  const size_t first = byte_begin / SNAPSHOT_CHUNK_BYTES;
+  size_t stop = (byte_end + SNAPSHOT_CHUNK_BYTES - 1) / SNAPSHOT_CHUNK_BYTES;
+  if (stop > bitarray->shared_chunks) {
+    stop = bitarray->shared_chunks;
+  }
+  for (size_t c = first; c < stop; c++) {
+    if (!atomic_load_explicit(&bitarray->shared[c], memory_order_acquire)) {
+      continue;
+    }
+    for (bitarray_snapshot_t* s = bitarray->snapshots; s != NULL; s = s->next) {
+      if (c >= s->nchunks) {
+        continue;
+      }
+      // Whoever claims the chunk copies it; anyone else writing to it, with
+      // the atomic operations, waits for the copy before going ahead.
+      unsigned char state = CHUNK_SHARED;
+      if (atomic_compare_exchange_strong_explicit(&s->copied[c], &state, CHUNK_COPYING,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire)) {
+        const size_t at = c * SNAPSHOT_CHUNK_BYTES;
+        const size_t n = s->bytes - at < SNAPSHOT_CHUNK_BYTES ?
+                         s->bytes - at : SNAPSHOT_CHUNK_BYTES;
+        memcpy(s->copies + at, bitarray->buf + at, n);
+        atomic_store_explicit(&s->copied[c], CHUNK_COPIED, memory_order_release);
+      } else {
+        while (atomic_load_explicit(&s->copied[c], memory_order_acquire) != CHUNK_COPIED) {
+        }
+      }
+    }
+    atomic_store_explicit(&bitarray->shared[c], 0, memory_order_release);
+  }
+  // Keep the writes that follow from overtaking the CHUNK_COPIED stores, so
+  // that a reader who sees them also sees that the chunk was copied.
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void snapshot_read(const bitarray_snapshot_t* const snapshot,
+                          const size_t at,
+                          char* const dst,
+                          const size_t n) {
+  atomic_uchar* const state = &snapshot->copied[at / SNAPSHOT_CHUNK_BYTES];
+  if (atomic_load_explicit(state, memory_order_acquire) != CHUNK_COPIED) {
+    memcpy(dst, snapshot->live + at, n);
+    // A writer copies a chunk out before touching it, so if what we read
+    // might have been written, the copy is there to read instead.
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(state, memory_order_relaxed) != CHUNK_COPIED) {
+      return;
+    }
+  }
+  memcpy(dst, snapshot->copies + at, n);
+}
+
+inline static _Atomic uint64_t* atomic_word(const bitarray_t* const bitarray,
+                                            const size_t word_index) {
+  assert((uintptr_t)bitarray->buf % sizeof(uint64_t) == 0);
+  return (_Atomic uint64_t*)(bitarray->buf + word_index * sizeof(uint64_t));
+}
+
+inline static memory_order rmw_order(const bitarray_order_t order) {
+  return order == BITARRAY_ACQ_REL ? memory_order_acq_rel : memory_order_relaxed;
+}
+
+inline static uint64_t hash_round(uint64_t acc, const uint64_t word) {
+  acc += word * HASH_PRIME2;
+  acc = (acc << 31) | (acc >> 33);
+  return acc * HASH_PRIME1;
+}
@@ -25,27 +25,265 @@
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// ********************************* Macros *********************************
+
+// Number of bits in a word of the storage bitarray_get_buf returns.
+#define BITARRAY_WORD_BITS 64
 
 // ********************************* Types **********************************
 
 // Abstract data type representing an array of bits.
 typedef struct bitarray bitarray_t;
 
+// Abstract data type representing a copy-on-write snapshot of a bit array.
+typedef struct bitarray_snapshot bitarray_snapshot_t;
+
+// Abstract data type representing an arena that many small bit arrays are
+// allocated from and released with at once.
+typedef struct bitarray_arena bitarray_arena_t;
+
+// A bitwise operation applied by the bitarray_logic functions.  ANDNOT
+// computes a & ~b.
+typedef enum {
+  BITARRAY_AND,
+  BITARRAY_OR,
+  BITARRAY_XOR,
+  BITARRAY_ANDNOT
+} bitarray_logic_t;
+
+// Returns x op y, for the modules that combine words of bit arrays.
+static inline uint64_t bitarray_logic_word(const bitarray_logic_t op,
+                                           const uint64_t x,
+                                           const uint64_t y) {
+  switch (op) {
+  case BITARRAY_AND:
+    return x & y;
+  case BITARRAY_OR:
+    return x | y;
+  case BITARRAY_XOR:
+    return x ^ y;
+  case BITARRAY_ANDNOT:
+    return x & ~y;
+  }
+  return 0;
+}
+
+// Memory ordering of the atomic bit operations.  RELAXED makes only the bit
+// update itself atomic.  ACQ_REL also orders the caller's other memory
+// accesses around it, so a thread that sees a bit another thread set also
+// sees everything that thread wrote before setting it.
+typedef enum {
+  BITARRAY_RELAXED,
+  BITARRAY_ACQ_REL
+} bitarray_order_t;
+
+// Iterator over the set bits of a bit array, in increasing order.  Its
+// fields are private; it is only declared here so that it can live on the
+// stack.  See bitarray_iter_init.
+typedef struct {
+  const bitarray_t* bitarray;
+  size_t next;
+  size_t word_index;
+  uint64_t word;
+} bitarray_iter_t;
+
 // ******************************* Prototypes *******************************
 
 // Allocates space for a new bit array.
 // bit_sz is the number of bits storable in the resultant bit array
 bitarray_t* bitarray_new(const size_t bit_sz);
 
-// Frees a bit array allocated by bitarray_new.
+// Frees a bit array allocated by bitarray_new or bitarray_arena_alloc.
 void bitarray_free(bitarray_t* const bitarray);
 
+// Allocates an empty arena, or returns NULL if memory could not be
+// allocated.  An arena carves each of its bit arrays, the struct and the
+// bits together, out of one block of a large chunk, so allocating and
+// freeing small bit arrays costs no call to malloc or free.  An arena does
+// no locking: each thread allocating bit arrays should have its own.
+bitarray_arena_t* bitarray_arena_new(void);
+
+// Allocates a zeroed bit array of bit_sz bits from an arena, or returns
+// NULL if memory could not be allocated.  It works like one from
+// bitarray_new.  Growing it moves its bits to a new block of the same
+// arena, giving back the block they had to themselves, if any.
+// bitarray_free gives its blocks back to the arena to reuse.  Blocks whose
+// bits snapshots were still reading when they moved or were freed are only
+// reclaimed by bitarray_arena_free.
+bitarray_t* bitarray_arena_alloc(bitarray_arena_t* const arena,
+                                 const size_t bit_sz);
+
+// Frees an arena along with every bit array still allocated from it, none
+// of which may be used afterwards.  Any snapshots of those bit arrays must
+// be freed first.
+void bitarray_arena_free(bitarray_arena_t* const arena);
+
+// Returns how many bits a bit array can hold before appending to it has to
+// reallocate its storage.
+size_t bitarray_get_capacity(const bitarray_t* const bitarray);
+
+// Makes room for at least bit_capacity bits without changing the size.
+// Returns false, leaving the bit array untouched, if memory could not be
+// allocated.
+bool bitarray_reserve(bitarray_t* const bitarray, const size_t bit_capacity);
+
+// Appends a bit to the end of a bit array, growing its storage
+// geometrically when full so that n appends cost amortized O(n).  Large
+// arrays grow by remapping pages where the platform allows (mremap on
+// Linux) rather than copying.  Returns false, leaving the bit array
+// untouched, if memory could not be allocated.
+//
+// Resizing invalidates the pointer returned by bitarray_get_buf.
+bool bitarray_append(bitarray_t* const bitarray, const bool value);
+
+// Appends bit_length bits packed into words, bit i being bit (i % 64) of
+// words[i / 64], like bitarray_append.  words must hold
+// ceil(bit_length / 64) words; bits of the last one past bit_length are
+// ignored.
+bool bitarray_append_bits(bitarray_t* const bitarray,
+                          const uint64_t* const words,
+                          const size_t bit_length);
+
+// Shortens a bit array to its first bit_sz bits, which requires bit_sz to be
+// at most its size.  The capacity is kept for later appends.
+void bitarray_truncate(bitarray_t* const bitarray, const size_t bit_sz);
+
+// Releases the capacity a bit array does not need for its current size.
+// Returns false, leaving the bit array untouched, if memory could not be
+// reallocated.
+bool bitarray_shrink_to_fit(bitarray_t* const bitarray);
+
 // Returns the number of bits stored in a bit array.
 // Note the invariant bitarray_get_bit_sz(bitarray_new(n)) = n.
 size_t bitarray_get_bit_sz(const bitarray_t* const bitarray);
 
-// Does a random fill of all the bits in the bit array.
-void bitarray_randfill(bitarray_t* const bitarray);
+// Returns the packed storage of a bit array, for modules that build their
+// own word-level structures on top of it.  Bit i is bit (i % 64) of the
+// little-endian 64-bit word i / 64.  The buffer holds ceil(bit_sz / 64)
+// words plus one word of slack; bits at or past bit_sz have unspecified
+// values.
+const char* bitarray_get_buf(const bitarray_t* const bitarray);
+
+// Loads the word_index th word of a buffer laid out like bitarray_get_buf's.
+static inline uint64_t bitarray_load_word(const char* const buf, const size_t word_index) {
+  uint64_t word;
+  memcpy(&word, buf + word_index * sizeof(uint64_t), sizeof(uint64_t));
+  return word;
+}
+
+// Writes a bit array to fd in the binary format: a 64-byte header holding a
+// magic string, the format version, flags, bit_sz and a checksum of the
+// bits, followed by the words exactly as bitarray_get_buf lays them out,
+// slack word included and bits past bit_sz cleared.  The words go from the
+// bit array's storage to the kernel with a single writev, without copying.
+// Returns false if the write failed.
+bool bitarray_write(const bitarray_t* const bitarray, const int fd);
+
+// Reads a bit array in the binary format from fd, which may be a pipe or a
+// socket, reading the words straight into the new bit array's storage.
+// Returns NULL if the header is not one of this version, the checksum does
+// not match, memory could not be allocated, or the read failed.
+bitarray_t* bitarray_read(const int fd);
+
+// Maps a file in the binary format as a bit array without reading it: the
+// file's words become the bit array's storage, paged in as they are
+// touched.  Only the header is checked unless verify is true, in which case
+// the checksum is too, which reads every word.  Changes to the bit array
+// stay private to it and never reach the file, and resizing it moves it to
+// storage of its own.  fd may be closed afterwards.  Returns NULL if the
+// header is not one of this version, the file is too short, the checksum
+// does not match, or the file could not be mapped.
+bitarray_t* bitarray_map(const int fd, const bool verify);
+
+// Returns a new bit array parsed from a string of '0' and '1' characters,
+// character i giving bit i.  The characters are converted a word at a time,
+// 64 per step with AVX2 and 8 per step without.  Returns NULL if any other
+// character appears or memory could not be allocated.
+bitarray_t* bitarray_from_string(const char* const string);
+
+// Writes the bits of [bit_offset, bit_offset + bit_length) into string as
+// '0' and '1' characters, followed by a terminating NUL; string must have
+// room for bit_length + 1 characters.  The inverse of bitarray_from_string.
+void bitarray_to_string(const bitarray_t* const bitarray,
+                        const size_t bit_offset,
+                        const size_t bit_length,
+                        char* const string);
+
+// Takes a snapshot of a bit array: a read-only copy of its bits as they are
+// now, which shares the bit array's storage in 4096-byte chunks.  Taking one
+// costs a byte per chunk and no copying; afterwards, the first write to a
+// chunk through any of the bit array's functions copies that chunk out for
+// the snapshot, so writes cost extra space only for the chunks they touch.
+// Resizing or freeing the bit array hands its old storage over to its
+// snapshots, leaving them intact.  Returns NULL if memory could not be
+// allocated.
+//
+// Snapshots are taken and freed by the thread that owns the bit array.
+// Other threads can read a snapshot without locking while the owner keeps
+// writing the bit array.
+bitarray_snapshot_t* bitarray_snapshot(bitarray_t* const bitarray);
+
+// Frees a snapshot.  The bit array is untouched.
+void bitarray_snapshot_free(bitarray_snapshot_t* const snapshot);
+
+// Returns the number of bits in a snapshot.
+size_t bitarray_snapshot_get_bit_sz(const bitarray_snapshot_t* const snapshot);
+
+// Returns the number of bytes a snapshot uses, counting the chunks it has
+// had to copy but not the storage it still shares.
+size_t bitarray_snapshot_get_space(const bitarray_snapshot_t* const snapshot);
+
+// Returns bit bit_index of a snapshot.
+bool bitarray_snapshot_get(const bitarray_snapshot_t* const snapshot,
+                           const size_t bit_index);
+
+// Returns the number of set bits of a snapshot in the subarray
+// [bit_offset, bit_offset + bit_length).
+size_t bitarray_snapshot_count(const bitarray_snapshot_t* const snapshot,
+                               const size_t bit_offset,
+                               const size_t bit_length);
+
+// Returns a new bit array holding a snapshot's bits, or NULL if memory could
+// not be allocated.
+bitarray_t* bitarray_snapshot_copy(const bitarray_snapshot_t* const snapshot);
+
+// Fills the bit array with pseudorandom bits drawn from seed.  Word i of
+// the bits is a function of seed and i alone, so the same seed gives the
+// same bits on every platform, and large bit arrays are filled by several
+// threads at once.
+void bitarray_randfill(bitarray_t* const bitarray, const uint64_t seed);
+
+// Structured random fills, for benchmarks that need bits other than
+// uniform noise.  Like bitarray_randfill, each is determined by its
+// parameters and seed alone, and large bit arrays are filled by several
+// threads at once.
+//
+// bitarray_randfill_density sets each bit with probability density, which
+// is rounded to a multiple of 2^-32.
+void bitarray_randfill_density(bitarray_t* const bitarray,
+                               const double density,
+                               const uint64_t seed);
+
+// Fills the bit array with alternating runs of 0s and 1s, starting with a
+// random bit, whose lengths are geometrically distributed with mean
+// mean_run bits.  Requires mean_run >= 1.
+void bitarray_randfill_runs(bitarray_t* const bitarray,
+                            const double mean_run,
+                            const uint64_t seed);
+
+// Fills the bit array with one random pattern of period bits, repeated.
+// Requires period >= 1.
+void bitarray_randfill_periodic(bitarray_t* const bitarray,
+                                const size_t period,
+                                const uint64_t seed);
+
+// Sets exactly one bit, at a random position, in each 64-bit word.  The
+// bits are too sparse to be worth scanning word by word, yet no word is
+// empty for a scan to skip or for a run-length encoding to compress.
+void bitarray_randfill_adversarial(bitarray_t* const bitarray, const uint64_t seed);
 
 // Indexes into a bit array, retreiving the bit at the specified zero-based
 // index.
@@ -56,6 +294,203 @@ void bitarray_set(bitarray_t* const bitarray,
                   const size_t bit_index,
                   const bool value);
 
+// Returns the 64 bits starting at bit_index, with bit bit_index + i in bit i
+// of the result.  Requires bit_index < bit_sz; bits of the result at or past
+// bit_sz are unspecified.
+uint64_t bitarray_get_u64(const bitarray_t* const bitarray,
+                          const size_t bit_index);
+
+// Stores value into the 64 bits starting at bit_index, bit i of value going
+// to bit bit_index + i.  Requires bit_index < bit_sz; bits that would land
+// at or past bit_sz go to the buffer's slack and are lost.
+void bitarray_set_u64(bitarray_t* const bitarray,
+                      const size_t bit_index,
+                      const uint64_t value);
+
+// Atomic bit operations, for bit arrays that several threads update at
+// once.  Each is a single C11 atomic operation on the 64-bit word holding
+// the bit, so concurrent calls on the same bit array, even on neighbouring
+// bits, never lose an update.  They must not run concurrently with the
+// non-atomic functions that modify the bit array, nor with resizing it.
+//
+// bitarray_atomic_get returns the bit.  bitarray_atomic_set and
+// bitarray_atomic_clear set it to 1 and 0.  bitarray_atomic_test_and_set
+// sets it and returns its previous value, so of several threads setting the
+// same bit exactly one sees false.
+bool bitarray_atomic_get(const bitarray_t* const bitarray,
+                         const size_t bit_index,
+                         const bitarray_order_t order);
+void bitarray_atomic_set(bitarray_t* const bitarray,
+                         const size_t bit_index,
+                         const bitarray_order_t order);
+void bitarray_atomic_clear(bitarray_t* const bitarray,
+                           const size_t bit_index,
+                           const bitarray_order_t order);
+bool bitarray_atomic_test_and_set(bitarray_t* const bitarray,
+                                  const size_t bit_index,
+                                  const bitarray_order_t order);
+
+// Atomically ORs mask into word word_index, the bits
+// [64 * word_index, 64 * word_index + 64), and returns the word's previous
+// value.  Requires word_index < ceil(bit_sz / 64); mask bits at or past
+// bit_sz land in the buffer's slack.
+uint64_t bitarray_atomic_fetch_or(bitarray_t* const bitarray,
+                                  const size_t word_index,
+                                  const uint64_t mask,
+                                  const bitarray_order_t order);
+
+// Sets every bit of a subarray to value.
+//
+// bit_offset is the index of the start of the subarray
+// bit_length is the length of the subarray, in bits
+//
+// The subarray spans the half-open interval
+// [bit_offset, bit_offset + bit_length).  Whole bytes are filled with memset,
+// split across threads when the range is large.
+void bitarray_fill_range(bitarray_t* const bitarray,
+                         const size_t bit_offset,
+                         const size_t bit_length,
+                         const bool value);
+
+// Returns the number of set bits in the subarray
+// [bit_offset, bit_offset + bit_length).  Long ranges are counted with the
+// fastest popcount kernel the CPU supports.
+size_t bitarray_count(const bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length);
+
+// Returns the index of the first set bit at or after bit_index, or the size
+// of the bit array if there is none.  Runs of zero words are skipped with
+// vector compares where the CPU supports them.
+size_t bitarray_find_next_set(const bitarray_t* const bitarray,
+                              const size_t bit_index);
+
+// Returns the index of the first clear bit at or after bit_index, or the
+// size of the bit array if there is none.
+size_t bitarray_find_next_clear(const bitarray_t* const bitarray,
+                                const size_t bit_index);
+
+// Like bitarray_find_next_set and bitarray_find_next_clear, but only look
+// at bits before bit_end, and return bit_end if there is none.  bit_end may
+// be at most the size of the bit array.
+size_t bitarray_find_next_set_until(const bitarray_t* const bitarray,
+                                    const size_t bit_index,
+                                    const size_t bit_end);
+size_t bitarray_find_next_clear_until(const bitarray_t* const bitarray,
+                                      const size_t bit_index,
+                                      const size_t bit_end);
+
+// Starts an iteration over the set bits of bitarray at or after bit_index.
+// The bit array must not be modified while the iteration is in progress.
+//
+// Example:
+// bitarray_iter_t iter;
+// size_t i;
+// bitarray_iter_init(&iter, ba, 0);
+// while (bitarray_iter_next(&iter, &i)) {
+//   ... bit i of ba is set ...
+// }
+void bitarray_iter_init(bitarray_iter_t* const iter,
+                        const bitarray_t* const bitarray,
+                        const size_t bit_index);
+
+// Stores the index of the next set bit in *bit_index and returns true, or
+// returns false once there are no set bits left.
+bool bitarray_iter_next(bitarray_iter_t* const iter, size_t* const bit_index);
+
+// Combines two subarrays bit by bit and stores the result in a third:
+// bit dst_offset + i of dst becomes (bit a_offset + i of a) op
+// (bit b_offset + i of b), for i in [0, bit_length).
+//
+// The offsets need not be aligned to one another: the whole destination
+// words go through a word loop that the compiler vectorizes, reading
+// misaligned operands with the same funnel shift as bitarray_get_u64.
+//
+// a or b may be dst itself.  An operand overlapping the destination range
+// must start at or after dst_offset, or both overlapping operands must start
+// at or before it.
+void bitarray_logic3_range(bitarray_t* const dst,
+                           const size_t dst_offset,
+                           const bitarray_t* const a,
+                           const size_t a_offset,
+                           const bitarray_t* const b,
+                           const size_t b_offset,
+                           const size_t bit_length,
+                           const bitarray_logic_t op);
+
+// In-place form of bitarray_logic3_range: dst's subarray becomes
+// dst op src.
+void bitarray_logic_range(bitarray_t* const dst,
+                          const size_t dst_offset,
+                          const bitarray_t* const src,
+                          const size_t src_offset,
+                          const size_t bit_length,
+                          const bitarray_logic_t op);
+
+// Whole-array forms; all the bit arrays must have the same size.
+void bitarray_logic3(bitarray_t* const dst,
+                     const bitarray_t* const a,
+                     const bitarray_t* const b,
+                     const bitarray_logic_t op);
+void bitarray_logic(bitarray_t* const dst,
+                    const bitarray_t* const src,
+                    const bitarray_logic_t op);
+
+// Returns the number of set bits in (a's subarray) op (b's subarray)
+// without storing the result anywhere, e.g. the size of an intersection
+// with BITARRAY_AND.
+size_t bitarray_logic_count(const bitarray_t* const a,
+                            const size_t a_offset,
+                            const bitarray_t* const b,
+                            const size_t b_offset,
+                            const size_t bit_length,
+                            const bitarray_logic_t op);
+
+// Returns whether two subarrays of bit_length bits, starting at a_offset in
+// a and b_offset in b, hold the same bits.  The offsets need not be aligned
+// to one another.
+bool bitarray_equal_range(const bitarray_t* const a,
+                          const size_t a_offset,
+                          const bitarray_t* const b,
+                          const size_t b_offset,
+                          const size_t bit_length);
+
+// Compares two subarrays lexicographically, bit index by bit index, with a
+// clear bit ordering before a set one.  Returns a negative number, zero or
+// a positive number as a's subarray is less than, equal to or greater than
+// b's.
+int bitarray_compare_range(const bitarray_t* const a,
+                           const size_t a_offset,
+                           const bitarray_t* const b,
+                           const size_t b_offset,
+                           const size_t bit_length);
+
+// Returns a 64-bit hash of the bits in a subarray.  Equal subarrays hash
+// equally wherever they start, so ranges can be deduplicated across
+// different offsets and bit arrays.  The hash is not cryptographic.
+uint64_t bitarray_hash_range(const bitarray_t* const bitarray,
+                             const size_t bit_offset,
+                             const size_t bit_length);
+
+// Reverses the order of the bits in a subarray, so that the bit at
+// bit_offset + i moves to bit_offset + bit_length - 1 - i.
+//
+// The subarray spans the half-open interval
+// [bit_offset, bit_offset + bit_length)
+//
+// Example:
+// Let ba be a bit array containing the byte 0b10010110; then,
+// bitarray_reverse(ba, 0, bitarray_get_bit_sz(ba)) reverses the whole bit
+// array in place.  After the reversal, ba contains the byte 0b01101001.
+//
+// Example:
+// Let ba be a bit array containing the byte 0b10010110; then,
+// bitarray_reverse(ba, 0, 3) reverses its first three bits.  After the
+// reversal, ba contains the byte 0b00110110.
+void bitarray_reverse(bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length);
+
 // Rotates a subarray.
 //
 // bit_offset is the index of the start of the subarray
@@ -0,0 +1,246 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Transposition works on 64x64 tiles: each tile is read as 64 row words,
+// transposed in registers by bitmatrix_transpose64, and written out as 64
+// row words of the destination.  Reading a tile streams along 64 source
+// rows, but writing it touches 64 different destination rows, so tiles are
+// visited in square groups whose destination rows fit in cache together
+// instead of sweeping a whole row of tiles at once.
+
+#include "./bitmatrix.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+
+// ********************************* Macros *********************************
+
+#define WORD_BITS 64
+
+// Tiles per side of the square groups visited by bitmatrix_transpose.  A
+// group writes to 64 * TILE_GROUP destination rows, 8 bytes per tile each,
+// i.e. 32KB for a group of 8x8 tiles.
+#define TILE_GROUP 8
+
+// ********************************* Types **********************************
+
+// Concrete data type representing a bit matrix view.
+struct bitmatrix {
+  // The bit array holding the matrix.
+  bitarray_t* bitarray;
+
+  // The index in bitarray of the bit at (0, 0).
+  size_t bit_offset;
+
+  // The dimensions of the matrix.
+  size_t rows;
+  size_t cols;
+};
+
+// ******************** Prototypes for static functions *********************
+
+// Returns the index in the underlying bit array of the bit at (row, col).
+static inline size_t bit_index(const bitmatrix_t* const bitmatrix,
+                               const size_t row,
+                               const size_t col);
+
+// Returns the nbits bits starting at index, for 0 < nbits <= 64, in the low
+// bits of the result; the rest are zero.
+static inline uint64_t load_bits(const bitarray_t* const bitarray,
+                                 const size_t index,
+                                 const size_t nbits);
+
+// Stores the low nbits bits of value starting at index, for
+// 0 < nbits <= 64, leaving the bits around them untouched.
+static inline void store_bits(bitarray_t* const bitarray,
+                              const size_t index,
+                              const uint64_t value,
+                              const size_t nbits);
+
+// One step of bitmatrix_transpose64: within every group of 2j rows, rows k
+// and k + j exchange the high j bits of each 2j-bit field of row k with the
+// low j bits of row k + j's, mask selecting the low j bits of every field.
+// The inner loop runs over j consecutive rows, so it vectorizes for the
+// larger steps.
+static inline void transpose_step(uint64_t block[64],
+                                  const size_t j,
+                                  const uint64_t mask);
+
+// Transposes the tile of src whose top-left corner is (row, col) into dst.
+// The tile is clipped to the edges of src.
+static void transpose_tile(bitmatrix_t* const dst,
+                           const bitmatrix_t* const src,
+                           const size_t row,
+                           const size_t col);
+
+// ******************************* Functions ********************************
+
+bitmatrix_t* bitmatrix_new(bitarray_t* const bitarray,
+                           const size_t bit_offset,
+                           const size_t rows,
+                           const size_t cols) {
+  assert(bitarray != NULL);
+  assert(cols == 0 || rows <= (SIZE_MAX - bit_offset) / cols);
+  assert(bit_offset + rows * cols <= bitarray_get_bit_sz(bitarray));
+
+  bitmatrix_t* const bitmatrix = malloc(sizeof(struct bitmatrix));
+  if (bitmatrix == NULL) {
+    return NULL;
+  }
+  bitmatrix->bitarray = bitarray;
+  bitmatrix->bit_offset = bit_offset;
+  bitmatrix->rows = rows;
+  bitmatrix->cols = cols;
+  return bitmatrix;
+}
+
+void bitmatrix_free(bitmatrix_t* const bitmatrix) {
+  free(bitmatrix);
+}
+
+size_t bitmatrix_get_rows(const bitmatrix_t* const bitmatrix) {
+  return bitmatrix->rows;
+}
+
+size_t bitmatrix_get_cols(const bitmatrix_t* const bitmatrix) {
+  return bitmatrix->cols;
+}
+
+bool bitmatrix_get(const bitmatrix_t* const bitmatrix,
+                   const size_t row,
+                   const size_t col) {
+  assert(row < bitmatrix->rows && col < bitmatrix->cols);
+  return bitarray_get(bitmatrix->bitarray, bit_index(bitmatrix, row, col));
+}
+
+void bitmatrix_set(bitmatrix_t* const bitmatrix,
+                   const size_t row,
+                   const size_t col,
+                   const bool value) {
+  assert(row < bitmatrix->rows && col < bitmatrix->cols);
+  bitarray_set(bitmatrix->bitarray, bit_index(bitmatrix, row, col), value);
+}
+
+void bitmatrix_transpose64(uint64_t block[64]) {
+  // Swap the off-diagonal 32x32 quadrants, then the off-diagonal 16x16
+  // blocks within each quadrant, and so on down to single bits.
+  transpose_step(block, 32, 0x00000000ffffffffULL);
+  transpose_step(block, 16, 0x0000ffff0000ffffULL);
+  transpose_step(block, 8, 0x00ff00ff00ff00ffULL);
+  transpose_step(block, 4, 0x0f0f0f0f0f0f0f0fULL);
+  transpose_step(block, 2, 0x3333333333333333ULL);
+  transpose_step(block, 1, 0x5555555555555555ULL);
+}
+
+void bitmatrix_transpose(bitmatrix_t* const dst, const bitmatrix_t* const src) {
+  assert(dst->rows == src->cols && dst->cols == src->rows);
+  const size_t group = TILE_GROUP * WORD_BITS;
+  for (size_t row0 = 0; row0 < src->rows; row0 += group) {
+    for (size_t col0 = 0; col0 < src->cols; col0 += group) {
+      const size_t row_end = row0 + group < src->rows ? row0 + group : src->rows;
+      const size_t col_end = col0 + group < src->cols ? col0 + group : src->cols;
+      for (size_t row = row0; row < row_end; row += WORD_BITS) {
+        for (size_t col = col0; col < col_end; col += WORD_BITS) {
+          transpose_tile(dst, src, row, col);
+        }
+      }
+    }
+  }
+}
+
+void bitmatrix_get_column(const bitmatrix_t* const bitmatrix,
+                          const size_t col,
+                          bitarray_t* const dst,
+                          const size_t dst_offset) {
+  assert(col < bitmatrix->cols);
+  assert(dst_offset + bitmatrix->rows <= bitarray_get_bit_sz(dst));
+  for (size_t row0 = 0; row0 < bitmatrix->rows; row0 += WORD_BITS) {
+    const size_t nrows = bitmatrix->rows - row0 < WORD_BITS ?
+                         bitmatrix->rows - row0 : WORD_BITS;
+    uint64_t word = 0;
+    for (size_t i = 0; i < nrows; i++) {
+      word |= (uint64_t)bitarray_get(bitmatrix->bitarray,
+                                     bit_index(bitmatrix, row0 + i, col)) << i;
+    }
+    store_bits(dst, dst_offset + row0, word, nrows);
+  }
+}
+
+inline static size_t bit_index(const bitmatrix_t* const bitmatrix,
+                               const size_t row,
+                               const size_t col) {
+  return bitmatrix->bit_offset + row * bitmatrix->cols + col;
+}
+
+inline static uint64_t load_bits(const bitarray_t* const bitarray,
+                                 const size_t index,
+                                 const size_t nbits) {
+  const uint64_t word = bitarray_get_u64(bitarray, index);
+  return nbits < WORD_BITS ? word & ((1ULL << nbits) - 1) : word;
+}
+
+inline static void store_bits(bitarray_t* const bitarray,
+                              const size_t index,
+                              const uint64_t value,
+                              const size_t nbits) {
+  if (nbits == WORD_BITS) {
+    bitarray_set_u64(bitarray, index, value);
+    return;
+  }
+  const uint64_t mask = (1ULL << nbits) - 1;
+  const uint64_t old = bitarray_get_u64(bitarray, index);
+  bitarray_set_u64(bitarray, index, (old & ~mask) | (value & mask));
+}
+
+inline static void transpose_step(uint64_t block[64],
+                                  const size_t j,
+                                  const uint64_t mask) {
+  for (size_t base = 0; base < WORD_BITS; base += 2 * j) {
+    for (size_t k = base; k < base + j; k++) {
+      const uint64_t t = ((block[k] >> j) ^ block[k + j]) & mask;
+      block[k] ^= t << j;
+      block[k + j] ^= t;
+    }
+  }
+}
+
+static void transpose_tile(bitmatrix_t* const dst,
+                           const bitmatrix_t* const src,
+                           const size_t row,
+                           const size_t col) {
+  const size_t nrows = src->rows - row < WORD_BITS ? src->rows - row : WORD_BITS;
+  const size_t ncols = src->cols - col < WORD_BITS ? src->cols - col : WORD_BITS;
+
+  // Rows past the bottom edge are zero; columns past the right edge are
+  // masked off by load_bits.
+  uint64_t block[WORD_BITS] = {0};
+  for (size_t i = 0; i < nrows; i++) {
+    block[i] = load_bits(src->bitarray, bit_index(src, row + i, col), ncols);
+  }
+  bitmatrix_transpose64(block);
+  for (size_t j = 0; j < ncols; j++) {
+    store_bits(dst->bitarray, bit_index(dst, col + j, row), block[j], nrows);
+  }
+}
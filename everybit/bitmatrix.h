@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// A bit matrix stored row-major inside a bit array: the bit at (row, col)
+// of a rows x cols matrix lives at bit_offset + row * cols + col.  A matrix
+// is only a view; it neither owns nor copies the bits, and any number of
+// views may share one bit array.
+//
+// Reading a row is a streaming operation on the bit array, but reading a
+// column touches a different word for every row.  bitmatrix_transpose
+// turns columns into rows, 64x64 bits at a time.
+
+#ifndef BITMATRIX_H
+#define BITMATRIX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./bitarray.h"
+
+// ********************************* Types **********************************
+
+// Abstract data type representing a bit matrix view over a bit array.
+typedef struct bitmatrix bitmatrix_t;
+
+// ******************************* Prototypes *******************************
+
+// Creates a view of the rows x cols matrix stored row-major at bit_offset
+// in bitarray, which must hold at least bit_offset + rows * cols bits and
+// outlive the view.  Returns NULL if memory could not be allocated.
+bitmatrix_t* bitmatrix_new(bitarray_t* const bitarray,
+                           const size_t bit_offset,
+                           const size_t rows,
+                           const size_t cols);
+
+// Frees a view allocated by bitmatrix_new.  The bit array is untouched.
+void bitmatrix_free(bitmatrix_t* const bitmatrix);
+
+// Returns the number of rows and of columns of a matrix.
+size_t bitmatrix_get_rows(const bitmatrix_t* const bitmatrix);
+size_t bitmatrix_get_cols(const bitmatrix_t* const bitmatrix);
+
+// Reads and writes the bit at (row, col).
+bool bitmatrix_get(const bitmatrix_t* const bitmatrix,
+                   const size_t row,
+                   const size_t col);
+void bitmatrix_set(bitmatrix_t* const bitmatrix,
+                   const size_t row,
+                   const size_t col,
+                   const bool value);
+
+// Transposes a 64x64 block in place, where bit j of block[i] is the bit at
+// (i, j): afterwards bit j of block[i] holds what bit i of block[j] held.
+void bitmatrix_transpose64(uint64_t block[64]);
+
+// Stores the transpose of src into dst, which must be cols x rows where src
+// is rows x cols and must not overlap it.  Works through 64x64 tiles, in
+// groups small enough that the destination rows they touch stay in cache.
+void bitmatrix_transpose(bitmatrix_t* const dst, const bitmatrix_t* const src);
+
+// Copies column col of a matrix, top to bottom, into the subarray of dst
+// starting at dst_offset, which must hold rows bits.  Gathers 64 rows per
+// stored word; to read many columns, transpose once and read rows instead.
+void bitmatrix_get_column(const bitmatrix_t* const bitmatrix,
+                          const size_t col,
+                          bitarray_t* const dst,
+                          const size_t dst_offset);
+
+#endif  // BITMATRIX_H
@@ -0,0 +1,143 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Implements the views specified in bitview.h by translating every call into
+// the matching bitarray range operation.
+
+#include "./bitview.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// ******************************* Functions ********************************
+
+bitview_t bitview_from(bitarray_t* const bitarray,
+                       const size_t bit_offset,
+                       const size_t bit_length) {
+  assert(bit_offset + bit_length <= bitarray_get_bit_sz(bitarray));
+  const bitview_t view = {bitarray, bit_offset, bit_length};
+  return view;
+}
+
+bitview_t bitview_of(bitarray_t* const bitarray) {
+  return bitview_from(bitarray, 0, bitarray_get_bit_sz(bitarray));
+}
+
+bitview_t bitview_slice(const bitview_t view,
+                        const size_t bit_offset,
+                        const size_t bit_length) {
+  assert(bit_offset + bit_length <= view.bit_length);
+  return bitview_from(view.bitarray, view.bit_offset + bit_offset, bit_length);
+}
+
+size_t bitview_get_bit_sz(const bitview_t view) {
+  return view.bit_length;
+}
+
+bool bitview_get(const bitview_t view, const size_t bit_index) {
+  assert(bit_index < view.bit_length);
+  return bitarray_get(view.bitarray, view.bit_offset + bit_index);
+}
+
+void bitview_set(const bitview_t view, const size_t bit_index, const bool value) {
+  assert(bit_index < view.bit_length);
+  bitarray_set(view.bitarray, view.bit_offset + bit_index, value);
+}
+
+void bitview_rotate(const bitview_t view, const ssize_t bit_right_amount) {
+  bitarray_rotate(view.bitarray, view.bit_offset, view.bit_length, bit_right_amount);
+}
+
+void bitview_reverse(const bitview_t view) {
+  bitarray_reverse(view.bitarray, view.bit_offset, view.bit_length);
+}
+
+void bitview_fill(const bitview_t view, const bool value) {
+  bitarray_fill_range(view.bitarray, view.bit_offset, view.bit_length, value);
+}
+
+size_t bitview_count(const bitview_t view) {
+  return bitarray_count(view.bitarray, view.bit_offset, view.bit_length);
+}
+
+size_t bitview_find_next_set(const bitview_t view, const size_t bit_index) {
+  if (bit_index >= view.bit_length) {
+    return view.bit_length;
+  }
+  return bitarray_find_next_set_until(view.bitarray, view.bit_offset + bit_index,
+                                      view.bit_offset + view.bit_length) - view.bit_offset;
+}
+
+size_t bitview_find_next_clear(const bitview_t view, const size_t bit_index) {
+  if (bit_index >= view.bit_length) {
+    return view.bit_length;
+  }
+  return bitarray_find_next_clear_until(view.bitarray, view.bit_offset + bit_index,
+                                        view.bit_offset + view.bit_length) - view.bit_offset;
+}
+
+bool bitview_equal(const bitview_t a, const bitview_t b) {
+  return a.bit_length == b.bit_length &&
+         bitarray_equal_range(a.bitarray, a.bit_offset, b.bitarray, b.bit_offset,
+                              a.bit_length);
+}
+
+int bitview_compare(const bitview_t a, const bitview_t b) {
+  const size_t common = a.bit_length < b.bit_length ? a.bit_length : b.bit_length;
+  const int cmp = bitarray_compare_range(a.bitarray, a.bit_offset,
+                                         b.bitarray, b.bit_offset, common);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return (a.bit_length > b.bit_length) - (a.bit_length < b.bit_length);
+}
+
+uint64_t bitview_hash(const bitview_t view) {
+  return bitarray_hash_range(view.bitarray, view.bit_offset, view.bit_length);
+}
+
+void bitview_logic(const bitview_t dst,
+                   const bitview_t src,
+                   const bitarray_logic_t op) {
+  assert(dst.bit_length == src.bit_length);
+  bitarray_logic_range(dst.bitarray, dst.bit_offset, src.bitarray, src.bit_offset,
+                       dst.bit_length, op);
+}
+
+void bitview_logic3(const bitview_t dst,
+                    const bitview_t a,
+                    const bitview_t b,
+                    const bitarray_logic_t op) {
+  assert(dst.bit_length == a.bit_length && dst.bit_length == b.bit_length);
+  bitarray_logic3_range(dst.bitarray, dst.bit_offset, a.bitarray, a.bit_offset,
+                        b.bitarray, b.bit_offset, dst.bit_length, op);
+}
+
+size_t bitview_logic_count(const bitview_t a,
+                           const bitview_t b,
+                           const bitarray_logic_t op) {
+  assert(a.bit_length == b.bit_length);
+  return bitarray_logic_count(a.bitarray, a.bit_offset, b.bitarray, b.bit_offset,
+                              a.bit_length, op);
+}
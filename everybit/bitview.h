@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Non-owning views of subarrays.  A view names the bits
+// [bit_offset, bit_offset + bit_length) of a bit array and is passed around
+// by value, so taking a slice allocates nothing and copies no bits.  The
+// bitview functions mirror the bitarray ones with indices relative to the
+// start of the view, and act on the underlying bit array in place.
+//
+// A view does not keep its bit array alive, and is only valid while the bit
+// array holds at least bit_offset + bit_length bits.
+
+#ifndef BITVIEW_H
+#define BITVIEW_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./bitarray.h"
+
+// ********************************* Types **********************************
+
+// A view of the bits [bit_offset, bit_offset + bit_length) of bitarray.
+typedef struct {
+  bitarray_t* bitarray;
+  size_t bit_offset;
+  size_t bit_length;
+} bitview_t;
+
+// ******************************* Prototypes *******************************
+
+// Returns a view of the subarray [bit_offset, bit_offset + bit_length) of
+// bitarray.
+bitview_t bitview_from(bitarray_t* const bitarray,
+                       const size_t bit_offset,
+                       const size_t bit_length);
+
+// Returns a view of a whole bit array.
+bitview_t bitview_of(bitarray_t* const bitarray);
+
+// Returns a view of the subarray [bit_offset, bit_offset + bit_length) of
+// view, i.e. of the same bit array with the offsets added together.
+bitview_t bitview_slice(const bitview_t view,
+                        const size_t bit_offset,
+                        const size_t bit_length);
+
+// Returns the number of bits in a view.
+size_t bitview_get_bit_sz(const bitview_t view);
+
+// Reads and writes the bit at bit_index within the view.
+bool bitview_get(const bitview_t view, const size_t bit_index);
+void bitview_set(const bitview_t view, const size_t bit_index, const bool value);
+
+// In-place operations on the whole view, as bitarray_rotate,
+// bitarray_reverse and bitarray_fill_range on its subarray.
+void bitview_rotate(const bitview_t view, const ssize_t bit_right_amount);
+void bitview_reverse(const bitview_t view);
+void bitview_fill(const bitview_t view, const bool value);
+
+// Returns the number of set bits in a view.
+size_t bitview_count(const bitview_t view);
+
+// Return the index within the view of the first set (clear) bit at or after
+// bit_index, or the length of the view if there is none.  The scan stops at
+// the end of the view.
+size_t bitview_find_next_set(const bitview_t view, const size_t bit_index);
+size_t bitview_find_next_clear(const bitview_t view, const size_t bit_index);
+
+// Compare and hash views, as bitarray_equal_range, bitarray_compare_range and
+// bitarray_hash_range.  Views of different lengths are never equal, and
+// compare as their common prefix and then by length.
+bool bitview_equal(const bitview_t a, const bitview_t b);
+int bitview_compare(const bitview_t a, const bitview_t b);
+uint64_t bitview_hash(const bitview_t view);
+
+// Logical operations between views of equal length, as bitarray_logic_range,
+// bitarray_logic3_range and bitarray_logic_count.
+void bitview_logic(const bitview_t dst,
+                   const bitview_t src,
+                   const bitarray_logic_t op);
+void bitview_logic3(const bitview_t dst,
+                    const bitview_t a,
+                    const bitview_t b,
+                    const bitarray_logic_t op);
+size_t bitview_logic_count(const bitview_t a,
+                           const bitview_t b,
+                           const bitarray_logic_t op);
+
+#endif  // BITVIEW_H
@@ -0,0 +1,581 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// The compressed words are a sequence of markers, each followed by the
+// literal words it announces.  A marker holds
+//   bit 0:       the value of the bits in its clean run,
+//   bits 1-32:   the number of clean words in the run, and
+//   bits 33-63:  the number of literal words that follow the run.
+// Bits past bit_sz in the last word are always zero, so counts never need
+// to mask them.
+
+#include "./ewah.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ********************************* Macros *********************************
+
+#define WORD_BITS BITARRAY_WORD_BITS
+
+#define RUN_LENGTH_SHIFT 1
+#define RUN_LENGTH_MAX 0xffffffffULL
+#define LITERAL_COUNT_SHIFT 33
+#define LITERAL_COUNT_MAX 0x7fffffffULL
+
+// ********************************* Types **********************************
+
+// Concrete data type representing a compressed bit array.
+struct ewah {
+  // The number of bits represented.
+  size_t bit_sz;
+
+  // The compressed words, nwords of them in a buffer of capacity.
+  uint64_t* words;
+  size_t nwords;
+  size_t capacity;
+
+  // The index of the last marker in words, valid when nwords > 0.
+  size_t last_marker;
+
+  // While the array is being built: the low pending_bits bits of pending
+  // are the next bits, not yet a whole word; failed records that memory
+  // ran out.
+  uint64_t pending;
+  size_t pending_bits;
+  bool failed;
+};
+
+// A position in the uncompressed words of a compressed bit array, seen as
+// clean_left clean words of value clean_bit followed by literal_left
+// literal words starting at words[literal]; next is the index of the marker
+// after them.
+typedef struct {
+  const ewah_t* ewah;
+  bool clean_bit;
+  size_t clean_left;
+  size_t literal;
+  size_t literal_left;
+  size_t next;
+} cursor_t;
+
+// ******************** Prototypes for static functions *********************
+
+// Returns a new, empty compressed bit array of bit_sz bits, to be filled by
+// the emit and append functions below; or NULL on failure.
+static ewah_t* ewah_begin(const size_t bit_sz);
+
+// Flushes the pending bits of an array being built, zero-padded to a whole
+// word.  Returns the array, or NULL (freeing it) if memory ran out along
+// the way.
+static ewah_t* ewah_finish(ewah_t* const ewah);
+
+// Appends a word to the compressed words.  Returns false, and marks the
+// array failed, if memory runs out.
+static bool push_word(ewah_t* const ewah, const uint64_t word);
+
+// Appends nwords clean words of value bit, extending the last run when
+// possible.  Requires that no bits are pending.
+static void emit_clean(ewah_t* const ewah, const bool bit, size_t nwords);
+
+// Appends a literal word.  Requires that no bits are pending.
+static void emit_literal(ewah_t* const ewah, const uint64_t word);
+
+// Appends a whole word, as a clean word if it is one.  Requires that no bits
+// are pending.
+static void emit_word(ewah_t* const ewah, const uint64_t word);
+
+// Appends the low nbits bits of bits, for 0 < nbits <= 64, after the
+// pending ones.
+static void append_bits(ewah_t* const ewah, const uint64_t bits, const size_t nbits);
+
+// Appends nbits bits of value bit.
+static void append_run(ewah_t* const ewah, const bool bit, size_t nbits);
+
+// Appends the bits [bit_begin, bit_end) of src.
+static void append_range(ewah_t* const ewah,
+                         const ewah_t* const src,
+                         const size_t bit_begin,
+                         const size_t bit_end);
+
+// Positions a cursor at the first word of ewah.
+static void cursor_init(cursor_t* const cursor, const ewah_t* const ewah);
+
+// Moves a cursor that has run out of its marker's words on to the next
+// marker with any.
+static void cursor_normalize(cursor_t* const cursor);
+
+// Moves a cursor forward by nwords uncompressed words.
+static void cursor_skip(cursor_t* const cursor, size_t nwords);
+
+// Shared body of ewah_logic and ewah_logic_count: merges a and b word by
+// word into out, or counts the result bits if out is NULL.
+static size_t merge(ewah_t* const out,
+                    const ewah_t* const a,
+                    const ewah_t* const b,
+                    const bitarray_logic_t op);
+
+// Copies the next nwords words of cursor into out (or counts their bits if
+// out is NULL), complemented if invert is true.
+static size_t copy_words(ewah_t* const out,
+                         cursor_t* const cursor,
+                         size_t nwords,
+                         const bool invert);
+
+// ******************************* Functions ********************************
+
+ewah_t* ewah_from_bitarray(const bitarray_t* const bitarray) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  ewah_t* const ewah = ewah_begin(bit_sz);
+  if (ewah == NULL) {
+    return NULL;
+  }
+  const char* const buf = bitarray_get_buf(bitarray);
+  const size_t nwords = bit_sz / WORD_BITS;
+  for (size_t i = 0; i < nwords; i++) {
+    uint64_t word;
+    memcpy(&word, buf + i * sizeof(uint64_t), sizeof(uint64_t));
+    emit_word(ewah, word);
+  }
+  if (bit_sz % WORD_BITS != 0) {
+    uint64_t word;
+    memcpy(&word, buf + nwords * sizeof(uint64_t), sizeof(uint64_t));
+    append_bits(ewah, word, bit_sz % WORD_BITS);
+  }
+  return ewah_finish(ewah);
+}
+
+bitarray_t* ewah_to_bitarray(const ewah_t* const ewah) {
+  bitarray_t* const bitarray = bitarray_new(ewah->bit_sz);
+  if (bitarray == NULL) {
+    return NULL;
+  }
+  // The new bit array starts out zeroed, so only runs of ones and literal
+  // words need writing.
+  cursor_t cursor;
+  cursor_init(&cursor, ewah);
+  size_t bit_index = 0;
+  while (cursor.clean_left + cursor.literal_left > 0) {
+    if (cursor.clean_left > 0) {
+      const size_t nbits = cursor.clean_left * WORD_BITS;
+      if (cursor.clean_bit) {
+        const size_t end = bit_index + nbits < ewah->bit_sz ? bit_index + nbits : ewah->bit_sz;
+        bitarray_fill_range(bitarray, bit_index, end - bit_index, true);
+      }
+      bit_index += nbits;
+      cursor_skip(&cursor, cursor.clean_left);
+    } else {
+      bitarray_set_u64(bitarray, bit_index, ewah->words[cursor.literal]);
+      bit_index += WORD_BITS;
+      cursor_skip(&cursor, 1);
+    }
+  }
+  return bitarray;
+}
+
+void ewah_free(ewah_t* const ewah) {
+  if (ewah == NULL) {
+    return;
+  }
+  free(ewah->words);
+  free(ewah);
+}
+
+size_t ewah_get_bit_sz(const ewah_t* const ewah) {
+  return ewah->bit_sz;
+}
+
+size_t ewah_get_space(const ewah_t* const ewah) {
+  return ewah->nwords * sizeof(uint64_t);
+}
+
+size_t ewah_count(const ewah_t* const ewah) {
+  size_t count = 0;
+  size_t marker = 0;
+  while (marker < ewah->nwords) {
+    const uint64_t word = ewah->words[marker];
+    const size_t literals = word >> LITERAL_COUNT_SHIFT;
+    if (word & 1) {
+      count += ((word >> RUN_LENGTH_SHIFT) & RUN_LENGTH_MAX) * WORD_BITS;
+    }
+    for (size_t i = marker + 1; i <= marker + literals; i++) {
+      count += __builtin_popcountll(ewah->words[i]);
+    }
+    marker += literals + 1;
+  }
+  return count;
+}
+
+ewah_t* ewah_logic(const ewah_t* const a,
+                   const ewah_t* const b,
+                   const bitarray_logic_t op) {
+  assert(a->bit_sz == b->bit_sz);
+  ewah_t* const out = ewah_begin(a->bit_sz);
+  if (out == NULL) {
+    return NULL;
+  }
+  merge(out, a, b, op);
+  return ewah_finish(out);
+}
+
+size_t ewah_logic_count(const ewah_t* const a,
+                        const ewah_t* const b,
+                        const bitarray_logic_t op) {
+  assert(a->bit_sz == b->bit_sz);
+  return merge(NULL, a, b, op);
+}
+
+bool ewah_rotate(ewah_t* const ewah,
+                 const size_t bit_offset,
+                 const size_t bit_length,
+                 ssize_t bit_right_amount) {
+  assert(bit_offset + bit_length <= ewah->bit_sz);
+  if (bit_length == 0) {
+    return true;
+  }
+  if (bit_right_amount < 0) {
+    bit_right_amount = bit_length - ((-bit_right_amount) % bit_length);
+  } else {
+    bit_right_amount %= bit_length;
+  }
+  if (bit_right_amount == 0) {
+    return true;
+  }
+
+  // The rotated subarray is its last bit_right_amount bits followed by the
+  // rest; everything outside it is copied as is.
+  const size_t split = bit_offset + bit_length - bit_right_amount;
+  ewah_t* const rotated = ewah_begin(ewah->bit_sz);
+  if (rotated == NULL) {
+    return false;
+  }
+  append_range(rotated, ewah, 0, bit_offset);
+  append_range(rotated, ewah, split, bit_offset + bit_length);
+  append_range(rotated, ewah, bit_offset, split);
+  append_range(rotated, ewah, bit_offset + bit_length, ewah->bit_sz);
+  if (ewah_finish(rotated) == NULL) {
+    return false;
+  }
+
+  free(ewah->words);
+  *ewah = *rotated;
+  free(rotated);
+  return true;
+}
+
+static ewah_t* ewah_begin(const size_t bit_sz) {
+  ewah_t* const ewah = calloc(1, sizeof(struct ewah));
+  if (ewah == NULL) {
+    return NULL;
+  }
+  ewah->bit_sz = bit_sz;
+  return ewah;
+}
+
+static ewah_t* ewah_finish(ewah_t* const ewah) {
+  if (ewah->pending_bits > 0) {
+    const uint64_t word = ewah->pending;
+    ewah->pending = 0;
+    ewah->pending_bits = 0;
+    emit_word(ewah, word);
+  }
+  if (ewah->failed) {
+    ewah_free(ewah);
+    return NULL;
+  }
+  return ewah;
+}
+
+static bool push_word(ewah_t* const ewah, const uint64_t word) {
+  if (ewah->nwords == ewah->capacity) {
+    const size_t capacity = ewah->capacity == 0 ? 16 : ewah->capacity * 2;
+    uint64_t* const words = realloc(ewah->words, capacity * sizeof(uint64_t));
+    if (words == NULL) {
+      ewah->failed = true;
+      return false;
+    }
+    ewah->words = words;
+    ewah->capacity = capacity;
+  }
+  ewah->words[ewah->nwords++] = word;
+  return true;
+}
+
+static void emit_clean(ewah_t* const ewah, const bool bit, size_t nwords) {
+  assert(ewah->pending_bits == 0);
+  while (nwords > 0 && !ewah->failed) {
+    // Extend the last marker's run if nothing has followed it yet and it
+    // has the same value (or is still empty).
+    if (ewah->nwords > 0) {
+      uint64_t* const marker = &ewah->words[ewah->last_marker];
+      const uint64_t run = (*marker >> RUN_LENGTH_SHIFT) & RUN_LENGTH_MAX;
+      if ((*marker >> LITERAL_COUNT_SHIFT) == 0 &&
+          (run == 0 || (bool)(*marker & 1) == bit) && run < RUN_LENGTH_MAX) {
+        const size_t n = nwords < RUN_LENGTH_MAX - run ? nwords : RUN_LENGTH_MAX - run;
+        *marker = ((run + n) << RUN_LENGTH_SHIFT) | (uint64_t)bit;
+        nwords -= n;
+        continue;
+      }
+    }
+    if (push_word(ewah, 0)) {
+      ewah->last_marker = ewah->nwords - 1;
+    }
+  }
+}
+
+static void emit_literal(ewah_t* const ewah, const uint64_t word) {
+  assert(ewah->pending_bits == 0);
+  if (ewah->failed) {
+    return;
+  }
+  if (ewah->nwords == 0 ||
+      (ewah->words[ewah->last_marker] >> LITERAL_COUNT_SHIFT) == LITERAL_COUNT_MAX) {
+    if (!push_word(ewah, 0)) {
+      return;
+    }
+    ewah->last_marker = ewah->nwords - 1;
+  }
+  ewah->words[ewah->last_marker] += 1ULL << LITERAL_COUNT_SHIFT;
+  push_word(ewah, word);
+}
+
+inline static void emit_word(ewah_t* const ewah, const uint64_t word) {
+  if (word == 0 || word == ~0ULL) {
+    emit_clean(ewah, word != 0, 1);
+  } else {
+    emit_literal(ewah, word);
+  }
+}
+
+static void append_bits(ewah_t* const ewah, uint64_t bits, const size_t nbits) {
+  assert(nbits > 0 && nbits <= WORD_BITS);
+  if (nbits < WORD_BITS) {
+    bits &= (1ULL << nbits) - 1;
+  }
+  if (ewah->pending_bits == 0) {
+    if (nbits == WORD_BITS) {
+      emit_word(ewah, bits);
+    } else {
+      ewah->pending = bits;
+      ewah->pending_bits = nbits;
+    }
+    return;
+  }
+
+  const size_t room = WORD_BITS - ewah->pending_bits;
+  const uint64_t word = ewah->pending | (bits << ewah->pending_bits);
+  if (nbits < room) {
+    ewah->pending = word;
+    ewah->pending_bits += nbits;
+    return;
+  }
+  ewah->pending = 0;
+  ewah->pending_bits = 0;
+  emit_word(ewah, word);
+  if (nbits > room) {
+    ewah->pending = bits >> room;
+    ewah->pending_bits = nbits - room;
+  }
+}
+
+static void append_run(ewah_t* const ewah, const bool bit, size_t nbits) {
+  const uint64_t fill = bit ? ~0ULL : 0;
+  // Top up the pending word, then whole words as a run, then the rest.
+  if (ewah->pending_bits > 0 && nbits > 0) {
+    const size_t room = WORD_BITS - ewah->pending_bits;
+    const size_t n = nbits < room ? nbits : room;
+    append_bits(ewah, fill, n);
+    nbits -= n;
+  }
+  if (nbits >= WORD_BITS) {
+    emit_clean(ewah, bit, nbits / WORD_BITS);
+    nbits %= WORD_BITS;
+  }
+  if (nbits > 0) {
+    append_bits(ewah, fill, nbits);
+  }
+}
+
+static void append_range(ewah_t* const ewah,
+                         const ewah_t* const src,
+                         const size_t bit_begin,
+                         const size_t bit_end) {
+  cursor_t cursor;
+  cursor_init(&cursor, src);
+  cursor_skip(&cursor, bit_begin / WORD_BITS);
+  size_t bit_index = bit_begin;
+  while (bit_index < bit_end) {
+    const size_t word_index = bit_index / WORD_BITS;
+    if (cursor.clean_left > 0) {
+      const size_t run_end = (word_index + cursor.clean_left) * WORD_BITS;
+      const size_t end = run_end < bit_end ? run_end : bit_end;
+      append_run(ewah, cursor.clean_bit, end - bit_index);
+      bit_index = end;
+    } else {
+      const size_t shift = bit_index % WORD_BITS;
+      const size_t word_end = (word_index + 1) * WORD_BITS;
+      const size_t end = word_end < bit_end ? word_end : bit_end;
+      append_bits(ewah, src->words[cursor.literal] >> shift, end - bit_index);
+      bit_index = end;
+    }
+    cursor_skip(&cursor, bit_index / WORD_BITS - word_index);
+  }
+}
+
+static void cursor_init(cursor_t* const cursor, const ewah_t* const ewah) {
+  cursor->ewah = ewah;
+  cursor->clean_left = 0;
+  cursor->literal_left = 0;
+  cursor->next = 0;
+  cursor_normalize(cursor);
+}
+
+static void cursor_normalize(cursor_t* const cursor) {
+  const ewah_t* const ewah = cursor->ewah;
+  while (cursor->clean_left == 0 && cursor->literal_left == 0 &&
+         cursor->next < ewah->nwords) {
+    const uint64_t marker = ewah->words[cursor->next];
+    cursor->clean_bit = marker & 1;
+    cursor->clean_left = (marker >> RUN_LENGTH_SHIFT) & RUN_LENGTH_MAX;
+    cursor->literal = cursor->next + 1;
+    cursor->literal_left = marker >> LITERAL_COUNT_SHIFT;
+    cursor->next = cursor->literal + cursor->literal_left;
+  }
+}
+
+static void cursor_skip(cursor_t* const cursor, size_t nwords) {
+  while (nwords > 0) {
+    if (cursor->clean_left > 0) {
+      const size_t n = nwords < cursor->clean_left ? nwords : cursor->clean_left;
+      cursor->clean_left -= n;
+      nwords -= n;
+    } else {
+      assert(cursor->literal_left > 0);
+      const size_t n = nwords < cursor->literal_left ? nwords : cursor->literal_left;
+      cursor->literal += n;
+      cursor->literal_left -= n;
+      nwords -= n;
+    }
+    cursor_normalize(cursor);
+  }
+}
+
+static size_t merge(ewah_t* const out,
+                    const ewah_t* const a,
+                    const ewah_t* const b,
+                    const bitarray_logic_t op) {
+  size_t count = 0;
+  cursor_t ca;
+  cursor_t cb;
+  cursor_init(&ca, a);
+  cursor_init(&cb, b);
+  while (ca.clean_left + ca.literal_left > 0 && cb.clean_left + cb.literal_left > 0) {
+    if (ca.clean_left > 0 && cb.clean_left > 0) {
+      // Two runs: the result is a run as long as the shorter one.
+      const size_t n = ca.clean_left < cb.clean_left ? ca.clean_left : cb.clean_left;
+      const bool bit =
+          bitarray_logic_word(op, ca.clean_bit ? ~0ULL : 0, cb.clean_bit ? ~0ULL : 0) != 0;
+      if (out != NULL) {
+        emit_clean(out, bit, n);
+      } else if (bit) {
+        count += n * WORD_BITS;
+      }
+      cursor_skip(&ca, n);
+      cursor_skip(&cb, n);
+    } else if (ca.clean_left > 0 || cb.clean_left > 0) {
+      // A run against literals.  Over the run, the result is either a
+      // constant or the other operand, possibly complemented.
+      cursor_t* const run = ca.clean_left > 0 ? &ca : &cb;
+      cursor_t* const other = ca.clean_left > 0 ? &cb : &ca;
+      const size_t n = run->clean_left;
+      const uint64_t fill = run->clean_bit ? ~0ULL : 0;
+      const uint64_t on_zeros = run == &ca ? bitarray_logic_word(op, fill, 0)
+                                           : bitarray_logic_word(op, 0, fill);
+      const uint64_t on_ones = run == &ca ? bitarray_logic_word(op, fill, ~0ULL)
+                                          : bitarray_logic_word(op, ~0ULL, fill);
+      if (on_zeros == on_ones) {
+        if (out != NULL) {
+          emit_clean(out, on_zeros != 0, n);
+        } else if (on_zeros != 0) {
+          count += n * WORD_BITS;
+        }
+        cursor_skip(other, n);
+      } else {
+        count += copy_words(out, other, n, on_zeros != 0);
+      }
+      cursor_skip(run, n);
+    } else {
+      // Literals against literals.
+      const size_t n = ca.literal_left < cb.literal_left ? ca.literal_left : cb.literal_left;
+      for (size_t i = 0; i < n; i++) {
+        const uint64_t word =
+            bitarray_logic_word(op, a->words[ca.literal + i], b->words[cb.literal + i]);
+        if (out != NULL) {
+          emit_word(out, word);
+        } else {
+          count += __builtin_popcountll(word);
+        }
+      }
+      cursor_skip(&ca, n);
+      cursor_skip(&cb, n);
+    }
+  }
+  return count;
+}
+
+static size_t copy_words(ewah_t* const out,
+                         cursor_t* const cursor,
+                         size_t nwords,
+                         const bool invert) {
+  const uint64_t flip = invert ? ~0ULL : 0;
+  size_t count = 0;
+  while (nwords > 0) {
+    if (cursor->clean_left > 0) {
+      const size_t n = nwords < cursor->clean_left ? nwords : cursor->clean_left;
+      const bool bit = cursor->clean_bit != invert;
+      if (out != NULL) {
+        emit_clean(out, bit, n);
+      } else if (bit) {
+        count += n * WORD_BITS;
+      }
+      cursor_skip(cursor, n);
+      nwords -= n;
+    } else {
+      const size_t n = nwords < cursor->literal_left ? nwords : cursor->literal_left;
+      for (size_t i = 0; i < n; i++) {
+        const uint64_t word = cursor->ewah->words[cursor->literal + i] ^ flip;
+        if (out != NULL) {
+          emit_literal(out, word);
+        } else {
+          count += __builtin_popcountll(word);
+        }
+      }
+      cursor_skip(cursor, n);
+      nwords -= n;
+    }
+  }
+  return count;
+}
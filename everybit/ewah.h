@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// A compressed bit array in the Enhanced Word-Aligned Hybrid (EWAH) format,
+// for bitmaps that are mostly zeros or mostly ones.  The bits are cut into
+// 64-bit words as in the packed form; runs of all-zero or all-one ("clean")
+// words are stored as a count, and the other ("literal") words verbatim.
+// Counting and the logical operations work on the compressed words
+// directly, in time proportional to the compressed sizes, and a rotation
+// splices runs instead of moving bits.
+//
+// Compressed arrays are immutable except for rotation; to change individual
+// bits, convert to a packed bit array and back.
+
+#ifndef EWAH_H
+#define EWAH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./bitarray.h"
+
+// ********************************* Types **********************************
+
+// Abstract data type representing a compressed bit array.
+typedef struct ewah ewah_t;
+
+// ******************************* Prototypes *******************************
+
+// Compresses a packed bit array.  Returns NULL if memory could not be
+// allocated.
+ewah_t* ewah_from_bitarray(const bitarray_t* const bitarray);
+
+// Decompresses into a new packed bit array of the same size.  Returns NULL
+// if memory could not be allocated.
+bitarray_t* ewah_to_bitarray(const ewah_t* const ewah);
+
+// Frees a compressed bit array.
+void ewah_free(ewah_t* const ewah);
+
+// Returns the number of bits a compressed bit array represents.
+size_t ewah_get_bit_sz(const ewah_t* const ewah);
+
+// Returns the number of bytes of compressed words a compressed bit array
+// holds, for comparison with the bit_sz / 8 bytes of the packed form.
+size_t ewah_get_space(const ewah_t* const ewah);
+
+// Returns the number of set bits.  Clean runs are counted without being
+// expanded.
+size_t ewah_count(const ewah_t* const ewah);
+
+// Returns a new compressed bit array holding a op b, which must have the
+// same size.  Runs that decide the result on their own (zeros under AND,
+// ones under OR) skip over the other operand without looking at it.
+// Returns NULL if memory could not be allocated.
+ewah_t* ewah_logic(const ewah_t* const a,
+                   const ewah_t* const b,
+                   const bitarray_logic_t op);
+
+// Returns the number of set bits in a op b without building the result.
+size_t ewah_logic_count(const ewah_t* const a,
+                        const ewah_t* const b,
+                        const bitarray_logic_t op);
+
+// Rotates the subarray [bit_offset, bit_offset + bit_length) right by
+// bit_right_amount, exactly like bitarray_rotate.  The compressed words are
+// rebuilt by splicing the pieces of the old ones, in time proportional to
+// the compressed size.  Returns false, leaving the array untouched, if
+// memory could not be allocated.
+bool ewah_rotate(ewah_t* const ewah,
+                 const size_t bit_offset,
+                 const size_t bit_length,
+                 const ssize_t bit_right_amount);
+
+#endif  // EWAH_H
@@ -0,0 +1,937 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Chunk i holds bits [i * CHUNK_BITS, (i + 1) * CHUNK_BITS) and stores them
+// by their 16-bit position within the chunk.  Every container also keeps
+// how many ones it holds, so whole-chunk counts never look inside it.
+// Positions at or past bit_sz in the last chunk are always clear.
+
+#include "./hybrid.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ********************************* Macros *********************************
+
+#define WORD_BITS BITARRAY_WORD_BITS
+
+#define CHUNK_BITS 65536
+#define CHUNK_WORDS (CHUNK_BITS / WORD_BITS)
+
+// Past this many ones, an array takes more than the 8192 bytes of a bitmap.
+#define ARRAY_MAX 4096
+
+// ********************************* Types **********************************
+
+typedef enum {
+  CONTAINER_ARRAY = 0,
+  CONTAINER_RUNS,
+  CONTAINER_BITMAP
+} container_kind_t;
+
+// The container of one chunk.  An array holds size sorted positions in
+// values, which has room for capacity; runs holds size [start, last] pairs
+// in values; a bitmap holds CHUNK_WORDS words in words.  An empty chunk is
+// an array of size 0 with no storage, which is what zeroed memory reads as.
+typedef struct {
+  container_kind_t kind;
+  uint32_t cardinality;
+  uint32_t size;
+  uint32_t capacity;
+  uint16_t* values;
+  uint64_t* words;
+} container_t;
+
+// Concrete data type representing a hybrid bit array.
+struct hybrid {
+  // The number of bits represented.
+  size_t bit_sz;
+
+  // The containers, one per chunk.
+  size_t nchunks;
+  container_t* chunks;
+};
+
+// ******************** Prototypes for static functions *********************
+
+// Returns how many of the CHUNK_BITS positions of chunk are below bit_sz.
+static size_t chunk_bits(const hybrid_t* const hybrid, const size_t chunk);
+
+// Frees a container's storage, leaving it empty.
+static void container_free(container_t* const container);
+
+// Returns the number of bytes of storage a container holds.
+static size_t container_space(const container_t* const container);
+
+// Stores the CHUNK_WORDS words of a chunk into container in the smallest
+// container that holds them.  Returns false, leaving container untouched, if
+// memory could not be allocated.
+static bool container_from_words(container_t* const container,
+                                 const uint64_t* const words);
+
+// Expands a container into the CHUNK_WORDS words of its chunk.
+static void container_to_words(const container_t* const container,
+                               uint64_t* const words);
+
+// Returns the words of a container: its own for a bitmap, otherwise scratch
+// after expanding the container into it.
+static const uint64_t* container_words(const container_t* const container,
+                                       uint64_t* const scratch);
+
+// Makes dst a copy of src with storage of its own.  Returns false, leaving
+// dst untouched, if memory could not be allocated.
+static bool container_clone(container_t* const dst, const container_t* const src);
+
+// Retrieves the bit at position pos of a container.
+static bool container_get(const container_t* const container, const size_t pos);
+
+// Flips the bit at position pos of a container to value, which it does not
+// already hold.  Returns false, leaving the container untouched, if memory
+// could not be allocated.
+static bool container_set(container_t* const container,
+                          const size_t pos,
+                          const bool value);
+
+// Returns the number of set bits at positions [lo, hi) of a container.
+static size_t container_count(const container_t* const container,
+                              const size_t lo,
+                              const size_t hi);
+
+// Stores a op b into out.  Returns false, leaving out untouched, if memory
+// could not be allocated.
+static bool container_logic(container_t* const out,
+                            const container_t* const a,
+                            const container_t* const b,
+                            const bitarray_logic_t op);
+
+// Returns the number of set bits in a op b.
+static size_t container_logic_count(const container_t* const a,
+                                    const container_t* const b,
+                                    const bitarray_logic_t op);
+
+// Shared body of the array paths of container_logic and
+// container_logic_count: merges the positions of two arrays into out, or
+// only counts them if out is NULL, and returns how many there are.
+static size_t merge_arrays(uint16_t* const out,
+                           const container_t* const a,
+                           const container_t* const b,
+                           const bitarray_logic_t op);
+
+// Shared body of the filtering paths of container_logic and
+// container_logic_count, for op AND or ANDNOT where a is an array: keeps
+// the positions of a for which op holds against b.
+static size_t filter_array(uint16_t* const out,
+                           const container_t* const a,
+                           const container_t* const b,
+                           const bitarray_logic_t op);
+
+// Returns the index of the first of n sorted values that is at least pos.
+static size_t lower_bound(const uint16_t* const values,
+                          const size_t n,
+                          const size_t pos);
+
+// Returns the number of runs of a runs container that start at or before
+// pos.
+static size_t runs_before(const container_t* const container, const size_t pos);
+
+// Returns the first position at or after pos whose bit in words is value,
+// or CHUNK_BITS if there is none.
+static size_t next_bit(const uint64_t* const words, size_t pos, const bool value);
+
+// Sets the bits [lo, hi) of words.
+static void fill_words(uint64_t* const words, size_t lo, const size_t hi);
+
+// Copies nbits bits of src starting at src_bit to dst starting at dst_bit.
+// Neither range may run past the CHUNK_WORDS words of its buffer.
+static void copy_bits(uint64_t* const dst,
+                      size_t dst_bit,
+                      const uint64_t* const src,
+                      size_t src_bit,
+                      size_t nbits);
+
+// Copies nbits bits of a hybrid bit array, starting at src_bit, to words
+// starting at dst_bit, expanding the containers they come from in scratch.
+static void copy_from_chunks(const hybrid_t* const hybrid,
+                             size_t src_bit,
+                             uint64_t* const words,
+                             size_t dst_bit,
+                             size_t nbits,
+                             uint64_t* const scratch);
+
+// ******************************* Functions ********************************
+
+hybrid_t* hybrid_new(const size_t bit_sz) {
+  hybrid_t* const hybrid = malloc(sizeof(struct hybrid));
+  if (hybrid == NULL) {
+    return NULL;
+  }
+  hybrid->bit_sz = bit_sz;
+  hybrid->nchunks = (bit_sz + CHUNK_BITS - 1) / CHUNK_BITS;
+  // Zeroed containers are empty arrays.
+  hybrid->chunks = calloc(hybrid->nchunks > 0 ? hybrid->nchunks : 1, sizeof(container_t));
+  if (hybrid->chunks == NULL) {
+    free(hybrid);
+    return NULL;
+  }
+  return hybrid;
+}
+
+hybrid_t* hybrid_from_bitarray(const bitarray_t* const bitarray) {
+  hybrid_t* const hybrid = hybrid_new(bitarray_get_bit_sz(bitarray));
+  if (hybrid == NULL) {
+    return NULL;
+  }
+  const char* const buf = bitarray_get_buf(bitarray);
+  uint64_t words[CHUNK_WORDS];
+  for (size_t chunk = 0; chunk < hybrid->nchunks; chunk++) {
+    const size_t nbits = chunk_bits(hybrid, chunk);
+    const size_t nwords = (nbits + WORD_BITS - 1) / WORD_BITS;
+    memset(words, 0, sizeof(words));
+    memcpy(words, buf + chunk * CHUNK_WORDS * sizeof(uint64_t), nwords * sizeof(uint64_t));
+    if (nbits % WORD_BITS != 0) {
+      words[nwords - 1] &= (1ULL << (nbits % WORD_BITS)) - 1;
+    }
+    if (!container_from_words(&hybrid->chunks[chunk], words)) {
+      hybrid_free(hybrid);
+      return NULL;
+    }
+  }
+  return hybrid;
+}
+
+bitarray_t* hybrid_to_bitarray(const hybrid_t* const hybrid) {
+  bitarray_t* const bitarray = bitarray_new(hybrid->bit_sz);
+  if (bitarray == NULL) {
+    return NULL;
+  }
+  // The new bit array starts out zeroed, so only the ones need writing.
+  for (size_t chunk = 0; chunk < hybrid->nchunks; chunk++) {
+    const container_t* const container = &hybrid->chunks[chunk];
+    const size_t base = chunk * CHUNK_BITS;
+    switch (container->kind) {
+    case CONTAINER_ARRAY:
+      for (size_t i = 0; i < container->size; i++) {
+        bitarray_set(bitarray, base + container->values[i], true);
+      }
+      break;
+    case CONTAINER_RUNS:
+      for (size_t i = 0; i < container->size; i++) {
+        const size_t start = container->values[2 * i];
+        const size_t last = container->values[2 * i + 1];
+        bitarray_fill_range(bitarray, base + start, last - start + 1, true);
+      }
+      break;
+    case CONTAINER_BITMAP:
+      for (size_t i = 0; i < CHUNK_WORDS; i++) {
+        if (container->words[i] != 0) {
+          bitarray_set_u64(bitarray, base + i * WORD_BITS, container->words[i]);
+        }
+      }
+      break;
+    }
+  }
+  return bitarray;
+}
+
+void hybrid_free(hybrid_t* const hybrid) {
+  if (hybrid == NULL) {
+    return;
+  }
+  for (size_t chunk = 0; chunk < hybrid->nchunks; chunk++) {
+    container_free(&hybrid->chunks[chunk]);
+  }
+  free(hybrid->chunks);
+  free(hybrid);
+}
+
+size_t hybrid_get_bit_sz(const hybrid_t* const hybrid) {
+  return hybrid->bit_sz;
+}
+
+size_t hybrid_get_space(const hybrid_t* const hybrid) {
+  size_t space = sizeof(struct hybrid) + hybrid->nchunks * sizeof(container_t);
+  for (size_t chunk = 0; chunk < hybrid->nchunks; chunk++) {
+    space += container_space(&hybrid->chunks[chunk]);
+  }
+  return space;
+}
+
+bool hybrid_get(const hybrid_t* const hybrid, const size_t bit_index) {
+  assert(bit_index < hybrid->bit_sz);
+  return container_get(&hybrid->chunks[bit_index / CHUNK_BITS], bit_index % CHUNK_BITS);
+}
+
+bool hybrid_set(hybrid_t* const hybrid,
+                const size_t bit_index,
+                const bool value) {
+  assert(bit_index < hybrid->bit_sz);
+  container_t* const container = &hybrid->chunks[bit_index / CHUNK_BITS];
+  if (container_get(container, bit_index % CHUNK_BITS) == value) {
+    return true;
+  }
+  return container_set(container, bit_index % CHUNK_BITS, value);
+}
+
+size_t hybrid_count(const hybrid_t* const hybrid,
+                    const size_t bit_offset,
+                    const size_t bit_length) {
+  assert(bit_offset + bit_length <= hybrid->bit_sz);
+  const size_t bit_end = bit_offset + bit_length;
+  size_t count = 0;
+  size_t pos = bit_offset;
+  while (pos < bit_end) {
+    const size_t chunk = pos / CHUNK_BITS;
+    const size_t base = chunk * CHUNK_BITS;
+    const size_t hi = bit_end - base < CHUNK_BITS ? bit_end - base : CHUNK_BITS;
+    count += container_count(&hybrid->chunks[chunk], pos - base, hi);
+    pos = base + hi;
+  }
+  return count;
+}
+
+hybrid_t* hybrid_logic(const hybrid_t* const a,
+                       const hybrid_t* const b,
+                       const bitarray_logic_t op) {
+  assert(a->bit_sz == b->bit_sz);
+  hybrid_t* const out = hybrid_new(a->bit_sz);
+  if (out == NULL) {
+    return NULL;
+  }
+  for (size_t chunk = 0; chunk < a->nchunks; chunk++) {
+    if (!container_logic(&out->chunks[chunk], &a->chunks[chunk], &b->chunks[chunk], op)) {
+      hybrid_free(out);
+      return NULL;
+    }
+  }
+  return out;
+}
+
+size_t hybrid_logic_count(const hybrid_t* const a,
+                          const hybrid_t* const b,
+                          const bitarray_logic_t op) {
+  assert(a->bit_sz == b->bit_sz);
+  size_t count = 0;
+  for (size_t chunk = 0; chunk < a->nchunks; chunk++) {
+    count += container_logic_count(&a->chunks[chunk], &b->chunks[chunk], op);
+  }
+  return count;
+}
+
+bool hybrid_rotate(hybrid_t* const hybrid,
+                   const size_t bit_offset,
+                   const size_t bit_length,
+                   ssize_t bit_right_amount) {
+  assert(bit_offset + bit_length <= hybrid->bit_sz);
+  if (bit_length == 0) {
+    return true;
+  }
+  if (bit_right_amount < 0) {
+    bit_right_amount = bit_length - ((-bit_right_amount) % bit_length);
+  } else {
+    bit_right_amount %= bit_length;
+  }
+  if (bit_right_amount == 0) {
+    return true;
+  }
+
+  // Position p of the rotated subarray takes the bit at p + bit_length -
+  // bit_right_amount if p < split, and at p - bit_right_amount otherwise.
+  const size_t bit_end = bit_offset + bit_length;
+  const size_t split = bit_offset + bit_right_amount;
+  const size_t first = bit_offset / CHUNK_BITS;
+  const size_t nchunks = (bit_end - 1) / CHUNK_BITS - first + 1;
+
+  // The new containers of the chunks the subarray overlaps are built aside,
+  // so that the old ones stay readable until all are done.  A chunk whose
+  // bits all come from one whole old chunk takes over its container, which
+  // no other chunk then reads; the flags record which were moved.
+  container_t* const rotated = calloc(nchunks, sizeof(container_t));
+  bool* const moved = calloc(2 * nchunks, sizeof(bool));
+  uint64_t* const buffers = malloc(2 * CHUNK_WORDS * sizeof(uint64_t));
+  if (rotated == NULL || moved == NULL || buffers == NULL) {
+    free(rotated);
+    free(moved);
+    free(buffers);
+    return false;
+  }
+  bool* const moved_from = moved;
+  bool* const moved_to = moved + nchunks;
+  uint64_t* const words = buffers;
+  uint64_t* const scratch = buffers + CHUNK_WORDS;
+
+  bool ok = true;
+  for (size_t i = 0; i < nchunks && ok; i++) {
+    const size_t base = (first + i) * CHUNK_BITS;
+    const size_t nbits = chunk_bits(hybrid, first + i);
+    const size_t lo = bit_offset > base ? bit_offset : base;
+    const size_t hi = bit_end < base + nbits ? bit_end : base + nbits;
+
+    if (lo == base && hi == base + CHUNK_BITS &&
+        (base + CHUNK_BITS <= split || base >= split)) {
+      const size_t src = base < split ? base + bit_length - bit_right_amount
+                                      : base - bit_right_amount;
+      if (src % CHUNK_BITS == 0) {
+        rotated[i] = hybrid->chunks[src / CHUNK_BITS];
+        moved_from[src / CHUNK_BITS - first] = true;
+        moved_to[i] = true;
+        continue;
+      }
+    }
+
+    // Bits of the chunk outside the subarray keep their values.
+    if (lo > base || hi < base + nbits) {
+      container_to_words(&hybrid->chunks[first + i], words);
+    } else {
+      memset(words, 0, CHUNK_WORDS * sizeof(uint64_t));
+    }
+    if (lo < split) {
+      const size_t end = hi < split ? hi : split;
+      copy_from_chunks(hybrid, lo + bit_length - bit_right_amount, words, lo - base,
+                       end - lo, scratch);
+    }
+    if (hi > split) {
+      const size_t start = lo > split ? lo : split;
+      copy_from_chunks(hybrid, start - bit_right_amount, words, start - base,
+                       hi - start, scratch);
+    }
+    ok = container_from_words(&rotated[i], words);
+  }
+
+  if (ok) {
+    for (size_t i = 0; i < nchunks; i++) {
+      if (!moved_from[i]) {
+        container_free(&hybrid->chunks[first + i]);
+      }
+    }
+    memcpy(&hybrid->chunks[first], rotated, nchunks * sizeof(container_t));
+  } else {
+    for (size_t i = 0; i < nchunks; i++) {
+      if (!moved_to[i]) {
+        container_free(&rotated[i]);
+      }
+    }
+  }
+  free(rotated);
+  free(moved);
+  free(buffers);
+  return ok;
+}
+
+static size_t chunk_bits(const hybrid_t* const hybrid, const size_t chunk) {
+  const size_t base = chunk * CHUNK_BITS;
+  return hybrid->bit_sz - base < CHUNK_BITS ? hybrid->bit_sz - base : CHUNK_BITS;
+}
+
+static void container_free(container_t* const container) {
+  free(container->values);
+  free(container->words);
+  memset(container, 0, sizeof(container_t));
+}
+
+static size_t container_space(const container_t* const container) {
+  switch (container->kind) {
+  case CONTAINER_ARRAY:
+    return container->capacity * sizeof(uint16_t);
+  case CONTAINER_RUNS:
+    return container->size * 2 * sizeof(uint16_t);
+  case CONTAINER_BITMAP:
+    return CHUNK_WORDS * sizeof(uint64_t);
+  }
+  assert(false);
+  return 0;
+}
+
+static bool container_from_words(container_t* const container,
+                                 const uint64_t* const words) {
+  // A run starts at every one whose lower neighbor is a zero.
+  size_t cardinality = 0;
+  size_t nruns = 0;
+  uint64_t carry = 0;
+  for (size_t i = 0; i < CHUNK_WORDS; i++) {
+    cardinality += __builtin_popcountll(words[i]);
+    nruns += __builtin_popcountll(words[i] & ~((words[i] << 1) | carry));
+    carry = words[i] >> (WORD_BITS - 1);
+  }
+
+  container_t result;
+  memset(&result, 0, sizeof(container_t));
+  result.cardinality = cardinality;
+  const size_t array_bytes = cardinality * sizeof(uint16_t);
+  const size_t runs_bytes = nruns * 2 * sizeof(uint16_t);
+  const size_t bitmap_bytes = CHUNK_WORDS * sizeof(uint64_t);
+
+  if (cardinality == 0) {
+    // Empty: no storage at all.
+  } else if (runs_bytes < array_bytes && runs_bytes < bitmap_bytes) {
+    result.kind = CONTAINER_RUNS;
+    result.values = malloc(runs_bytes);
+    if (result.values == NULL) {
+      return false;
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < nruns; i++) {
+      const size_t start = next_bit(words, pos, true);
+      pos = next_bit(words, start, false);
+      result.values[2 * i] = start;
+      result.values[2 * i + 1] = pos - 1;
+    }
+    result.size = nruns;
+  } else if (cardinality <= ARRAY_MAX) {
+    result.kind = CONTAINER_ARRAY;
+    result.values = malloc(array_bytes);
+    if (result.values == NULL) {
+      return false;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < CHUNK_WORDS; i++) {
+      for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+        result.values[n++] = i * WORD_BITS + __builtin_ctzll(word);
+      }
+    }
+    result.size = cardinality;
+    result.capacity = cardinality;
+  } else {
+    result.kind = CONTAINER_BITMAP;
+    result.words = malloc(bitmap_bytes);
+    if (result.words == NULL) {
+      return false;
+    }
+    memcpy(result.words, words, bitmap_bytes);
+  }
+  *container = result;
+  return true;
+}
+
+static void container_to_words(const container_t* const container,
+                               uint64_t* const words) {
+  if (container->kind == CONTAINER_BITMAP) {
+    memcpy(words, container->words, CHUNK_WORDS * sizeof(uint64_t));
+    return;
+  }
+  memset(words, 0, CHUNK_WORDS * sizeof(uint64_t));
+  if (container->kind == CONTAINER_ARRAY) {
+    for (size_t i = 0; i < container->size; i++) {
+      const size_t pos = container->values[i];
+      words[pos / WORD_BITS] |= 1ULL << (pos % WORD_BITS);
+    }
+  } else {
+    for (size_t i = 0; i < container->size; i++) {
+      fill_words(words, container->values[2 * i], container->values[2 * i + 1] + 1);
+    }
+  }
+}
+
+static const uint64_t* container_words(const container_t* const container,
+                                       uint64_t* const scratch) {
+  if (container->kind == CONTAINER_BITMAP) {
+    return container->words;
+  }
+  container_to_words(container, scratch);
+  return scratch;
+}
+
+static bool container_clone(container_t* const dst, const container_t* const src) {
+  container_t result = *src;
+  if (src->kind == CONTAINER_BITMAP) {
+    result.words = malloc(CHUNK_WORDS * sizeof(uint64_t));
+    if (result.words == NULL) {
+      return false;
+    }
+    memcpy(result.words, src->words, CHUNK_WORDS * sizeof(uint64_t));
+  } else if (src->size > 0) {
+    const size_t nvalues = src->kind == CONTAINER_RUNS ? 2 * src->size : src->size;
+    result.values = malloc(nvalues * sizeof(uint16_t));
+    if (result.values == NULL) {
+      return false;
+    }
+    memcpy(result.values, src->values, nvalues * sizeof(uint16_t));
+    result.capacity = src->kind == CONTAINER_ARRAY ? src->size : 0;
+  }
+  *dst = result;
+  return true;
+}
+
+static bool container_get(const container_t* const container, const size_t pos) {
+  switch (container->kind) {
+  case CONTAINER_ARRAY: {
+    const size_t i = lower_bound(container->values, container->size, pos);
+    return i < container->size && container->values[i] == pos;
+  }
+  case CONTAINER_RUNS: {
+    const size_t i = runs_before(container, pos);
+    return i > 0 && pos <= container->values[2 * i - 1];
+  }
+  case CONTAINER_BITMAP:
+    return (container->words[pos / WORD_BITS] >> (pos % WORD_BITS)) & 1;
+  }
+  assert(false);
+  return false;
+}
+
+static bool container_set(container_t* const container,
+                          const size_t pos,
+                          const bool value) {
+  // Arrays with room take the position in place, and bitmaps flip it in
+  // place; a bitmap that falls back to ARRAY_MAX ones is re-encoded if it
+  // can be.  Everything else is re-encoded from its words.
+  if (container->kind == CONTAINER_ARRAY && (!value || container->size < ARRAY_MAX)) {
+    const size_t i = lower_bound(container->values, container->size, pos);
+    if (!value) {
+      memmove(&container->values[i], &container->values[i + 1],
+              (container->size - i - 1) * sizeof(uint16_t));
+      container->size--;
+      container->cardinality--;
+      if (container->size == 0) {
+        container_free(container);
+      }
+      return true;
+    }
+    if (container->size == container->capacity) {
+      size_t capacity = container->capacity > 0 ? 2 * container->capacity : 4;
+      capacity = capacity < ARRAY_MAX ? capacity : ARRAY_MAX;
+      uint16_t* const values = realloc(container->values, capacity * sizeof(uint16_t));
+      if (values == NULL) {
+        return false;
+      }
+      container->values = values;
+      container->capacity = capacity;
+    }
+    memmove(&container->values[i + 1], &container->values[i],
+            (container->size - i) * sizeof(uint16_t));
+    container->values[i] = pos;
+    container->size++;
+    container->cardinality++;
+    return true;
+  }
+
+  if (container->kind == CONTAINER_BITMAP) {
+    container->words[pos / WORD_BITS] ^= 1ULL << (pos % WORD_BITS);
+    if (value) {
+      container->cardinality++;
+    } else {
+      container->cardinality--;
+    }
+    container_t smaller;
+    if (container->cardinality <= ARRAY_MAX &&
+        container_from_words(&smaller, container->words)) {
+      container_free(container);
+      *container = smaller;
+    }
+    return true;
+  }
+
+  uint64_t words[CHUNK_WORDS];
+  container_to_words(container, words);
+  words[pos / WORD_BITS] ^= 1ULL << (pos % WORD_BITS);
+  container_t result;
+  if (!container_from_words(&result, words)) {
+    return false;
+  }
+  container_free(container);
+  *container = result;
+  return true;
+}
+
+static size_t container_count(const container_t* const container,
+                              const size_t lo,
+                              const size_t hi) {
+  if (lo == 0 && hi == CHUNK_BITS) {
+    return container->cardinality;
+  }
+  switch (container->kind) {
+  case CONTAINER_ARRAY:
+    return lower_bound(container->values, container->size, hi) -
+           lower_bound(container->values, container->size, lo);
+  case CONTAINER_RUNS: {
+    size_t count = 0;
+    size_t i = runs_before(container, lo);
+    i = i > 0 ? i - 1 : 0;
+    for (; i < container->size && container->values[2 * i] < hi; i++) {
+      const size_t start = container->values[2 * i];
+      const size_t end = container->values[2 * i + 1] + 1;
+      const size_t from = start > lo ? start : lo;
+      const size_t to = end < hi ? end : hi;
+      count += to > from ? to - from : 0;
+    }
+    return count;
+  }
+  case CONTAINER_BITMAP: {
+    if (lo >= hi) {
+      return 0;
+    }
+    const size_t first = lo / WORD_BITS;
+    const size_t last = (hi - 1) / WORD_BITS;
+    const uint64_t first_mask = ~0ULL << (lo % WORD_BITS);
+    const uint64_t last_mask = ~0ULL >> (WORD_BITS - 1 - (hi - 1) % WORD_BITS);
+    if (first == last) {
+      return __builtin_popcountll(container->words[first] & first_mask & last_mask);
+    }
+    size_t count = __builtin_popcountll(container->words[first] & first_mask);
+    for (size_t i = first + 1; i < last; i++) {
+      count += __builtin_popcountll(container->words[i]);
+    }
+    return count + __builtin_popcountll(container->words[last] & last_mask);
+  }
+  }
+  assert(false);
+  return 0;
+}
+
+static bool container_logic(container_t* const out,
+                            const container_t* const a,
+                            const container_t* const b,
+                            const bitarray_logic_t op) {
+  container_t result;
+  memset(&result, 0, sizeof(container_t));
+
+  // An empty operand leaves either nothing or a copy of the other one.
+  if (a->cardinality == 0 || b->cardinality == 0) {
+    const bool keep_a = a->cardinality > 0 && op != BITARRAY_AND;
+    const bool keep_b = b->cardinality > 0 && (op == BITARRAY_OR || op == BITARRAY_XOR);
+    if (keep_a || keep_b) {
+      return container_clone(out, keep_a ? a : b);
+    }
+    *out = result;
+    return true;
+  }
+
+  // Results that are subsets of an array, or small unions of two arrays,
+  // are merged as arrays.
+  const bool subset = op == BITARRAY_AND || op == BITARRAY_ANDNOT;
+  const container_t* const filtered =
+      a->kind == CONTAINER_ARRAY ? a
+      : (op == BITARRAY_AND && b->kind == CONTAINER_ARRAY ? b : NULL);
+  if (a->kind == CONTAINER_ARRAY && b->kind == CONTAINER_ARRAY &&
+      (subset || a->size + b->size <= ARRAY_MAX)) {
+    result.values = malloc((subset ? a->size : a->size + b->size) * sizeof(uint16_t));
+    if (result.values == NULL) {
+      return false;
+    }
+    result.size = merge_arrays(result.values, a, b, op);
+  } else if (subset && filtered != NULL) {
+    result.values = malloc(filtered->size * sizeof(uint16_t));
+    if (result.values == NULL) {
+      return false;
+    }
+    result.size = filtered == a ? filter_array(result.values, a, b, op)
+                                : filter_array(result.values, b, a, op);
+  } else {
+    uint64_t* const buffers = malloc(3 * CHUNK_WORDS * sizeof(uint64_t));
+    if (buffers == NULL) {
+      return false;
+    }
+    const uint64_t* const x = container_words(a, buffers);
+    const uint64_t* const y = container_words(b, buffers + CHUNK_WORDS);
+    uint64_t* const words = buffers + 2 * CHUNK_WORDS;
+    for (size_t i = 0; i < CHUNK_WORDS; i++) {
+      words[i] = bitarray_logic_word(op, x[i], y[i]);
+    }
+    const bool ok = container_from_words(out, words);
+    free(buffers);
+    return ok;
+  }
+
+  result.cardinality = result.size;
+  result.capacity = result.size;
+  if (result.size == 0) {
+    container_free(&result);
+  }
+  *out = result;
+  return true;
+}
+
+static size_t container_logic_count(const container_t* const a,
+                                    const container_t* const b,
+                                    const bitarray_logic_t op) {
+  if (a->cardinality == 0 || b->cardinality == 0) {
+    const size_t count_a = op != BITARRAY_AND ? a->cardinality : 0;
+    const size_t count_b = op == BITARRAY_OR || op == BITARRAY_XOR ? b->cardinality : 0;
+    return count_a + count_b;
+  }
+  if (a->kind == CONTAINER_ARRAY && b->kind == CONTAINER_ARRAY) {
+    return merge_arrays(NULL, a, b, op);
+  }
+  if (op == BITARRAY_AND || op == BITARRAY_ANDNOT) {
+    if (a->kind == CONTAINER_ARRAY) {
+      return filter_array(NULL, a, b, op);
+    }
+    if (op == BITARRAY_AND && b->kind == CONTAINER_ARRAY) {
+      return filter_array(NULL, b, a, op);
+    }
+  }
+  uint64_t scratch_a[CHUNK_WORDS];
+  uint64_t scratch_b[CHUNK_WORDS];
+  const uint64_t* const x = container_words(a, scratch_a);
+  const uint64_t* const y = container_words(b, scratch_b);
+  size_t count = 0;
+  for (size_t i = 0; i < CHUNK_WORDS; i++) {
+    count += __builtin_popcountll(bitarray_logic_word(op, x[i], y[i]));
+  }
+  return count;
+}
+
+static size_t merge_arrays(uint16_t* const out,
+                           const container_t* const a,
+                           const container_t* const b,
+                           const bitarray_logic_t op) {
+  // Whether op keeps a position found only in a, only in b, or in both.
+  const bool keep_a = bitarray_logic_word(op, 1, 0);
+  const bool keep_b = bitarray_logic_word(op, 0, 1);
+  const bool keep_both = bitarray_logic_word(op, 1, 1);
+  size_t i = 0;
+  size_t j = 0;
+  size_t n = 0;
+  while (i < a->size && j < b->size) {
+    const uint16_t x = a->values[i];
+    const uint16_t y = b->values[j];
+    const bool keep = x < y ? keep_a : (y < x ? keep_b : keep_both);
+    if (keep && out != NULL) {
+      out[n] = x < y ? x : y;
+    }
+    n += keep;
+    i += x <= y;
+    j += y <= x;
+  }
+  for (; i < a->size && keep_a; i++) {
+    if (out != NULL) {
+      out[n] = a->values[i];
+    }
+    n++;
+  }
+  for (; j < b->size && keep_b; j++) {
+    if (out != NULL) {
+      out[n] = b->values[j];
+    }
+    n++;
+  }
+  return n;
+}
+
+static size_t filter_array(uint16_t* const out,
+                           const container_t* const a,
+                           const container_t* const b,
+                           const bitarray_logic_t op) {
+  assert(op == BITARRAY_AND || op == BITARRAY_ANDNOT);
+  const bool wanted = op == BITARRAY_AND;
+  size_t n = 0;
+  for (size_t i = 0; i < a->size; i++) {
+    const bool keep = container_get(b, a->values[i]) == wanted;
+    if (keep && out != NULL) {
+      out[n] = a->values[i];
+    }
+    n += keep;
+  }
+  return n;
+}
+
+static size_t lower_bound(const uint16_t* const values,
+                          const size_t n,
+                          const size_t pos) {
+  size_t lo = 0;
+  size_t hi = n;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (values[mid] < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static size_t runs_before(const container_t* const container, const size_t pos) {
+  size_t lo = 0;
+  size_t hi = container->size;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (container->values[2 * mid] <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static size_t next_bit(const uint64_t* const words, size_t pos, const bool value) {
+  while (pos < CHUNK_BITS) {
+    uint64_t word = value ? words[pos / WORD_BITS] : ~words[pos / WORD_BITS];
+    word &= ~0ULL << (pos % WORD_BITS);
+    if (word != 0) {
+      return pos - pos % WORD_BITS + __builtin_ctzll(word);
+    }
+    pos += WORD_BITS - pos % WORD_BITS;
+  }
+  return CHUNK_BITS;
+}
+
+static void fill_words(uint64_t* const words, size_t lo, const size_t hi) {
+  while (lo < hi) {
+    const size_t end = hi < lo - lo % WORD_BITS + WORD_BITS ? hi : lo - lo % WORD_BITS + WORD_BITS;
+    const size_t n = end - lo;
+    const uint64_t mask = n == WORD_BITS ? ~0ULL : ((1ULL << n) - 1) << (lo % WORD_BITS);
+    words[lo / WORD_BITS] |= mask;
+    lo = end;
+  }
+}
+
+static void copy_bits(uint64_t* const dst,
+                      size_t dst_bit,
+                      const uint64_t* const src,
+                      size_t src_bit,
+                      size_t nbits) {
+  while (nbits > 0) {
+    const size_t shift = dst_bit % WORD_BITS;
+    const size_t take = nbits < WORD_BITS - shift ? nbits : WORD_BITS - shift;
+    uint64_t bits = src[src_bit / WORD_BITS] >> (src_bit % WORD_BITS);
+    if (src_bit % WORD_BITS + take > WORD_BITS) {
+      bits |= src[src_bit / WORD_BITS + 1] << (WORD_BITS - src_bit % WORD_BITS);
+    }
+    const uint64_t mask = (take == WORD_BITS ? ~0ULL : (1ULL << take) - 1) << shift;
+    dst[dst_bit / WORD_BITS] = (dst[dst_bit / WORD_BITS] & ~mask) | ((bits << shift) & mask);
+    dst_bit += take;
+    src_bit += take;
+    nbits -= take;
+  }
+}
+
+static void copy_from_chunks(const hybrid_t* const hybrid,
+                             size_t src_bit,
+                             uint64_t* const words,
+                             size_t dst_bit,
+                             size_t nbits,
+                             uint64_t* const scratch) {
+  while (nbits > 0) {
+    const size_t chunk = src_bit / CHUNK_BITS;
+    const size_t within = src_bit % CHUNK_BITS;
+    const size_t take = nbits < CHUNK_BITS - within ? nbits : CHUNK_BITS - within;
+    copy_bits(words, dst_bit, container_words(&hybrid->chunks[chunk], scratch), within, take);
+    src_bit += take;
+    dst_bit += take;
+    nbits -= take;
+  }
+}
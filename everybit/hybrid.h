@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// A hybrid bit array for bitmaps that are dense in some regions and sparse
+// in others.  The bits are cut into chunks of 65536, and each chunk is held
+// in whichever of three containers is smallest for its contents:
+//   array:  the sorted 16-bit positions of its ones, when there are few;
+//   runs:   the sorted [start, last] pairs of its runs of ones; or
+//   bitmap: its 1024 words verbatim, when neither of the others is smaller.
+// A chunk with no ones takes no space beyond its table entry.
+//
+// Reads and writes of single bits touch one container.  Counting uses the
+// number of ones each container keeps, and the logical operations combine
+// the chunks pairwise, merging arrays directly and falling back to words
+// only where a bitmap is involved.  A rotation by a whole number of chunks
+// moves containers instead of bits.
+
+#ifndef HYBRID_H
+#define HYBRID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "./bitarray.h"
+
+// ********************************* Types **********************************
+
+// Abstract data type representing a hybrid bit array.
+typedef struct hybrid hybrid_t;
+
+// ******************************* Prototypes *******************************
+
+// Allocates a hybrid bit array of bit_sz bits, all clear.  Returns NULL if
+// memory could not be allocated.
+hybrid_t* hybrid_new(const size_t bit_sz);
+
+// Converts a packed bit array.  Returns NULL if memory could not be
+// allocated.
+hybrid_t* hybrid_from_bitarray(const bitarray_t* const bitarray);
+
+// Converts into a new packed bit array of the same size.  Returns NULL if
+// memory could not be allocated.
+bitarray_t* hybrid_to_bitarray(const hybrid_t* const hybrid);
+
+// Frees a hybrid bit array.
+void hybrid_free(hybrid_t* const hybrid);
+
+// Returns the number of bits a hybrid bit array represents.
+size_t hybrid_get_bit_sz(const hybrid_t* const hybrid);
+
+// Returns the number of bytes a hybrid bit array takes, chunk table and
+// containers included, for comparison with the bit_sz / 8 bytes of the
+// packed form.
+size_t hybrid_get_space(const hybrid_t* const hybrid);
+
+// Indexes into a hybrid bit array, retrieving the bit at the specified
+// zero-based index.
+bool hybrid_get(const hybrid_t* const hybrid, const size_t bit_index);
+
+// Indexes into a hybrid bit array, setting the bit at the specified
+// zero-based index.  The chunk changes container when another one becomes
+// smaller.  Returns false, leaving the array untouched, if memory could not
+// be allocated.
+bool hybrid_set(hybrid_t* const hybrid,
+                const size_t bit_index,
+                const bool value);
+
+// Returns the number of set bits in [bit_offset, bit_offset + bit_length).
+// Whole chunks are counted without being looked at.
+size_t hybrid_count(const hybrid_t* const hybrid,
+                    const size_t bit_offset,
+                    const size_t bit_length);
+
+// Returns a new hybrid bit array holding a op b, which must have the same
+// size.  Returns NULL if memory could not be allocated.
+hybrid_t* hybrid_logic(const hybrid_t* const a,
+                       const hybrid_t* const b,
+                       const bitarray_logic_t op);
+
+// Returns the number of set bits in a op b without building the result.
+size_t hybrid_logic_count(const hybrid_t* const a,
+                          const hybrid_t* const b,
+                          const bitarray_logic_t op);
+
+// Rotates the subarray [bit_offset, bit_offset + bit_length) right by
+// bit_right_amount, exactly like bitarray_rotate.  Chunks that land whole
+// on a chunk boundary are remapped by moving their containers; only the
+// others are rebuilt bit by bit.  Returns false, leaving the array
+// untouched, if memory could not be allocated.
+bool hybrid_rotate(hybrid_t* const hybrid,
+                   const size_t bit_offset,
+                   const size_t bit_length,
+                   const ssize_t bit_right_amount);
+
+#endif  // HYBRID_H
@@ -34,12 +34,18 @@
 // will report close to zero time elapsed, while on Darwin and Cygwin it will
 // report the wall time, which is about 1 second.
 
-// We need _POSIX_C_SOURCES to pick up 'struct timespec' and clock_gettime.
+// We need _POSIX_C_SOURCES to pick up 'struct timespec' and clock_gettime,
+// and _DEFAULT_SOURCE for syscall, which opens the hardware counters.
 #define _POSIX_C_SOURCE 200112L
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef __APPLE__
   #include <time.h>
@@ -49,6 +55,17 @@
   #include "mach/mach_time.h"
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+  #include <cpuid.h>
+#endif
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
 #include "./ktiming.h"
 
 
@@ -62,19 +79,120 @@
   #define KTIMING_CLOCK_ID CLOCK_PROCESS_CPUTIME_ID
 #endif
 
+#if defined(__x86_64__) || defined(__i386__)
+  // Whether there may be a time-stamp counter to read.
+  #define KTIMING_HAVE_TSC 1
+#endif
+
+// How long the time-stamp counter is calibrated against the wall clock, in
+// nanoseconds.
+#define KTIMING_CALIBRATION_NSEC 20000000
+
+// The CPUID leaf and EDX bit that say whether rdtscp is supported.
+#define KTIMING_CPUID_EXTENDED 0x80000001
+#define KTIMING_CPUID_RDTSCP (1U << 27)
+
+// A perf_event_attr config for a cache event: which cache, which kind of
+// access, and whether to count accesses or misses.
+#define KTIMING_CACHE_EVENT(cache, op, result) \
+  ((cache) | ((op) << 8) | ((result) << 16))
+
+
+// ******************************* Prototypes *******************************
+
+#ifndef __APPLE__
+// Reads a clock_gettime clock, falling back to CLOCK_MONOTONIC if it cannot.
+static clockmark_t ktiming_clock_gettime(const int clock_id);
+#endif
+
+// Returns the time-stamp counter, read with rdtscp, which waits for the
+// instructions before it to finish.
+static inline uint64_t ktiming_rdtscp();
+
+// Calibrates the time-stamp counter against the wall clock, once.  Returns
+// false if there is no rdtscp.
+static bool ktiming_calibrate();
+
+
+// ******************************** Globals *********************************
+
+// The clock ktiming_getmark reads.
+static ktiming_clock_t ktiming_clock = KTIMING_CPU;
+
+// Time-stamp counter ticks per nanosecond, and the count at calibration,
+// which marks are taken relative to; 0 until calibrated.
+static double ktiming_tsc_per_nsec = 0;
+static uint64_t ktiming_tsc_base = 0;
+
+static const char* const ktiming_clock_names[] = {"cpu", "wall", "thread", "cycles"};
+
+static const char* const ktiming_event_names[] = {
+  "cycles", "instructions", "llc-misses", "dtlb-misses", "loads", "stores"
+};
+
+// The file descriptor of each event's counter, or -1 if it is not open.
+static int ktiming_counter_fds[KTIMING_NEVENTS];
+
+// Whether ktiming_counter_fds has been set up at all.
+static bool ktiming_counters_ready = false;
+
+#ifdef __linux__
+// The perf_event_open type and config of each event.
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} ktiming_events[] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HW_CACHE, KTIMING_CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                           PERF_COUNT_HW_CACHE_OP_READ,
+                                           PERF_COUNT_HW_CACHE_RESULT_MISS)},
+  {PERF_TYPE_HW_CACHE, KTIMING_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                           PERF_COUNT_HW_CACHE_OP_READ,
+                                           PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+  {PERF_TYPE_HW_CACHE, KTIMING_CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                           PERF_COUNT_HW_CACHE_OP_WRITE,
+                                           PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+};
+#endif
+
 
 // ******************************* Functions ********************************
 
 clockmark_t ktiming_getmark() {
+  return ktiming_getmark_clock(ktiming_clock);
+}
+
+clockmark_t ktiming_getmark_clock(const ktiming_clock_t clock) {
+  if (clock == KTIMING_CYCLES && ktiming_calibrate()) {
+    return (ktiming_rdtscp() - ktiming_tsc_base) / ktiming_tsc_per_nsec;
+  }
 #ifdef __APPLE__
   const uint64_t now = mach_absolute_time();
   const Nanoseconds now_nanoseconds = AbsoluteToNanoseconds(*(AbsoluteTime*)&now);
   return *(uint64_t*)&now_nanoseconds;
+#elif defined(__CYGWIN__)
+  return ktiming_clock_gettime(KTIMING_CLOCK_ID);
 #else
+  switch (clock) {
+  case KTIMING_WALL:
+  case KTIMING_CYCLES:
+    return ktiming_clock_gettime(CLOCK_MONOTONIC);
+  case KTIMING_THREAD:
+    return ktiming_clock_gettime(CLOCK_THREAD_CPUTIME_ID);
+  default:
+    return ktiming_clock_gettime(KTIMING_CLOCK_ID);
+  }
+#endif
+}
+
+#ifndef __APPLE__
+static clockmark_t ktiming_clock_gettime(const int clock_id) {
   struct timespec now;
   uint64_t now_nanoseconds;
 
-  int stat = clock_gettime(KTIMING_CLOCK_ID, &now);
+  int stat = clock_gettime(clock_id, &now);
   if (stat != 0) {
     // Whoops, we couldn't get hold of the clock.  If we're on a
     // platform that supports it, we try again with
@@ -94,9 +212,77 @@ clockmark_t ktiming_getmark() {
   now_nanoseconds = now.tv_nsec;
   now_nanoseconds += ((uint64_t)now.tv_sec) * 1000 * 1000 * 1000;
   return now_nanoseconds;
+}
+#endif
+
+inline static uint64_t ktiming_rdtscp() {
+#ifdef KTIMING_HAVE_TSC
+  uint32_t low, high, aux;
+  __asm__ volatile("rdtscp" : "=a"(low), "=d"(high), "=c"(aux));
+  return ((uint64_t)high << 32) | low;
+#else
+  return 0;
+#endif
+}
+
+static bool ktiming_calibrate() {
+  if (ktiming_tsc_per_nsec > 0) {
+    return true;
+  }
+#ifdef KTIMING_HAVE_TSC
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(KTIMING_CPUID_EXTENDED, &eax, &ebx, &ecx, &edx) ||
+      (edx & KTIMING_CPUID_RDTSCP) == 0) {
+    return false;
+  }
+
+  // Count ticks across a busy wait on the wall clock.
+  const clockmark_t start = ktiming_getmark_clock(KTIMING_WALL);
+  const uint64_t start_tsc = ktiming_rdtscp();
+  clockmark_t end;
+  do {
+    end = ktiming_getmark_clock(KTIMING_WALL);
+  } while (end - start < KTIMING_CALIBRATION_NSEC);
+  const uint64_t end_tsc = ktiming_rdtscp();
+
+  ktiming_tsc_base = start_tsc;
+  ktiming_tsc_per_nsec = (double)(end_tsc - start_tsc) / (end - start);
+  return ktiming_tsc_per_nsec > 0;
+#else
+  return false;
 #endif
 }
 
+bool ktiming_set_clock(const ktiming_clock_t clock) {
+  if (clock == KTIMING_CYCLES && !ktiming_calibrate()) {
+    return false;
+  }
+  ktiming_clock = clock;
+  return true;
+}
+
+ktiming_clock_t ktiming_get_clock() {
+  return ktiming_clock;
+}
+
+bool ktiming_clock_from_name(const char* const name, ktiming_clock_t* const clock) {
+  for (size_t i = 0; i < sizeof(ktiming_clock_names) / sizeof(ktiming_clock_names[0]); i++) {
+    if (strcmp(name, ktiming_clock_names[i]) == 0) {
+      *clock = (ktiming_clock_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* ktiming_clock_name(const ktiming_clock_t clock) {
+  return ktiming_clock_names[clock];
+}
+
+double ktiming_cycles_per_nsec() {
+  return ktiming_calibrate() ? ktiming_tsc_per_nsec : 0;
+}
+
 uint64_t ktiming_diff_usec(const clockmark_t* const start,
                            const clockmark_t* const end) {
   return *end - *start;
@@ -107,3 +293,80 @@ float ktiming_diff_sec(const clockmark_t* const start,
   return (float)ktiming_diff_usec(start, end) / 1000000000.0f;
 }
 
+
+int ktiming_counters_open() {
+  ktiming_counters_close();
+  int opened = 0;
+#ifdef __linux__
+  for (int event = 0; event < KTIMING_NEVENTS; event++) {
+    // Each counter is opened on its own rather than in a group: the kernel
+    // cannot read a group's counts inherited from the threads the parallel
+    // operations start.
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = ktiming_events[event].type;
+    attr.config = ktiming_events[event].config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    ktiming_counter_fds[event] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (ktiming_counter_fds[event] >= 0) {
+      opened++;
+    }
+  }
+#endif
+  return opened;
+}
+
+void ktiming_counters_close() {
+  for (int event = 0; event < KTIMING_NEVENTS; event++) {
+#ifdef __linux__
+    if (ktiming_counters_ready && ktiming_counter_fds[event] >= 0) {
+      close(ktiming_counter_fds[event]);
+    }
+#endif
+    ktiming_counter_fds[event] = -1;
+  }
+  ktiming_counters_ready = true;
+}
+
+void ktiming_counters_start() {
+#ifdef __linux__
+  for (int event = 0; ktiming_counters_ready && event < KTIMING_NEVENTS; event++) {
+    if (ktiming_counter_fds[event] >= 0) {
+      ioctl(ktiming_counter_fds[event], PERF_EVENT_IOC_RESET, 0);
+      ioctl(ktiming_counter_fds[event], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#endif
+}
+
+void ktiming_counters_stop(ktiming_counts_t* const counts) {
+  memset(counts, 0, sizeof(*counts));
+#ifdef __linux__
+  for (int event = 0; ktiming_counters_ready && event < KTIMING_NEVENTS; event++) {
+    const int fd = ktiming_counter_fds[event];
+    if (fd < 0) {
+      continue;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+    // The count, then the time the counter was enabled and the time it was
+    // actually on the hardware.
+    uint64_t values[3];
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+      continue;
+    }
+    counts->count[event] = values[2] < values[1]
+        ? (uint64_t)((double)values[0] * values[1] / values[2]) : values[0];
+    counts->counted[event] = true;
+  }
+#endif
+}
+
+const char* ktiming_event_name(const ktiming_event_t event) {
+  return ktiming_event_names[event];
+}
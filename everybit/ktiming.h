@@ -31,10 +31,25 @@
 // the wall time.  For example, timing sleep(1) on Linux will return a
 // number very close to 0; on Darwin or Cygwin, it will return a number very
 // close to 1.
+//
+// The clock can be changed with ktiming_set_clock: to monotonic wall-clock
+// time, to the CPU time of the calling thread alone, or to the x86
+// time-stamp counter, read with rdtscp and converted to nanoseconds by a
+// calibration against the wall clock.  Process CPU time sums the time of all
+// of a process's threads, so it overstates parallel code and leaves out time
+// spent blocked; wall time does neither.
+//
+// On Linux, ktiming can also count hardware events around a timed region,
+// through perf_event_open: cycles, instructions, last-level cache misses,
+// data TLB misses, and memory loads and stores.  Where the kernel or CPU
+// offers none of them, as in most virtual machines, or where
+// /proc/sys/kernel/perf_event_paranoid forbids them, the counters simply
+// count nothing.
 
 #ifndef _KTIMING_H_
 #define _KTIMING_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 
@@ -43,6 +58,38 @@
 // A clock time.
 typedef uint64_t clockmark_t;
 
+// The clocks ktiming can read.  On Darwin, all but KTIMING_CYCLES read the
+// wall time.
+typedef enum {
+  // CPU time of the whole process, summed over its threads; the default.
+  KTIMING_CPU,
+  // Monotonic wall-clock time.
+  KTIMING_WALL,
+  // CPU time of the calling thread.
+  KTIMING_THREAD,
+  // The time-stamp counter, in nanoseconds; x86 only.
+  KTIMING_CYCLES
+} ktiming_clock_t;
+
+// The hardware events ktiming can count.  Loads and stores are counted as
+// level-1 data cache reads and writes.
+typedef enum {
+  KTIMING_EVENT_CYCLES,
+  KTIMING_EVENT_INSTRUCTIONS,
+  KTIMING_EVENT_LLC_MISSES,
+  KTIMING_EVENT_DTLB_MISSES,
+  KTIMING_EVENT_LOADS,
+  KTIMING_EVENT_STORES,
+  KTIMING_NEVENTS
+} ktiming_event_t;
+
+// Event counts over a region.  counted[event] is false for an event that
+// could not be counted, whose count is then 0.
+typedef struct {
+  uint64_t count[KTIMING_NEVENTS];
+  bool counted[KTIMING_NEVENTS];
+} ktiming_counts_t;
+
 
 // ******************************* Prototypes *******************************
 
@@ -62,4 +109,47 @@ float ktiming_diff_sec(const clockmark_t* const start,
 // Gets the current clock time.
 clockmark_t ktiming_getmark();
 
+// Gets the current time of the given clock, whichever is selected.
+clockmark_t ktiming_getmark_clock(const ktiming_clock_t clock);
+
+// Selects the clock ktiming_getmark reads from now on.  Selecting
+// KTIMING_CYCLES calibrates the time-stamp counter first, which takes about
+// 20ms.  Returns false, leaving the clock unchanged, if the clock is not
+// available here.
+bool ktiming_set_clock(const ktiming_clock_t clock);
+
+// Returns the clock ktiming_getmark reads.
+ktiming_clock_t ktiming_get_clock();
+
+// Parses the name of a clock: "cpu", "wall", "thread" or "cycles".  Returns
+// false if name is none of them.
+bool ktiming_clock_from_name(const char* const name, ktiming_clock_t* const clock);
+
+// Returns the name of a clock, as ktiming_clock_from_name accepts it.
+const char* ktiming_clock_name(const ktiming_clock_t clock);
+
+// Returns the time-stamp counter's ticks per nanosecond, calibrating it if
+// it has not been, or 0 if there is no usable counter.
+double ktiming_cycles_per_nsec();
+
+// Opens a counter for each event that can be counted here.  The counters
+// count user-mode events in every thread of the process, including threads
+// started after they are opened.  Returns the number opened, which is 0 if
+// perf_event_open is unavailable or not permitted; the other counter
+// functions then do nothing.
+int ktiming_counters_open();
+
+// Closes the counters ktiming_counters_open opened.
+void ktiming_counters_close();
+
+// Zeroes and starts the open counters.
+void ktiming_counters_start();
+
+// Stops the open counters and reads them into counts.  A count the kernel
+// had to multiplex with other counters is scaled up to the whole region.
+void ktiming_counters_stop(ktiming_counts_t* const counts);
+
+// Returns a short name for an event, such as "cycles" or "llc-misses".
+const char* ktiming_event_name(const ktiming_event_t event);
+
 #endif  // _KTIMING_H_
@@ -30,13 +30,28 @@
 #include <stdlib.h>
 
 #include <unistd.h>
+#include "./ktiming.h"
+#include "./results.h"
 #include "./tests.h"
 
 
+// ********************************* Macros *********************************
+
+// The slowdown beyond which -C reports a regression, unless -x says
+// otherwise.
+#define DEFAULT_REGRESSION_THRESHOLD 0.05
+
+
 // ******************************* Prototypes *******************************
 
 void print_usage(const char* const argv_0);
 
+// Runs the performance test of op_name with the given time limit, printing
+// its results in the given format.
+static void run_timed(const char* const op_name,
+                      const double time_limit_seconds,
+                      const results_format_t format);
+
 
 // ******************************* Functions ********************************
 
@@ -47,11 +62,72 @@ int main(int argc, char** argv) {
   char optchar;
   opterr = 0;
   int selected_test = -1;
-  while ((optchar = getopt(argc, argv, "n:t:sml")) != -1) {
+  const char* selected_op = "rotate";
+  results_format_t format = RESULTS_TEXT;
+  double threshold = DEFAULT_REGRESSION_THRESHOLD;
+  while ((optchar = getopt(argc, argv, "n:t:b:g:r:c:po:x:C:sml")) != -1) {
     switch (optchar) {
     case 'n':
       selected_test = atoi(optarg);
       break;
+    case 'b':
+      selected_op = optarg;
+      break;
+    case 'g':
+      // -g spec fills the benchmark bit arrays from a generator.
+      if (!timed_select_fill(optarg)) {
+        print_usage(argv[0]);
+        retval = EXIT_FAILURE;
+        goto cleanup;
+      }
+      break;
+    case 'r':
+      // -r trials times each tier over that many trials.
+      if (!timed_set_trials(strtoul(optarg, NULL, 10))) {
+        print_usage(argv[0]);
+        retval = EXIT_FAILURE;
+        goto cleanup;
+      }
+      break;
+    case 'c':
+      // -c clock times the tiers on that clock.
+      {
+        ktiming_clock_t clock;
+        if (!ktiming_clock_from_name(optarg, &clock) || !ktiming_set_clock(clock)) {
+          fprintf(stderr, "Clock %s is not available\n", optarg);
+          retval = EXIT_FAILURE;
+          goto cleanup;
+        }
+      }
+      break;
+    case 'p':
+      // -p counts hardware events in each tier, where it can.
+      if (!timed_count_events()) {
+        fprintf(stderr, "No hardware performance counters are available; "
+                "timing without them\n");
+      }
+      break;
+    case 'o':
+      // -o format prints the performance test's results as JSON or CSV.
+      if (!results_format_from_name(optarg, &format)) {
+        print_usage(argv[0]);
+        retval = EXIT_FAILURE;
+        goto cleanup;
+      }
+      break;
+    case 'x':
+      // -x percent sets the slowdown -C reports as a regression.
+      threshold = atof(optarg) / 100;
+      break;
+    case 'C':
+      // -C base new compares two results files, failing on regressions.
+      if (optind >= argc) {
+        print_usage(argv[0]);
+        retval = EXIT_FAILURE;
+        goto cleanup;
+      }
+      retval = results_compare(optarg, argv[optind], threshold);
+      goto cleanup;
     case 't':
       // -t file runs functional tests in the provided file
       parse_and_run_tests(optarg, selected_test);
@@ -59,26 +135,17 @@ int main(int argc, char** argv) {
       goto cleanup;
     case 's':
       // -s runs the short rotation performance test.
-      printf("---- RESULTS ----\n");
-      printf("Succesfully completed tier: %d\n",
-             timed_rotation(0.01));
-      printf("---- END RESULTS ----\n");
+      run_timed(selected_op, 0.01, format);
       retval = EXIT_SUCCESS;
       goto cleanup;
     case 'm':
       // -m runs the medium rotation performance test.
-      printf("---- RESULTS ----\n");
-      printf("Succesfully completed tier: %d\n",
-             timed_rotation(0.1));
-      printf("---- END RESULTS ----\n");
+      run_timed(selected_op, 0.1, format);
       retval = EXIT_SUCCESS;
       goto cleanup;
     case 'l':
       // -l runs the large rotation performance test.
-      printf("---- RESULTS ----\n");
-      printf("Succesfully completed tier: %d\n",
-             timed_rotation(1.0));
-      printf("---- END RESULTS ----\n");
+      run_timed(selected_op, 1.0, format);
       retval = EXIT_SUCCESS;
       goto cleanup;
     }
@@ -93,12 +160,50 @@ cleanup:
   return retval;
 }
 
+static void run_timed(const char* const op_name,
+                      const double time_limit_seconds,
+                      const results_format_t format) {
+  if (format != RESULTS_TEXT) {
+    results_begin(stdout, format, "everybit", timed_get_trials());
+    timed_operation(op_name, time_limit_seconds);
+    results_end();
+    return;
+  }
+  printf("---- RESULTS ----\n");
+  printf("Succesfully completed tier: %d\n",
+         timed_operation(op_name, time_limit_seconds));
+  printf("---- END RESULTS ----\n");
+}
+
 void print_usage(const char* const argv_0) {
   fprintf(stderr, "usage: %s\n"
           "\t -s Run a sample small (0.01s) rotation operation\n"
           "\t -m Run a sample medium (0.1s) rotation operation\n"
           "\t -l Run a sample large (1s) rotation operation\n"
           "\t    (note: the provided -[s/m/l] options only test performance and NOT correctness.)\n"
+          "\t -b count -l\tRun the large performance test on count instead of rotate\n"
+          "\t    (operations: rotate, reverse, count, fill, rank, select,\n"
+          "\t     scan, and, andcount, equal, hash, transpose, append,\n"
+          "\t     write, read, map, tostring, fromstring,\n"
+          "\t     atomicset, atomicor, lockedset, snapshot, set, cowset,\n"
+          "\t     alloc, arenaalloc, randfill, smallget, heapget,\n"
+          "\t     sparsecount, sparseand, sparseor, sparserotate, and the\n"
+          "\t     compressed ewahcount, ewahand, ewahor, ewahrotate;\n"
+          "\t     mixedget, mixedcount, mixedand, mixedrotate, and the\n"
+          "\t     hybrid hybridget, hybridcount, hybridand, hybridrotate)\n"
+          "\t -g density:0.01 -b scan -l\tFill the bit arrays of the performance test\n"
+          "\t    from a generator (uniform, density:p, runs:mean, periodic:period,\n"
+          "\t     adversarial) instead of uniform random bits\n"
+          "\t -r 21 -l\tTime each tier over 21 trials instead of 5, and judge it on\n"
+          "\t    their median\n"
+          "\t -c wall -l\tTime the tiers on the wall clock instead of process CPU\n"
+          "\t    time (clocks: cpu, wall, thread, cycles)\n"
+          "\t -p -l\tAlso count cycles, instructions, cache and TLB misses, loads\n"
+          "\t    and stores in each tier, where perf_event_open allows\n"
+          "\t -o json -l\tPrint the results of the performance test as JSON or CSV\n"
+          "\t    (formats: text, json, csv), with metadata about the host\n"
+          "\t -C old.json new.json\tCompare two results files; exit with 1 if any\n"
+          "\t    operation got more than 5%% slower (-x 10 -C ... for 10%%)\n"
           "\t -t tests/default\tRun alltests in the testfile tests/default\n"
           "\t -n 1 -t tests/default\tRun test 1 in the testfile tests/default\n",
           argv_0);
@@ -0,0 +1,415 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Implements the index specified in rankselect.h with a three-level layout
+// in the style of poppy (Zhou, Andersen and Kaminsky, 2013):
+//
+//   - one 64-bit count per 2^32 bits (the "L0" level), and
+//   - one 64-bit entry per 2048-bit superblock, holding the count of ones
+//     from the start of its L0 region (32 bits) interleaved with the running
+//     counts through its first, second and third 512-bit blocks (10, 11 and
+//     11 bits).
+//
+// A rank therefore reads one entry plus one 512-bit block of the bit array,
+// i.e. a single cache line of index and of data, without data-dependent
+// branches.  Select keeps the
+// superblock of every 8192nd one as a sample, binary-searches the entries
+// between two samples, and finishes inside a word.  The entries cost 64 bits
+// per 2048 (3.1%) and the samples at most 32 bits per 8192 (0.4%).
+
+#include "./rankselect.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+
+// ********************************* Macros *********************************
+
+#define WORD_BITS BITARRAY_WORD_BITS
+#define BLOCK_BITS 512
+#define SUPERBLOCK_BITS 2048
+#define BLOCKS_PER_SUPERBLOCK (SUPERBLOCK_BITS / BLOCK_BITS)
+#define WORDS_PER_BLOCK (BLOCK_BITS / WORD_BITS)
+#define L0_SHIFT 32
+#define SAMPLE_RATE 8192
+
+
+
+// Positions and widths of the running block counts inside an entry, indexed
+// by block; block 0 has nothing before it.
+static const unsigned char block_shift[BLOCKS_PER_SUPERBLOCK] = {0, 32, 42, 53};
+static const uint64_t block_mask[BLOCKS_PER_SUPERBLOCK] = {0, 0x3ff, 0x7ff, 0x7ff};
+
+
+// ********************************* Types **********************************
+
+// Concrete data type representing a rank/select index.
+struct rankselect {
+  // The indexed bit array, and its storage and size when the index was
+  // last built.
+  bitarray_t* bitarray;
+  const char* buf;
+  size_t bit_sz;
+
+  // Number of words readable through buf.
+  size_t buf_words;
+
+  // Total number of set bits.
+  size_t ones;
+
+  // Ones before each 2^32-bit region.  nl0 entries.
+  uint64_t* l0;
+  size_t nl0;
+
+  // One entry per superblock plus a sentinel.  nsuper + 1 entries.
+  uint64_t* entries;
+  size_t nsuper;
+
+  // samples[j] is the superblock holding the (j * SAMPLE_RATE) th one.
+  // nsamples are in use, out of room for samples_capacity.
+  uint32_t* samples;
+  size_t nsamples;
+  size_t samples_capacity;
+};
+
+
+// ******************** Prototypes for static functions *********************
+
+// Returns the number of ones in the blocks of a superblock that precede its
+// block th block, from the superblock's entry.
+static inline size_t blocks_rank(const uint64_t entry, const size_t block);
+
+// Returns the number of ones before superblock s.
+static inline size_t superblock_rank(const rankselect_t* const rankselect,
+                                     const size_t s);
+
+// Recounts superblocks [s_begin, s_end) given that ones_before ones precede
+// s_begin, writing their entries and any L0 counts that start among them.
+// Returns the number of ones before s_end.
+static size_t build_superblocks(rankselect_t* const rankselect,
+                                const size_t s_begin,
+                                const size_t s_end,
+                                size_t ones_before);
+
+// Recomputes the samples for ones ranked in [rank_begin, rank_end), which
+// must all live in superblocks [s_begin, s_end).
+static void build_samples(rankselect_t* const rankselect,
+                          const size_t s_begin,
+                          const size_t s_end,
+                          const size_t rank_begin,
+                          const size_t rank_end);
+
+// (Re)allocates the index arrays for the current size of the bit array.
+// Returns false on allocation failure.
+static bool allocate(rankselect_t* const rankselect);
+
+// Makes room for the samples of up to ones set bits (capped at the size of
+// the bit array).  Returns false, leaving the samples untouched, if memory
+// could not be allocated.
+static bool reserve_samples(rankselect_t* const rankselect, const size_t ones);
+
+// Returns the position of the r th (from zero) set bit of word, which must
+// have more than r set bits.
+static inline size_t select_in_word(uint64_t word, size_t r);
+
+
+// ******************************* Functions ********************************
+
+rankselect_t* rankselect_new(bitarray_t* const bitarray) {
+  rankselect_t* const rankselect = calloc(1, sizeof(struct rankselect));
+  if (rankselect == NULL) {
+    return NULL;
+  }
+  rankselect->bitarray = bitarray;
+  if (!allocate(rankselect) || !rankselect_rebuild(rankselect)) {
+    rankselect_free(rankselect);
+    return NULL;
+  }
+  return rankselect;
+}
+
+void rankselect_free(rankselect_t* const rankselect) {
+  if (rankselect == NULL) {
+    return;
+  }
+  free(rankselect->l0);
+  free(rankselect->entries);
+  free(rankselect->samples);
+  free(rankselect);
+}
+
+bool rankselect_rebuild(rankselect_t* const rankselect) {
+  // Make room for the samples before touching anything, so that running out
+  // of memory leaves the index as it was.
+  const size_t ones = bitarray_count(rankselect->bitarray, 0, rankselect->bit_sz);
+  if (!reserve_samples(rankselect, ones)) {
+    return false;
+  }
+
+  rankselect->buf = bitarray_get_buf(rankselect->bitarray);
+  rankselect->ones = build_superblocks(rankselect, 0, rankselect->nsuper + 1, 0);
+  assert(rankselect->ones == ones);
+  rankselect->nsamples = (rankselect->ones + SAMPLE_RATE - 1) / SAMPLE_RATE;
+  build_samples(rankselect, 0, rankselect->nsuper, 0, rankselect->ones);
+  return true;
+}
+
+bool rankselect_refresh_range(rankselect_t* const rankselect,
+                              const size_t bit_offset,
+                              const size_t bit_length) {
+  assert(bit_offset + bit_length <= rankselect->bit_sz);
+  if (bit_length == 0) {
+    return true;
+  }
+
+  // The subarray holds at most bit_length more ones than it did.  Make room
+  // for their samples first: once the entries below are rewritten, a full
+  // rebuild must not fail.
+  if (!reserve_samples(rankselect, rankselect->ones + bit_length)) {
+    return false;
+  }
+
+  const size_t s_begin = bit_offset / SUPERBLOCK_BITS;
+  const size_t s_end = (bit_offset + bit_length - 1) / SUPERBLOCK_BITS + 1;
+  const size_t rank_begin = superblock_rank(rankselect, s_begin);
+  const size_t rank_end = superblock_rank(rankselect, s_end);
+
+  // Entries count from the start of their L0 region, so if an L0 count
+  // inside the range moves, the entries after the range go stale as well.
+  const bool crosses_l0 = ((s_begin * SUPERBLOCK_BITS) >> L0_SHIFT) !=
+                          (((s_end - 1) * SUPERBLOCK_BITS) >> L0_SHIFT);
+
+  rankselect->buf = bitarray_get_buf(rankselect->bitarray);
+  if (crosses_l0 ||
+      build_superblocks(rankselect, s_begin, s_end, rank_begin) != rank_end) {
+    // The ones moved in or out of the range, so every later entry and
+    // sample is stale too.
+    return rankselect_rebuild(rankselect);
+  }
+  build_samples(rankselect, s_begin, s_end, rank_begin, rank_end);
+  return true;
+}
+
+bool rankselect_rotate(rankselect_t* const rankselect,
+                       const size_t bit_offset,
+                       const size_t bit_length,
+                       const ssize_t bit_right_amount) {
+  // Reserve what the refresh may need before rotating, so that it cannot
+  // fail once the bits have moved.
+  if (!reserve_samples(rankselect, rankselect->ones + bit_length)) {
+    return false;
+  }
+  bitarray_rotate(rankselect->bitarray, bit_offset, bit_length, bit_right_amount);
+  return rankselect_refresh_range(rankselect, bit_offset, bit_length);
+}
+
+size_t rankselect_rank(const rankselect_t* const rankselect,
+                       const size_t bit_index) {
+  assert(bit_index <= rankselect->bit_sz);
+  const uint64_t entry = rankselect->entries[bit_index / SUPERBLOCK_BITS];
+  size_t rank = rankselect->l0[bit_index >> L0_SHIFT] + (uint32_t)entry;
+
+  // Add the blocks of this superblock that precede bit_index.
+  rank += blocks_rank(entry, (bit_index / BLOCK_BITS) % BLOCKS_PER_SUPERBLOCK);
+
+  // Then the bits of this block that precede bit_index.  All eight words
+  // are visited with a mask each, so the loop has a fixed trip count and
+  // nothing to mispredict; words past the end of the buffer are clamped to
+  // its last word, whose mask is zero there anyway.
+  const size_t first_word = (bit_index / BLOCK_BITS) * WORDS_PER_BLOCK;
+  const size_t bits_in_block = bit_index % BLOCK_BITS;
+  for (size_t k = 0; k < WORDS_PER_BLOCK; k++) {
+    const size_t w = first_word + k < rankselect->buf_words ?
+                     first_word + k : rankselect->buf_words - 1;
+    const ssize_t left = (ssize_t)bits_in_block - (ssize_t)(k * WORD_BITS);
+    const size_t keep = left < 0 ? 0 : (left > WORD_BITS ? WORD_BITS : (size_t)left);
+    // keep is in [0, 64]; the second term supplies the all-ones mask for 64.
+    const uint64_t mask = ((1ULL << (keep % WORD_BITS)) - 1) | (0 - (uint64_t)(keep / WORD_BITS));
+    rank += __builtin_popcountll(bitarray_load_word(rankselect->buf, w) & mask);
+  }
+  return rank;
+}
+
+size_t rankselect_select(const rankselect_t* const rankselect, const size_t k) {
+  if (k >= rankselect->ones) {
+    return rankselect->bit_sz;
+  }
+
+  // Binary search for the last superblock with at most k ones before it,
+  // between the samples that bracket k.
+  const size_t j = k / SAMPLE_RATE;
+  size_t lo = rankselect->samples[j];
+  size_t hi = (j + 1 < rankselect->nsamples) ?
+              rankselect->samples[j + 1] : rankselect->nsuper - 1;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo + 1) / 2;
+    if (superblock_rank(rankselect, mid) <= k) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  // Pick the block from the running counts, then walk its words.
+  const uint64_t entry = rankselect->entries[lo];
+  size_t r = k - superblock_rank(rankselect, lo);
+  const size_t block = (r >= blocks_rank(entry, 1)) +
+                       (r >= blocks_rank(entry, 2)) +
+                       (r >= blocks_rank(entry, 3));
+  r -= blocks_rank(entry, block);
+
+  size_t w = lo * (SUPERBLOCK_BITS / WORD_BITS) + block * WORDS_PER_BLOCK;
+  for (;; w++) {
+    const uint64_t word = bitarray_load_word(rankselect->buf, w);
+    const size_t count = __builtin_popcountll(word);
+    if (r < count) {
+      return w * WORD_BITS + select_in_word(word, r);
+    }
+    r -= count;
+  }
+}
+
+size_t rankselect_get_ones(const rankselect_t* const rankselect) {
+  return rankselect->ones;
+}
+
+size_t rankselect_get_space(const rankselect_t* const rankselect) {
+  return rankselect->nl0 * sizeof(uint64_t) +
+         (rankselect->nsuper + 1) * sizeof(uint64_t) +
+         rankselect->nsamples * sizeof(uint32_t);
+}
+
+inline static size_t blocks_rank(const uint64_t entry, const size_t block) {
+  return (entry >> block_shift[block]) & block_mask[block];
+}
+
+inline static size_t superblock_rank(const rankselect_t* const rankselect,
+                                     const size_t s) {
+  const size_t bit_index = s * SUPERBLOCK_BITS;
+  return rankselect->l0[bit_index >> L0_SHIFT] + (uint32_t)rankselect->entries[s];
+}
+
+static size_t build_superblocks(rankselect_t* const rankselect,
+                                const size_t s_begin,
+                                const size_t s_end,
+                                size_t ones_before) {
+  const size_t bit_sz = rankselect->bit_sz;
+  for (size_t s = s_begin; s < s_end; s++) {
+    const size_t start = s * SUPERBLOCK_BITS;
+    if (start % (1ULL << L0_SHIFT) == 0) {
+      rankselect->l0[start >> L0_SHIFT] = ones_before;
+    }
+
+    uint64_t entry = ones_before - rankselect->l0[start >> L0_SHIFT];
+    size_t running = 0;
+    for (size_t b = 0; b < BLOCKS_PER_SUPERBLOCK; b++) {
+      // Blocks past the end of the array count as empty, so the running
+      // counts of a partial superblock still never decrease.
+      const size_t block_start = start + b * BLOCK_BITS;
+      if (block_start < bit_sz) {
+        const size_t length = (bit_sz - block_start < BLOCK_BITS) ?
+                              bit_sz - block_start : BLOCK_BITS;
+        running += bitarray_count(rankselect->bitarray, block_start, length);
+      }
+      if (b + 1 < BLOCKS_PER_SUPERBLOCK) {
+        entry |= (uint64_t)running << block_shift[b + 1];
+      }
+    }
+    ones_before += running;
+    rankselect->entries[s] = entry;
+  }
+  return ones_before;
+}
+
+static void build_samples(rankselect_t* const rankselect,
+                          const size_t s_begin,
+                          const size_t s_end,
+                          const size_t rank_begin,
+                          const size_t rank_end) {
+  size_t j = (rank_begin + SAMPLE_RATE - 1) / SAMPLE_RATE;
+  size_t s = s_begin;
+  for (; j * SAMPLE_RATE < rank_end; j++) {
+    // Advance to the superblock holding the (j * SAMPLE_RATE) th one.
+    while (s + 1 < s_end && superblock_rank(rankselect, s + 1) <= j * SAMPLE_RATE) {
+      s++;
+    }
+    rankselect->samples[j] = (uint32_t)s;
+  }
+}
+
+static bool allocate(rankselect_t* const rankselect) {
+  const size_t bit_sz = bitarray_get_bit_sz(rankselect->bitarray);
+  rankselect->bit_sz = bit_sz;
+  rankselect->buf_words = (bit_sz + WORD_BITS - 1) / WORD_BITS + 1;
+  rankselect->nsuper = (bit_sz + SUPERBLOCK_BITS - 1) / SUPERBLOCK_BITS;
+  rankselect->nl0 = ((rankselect->nsuper * SUPERBLOCK_BITS) >> L0_SHIFT) + 1;
+  rankselect->l0 = calloc(rankselect->nl0, sizeof(uint64_t));
+  rankselect->entries = calloc(rankselect->nsuper + 1, sizeof(uint64_t));
+  rankselect->samples = NULL;
+  rankselect->nsamples = 0;
+  rankselect->samples_capacity = 0;
+  return rankselect->l0 != NULL && rankselect->entries != NULL;
+}
+
+static bool reserve_samples(rankselect_t* const rankselect, const size_t ones) {
+  const size_t capped = ones < rankselect->bit_sz ? ones : rankselect->bit_sz;
+  const size_t nsamples = (capped + SAMPLE_RATE - 1) / SAMPLE_RATE;
+  if (nsamples <= rankselect->samples_capacity) {
+    return true;
+  }
+  uint32_t* const samples = realloc(rankselect->samples, nsamples * sizeof(uint32_t));
+  if (samples == NULL) {
+    return false;
+  }
+  rankselect->samples = samples;
+  rankselect->samples_capacity = nsamples;
+  return true;
+}
+
+inline static size_t select_in_word(uint64_t word, size_t r) {
+#if defined(__BMI2__)
+  // Deposit a single 1 onto the r th set bit of word.
+  return __builtin_ctzll(_pdep_u64(1ULL << r, word));
+#else
+  // Skip whole bytes, then clear the remaining low set bits one by one.
+  size_t position = 0;
+  for (;;) {
+    const size_t count = __builtin_popcountll(word & 0xff);
+    if (r < count) {
+      break;
+    }
+    r -= count;
+    word >>= 8;
+    position += 8;
+  }
+  for (; r > 0; r--) {
+    word &= word - 1;
+  }
+  return position + __builtin_ctzll(word);
+#endif
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// A succinct rank/select index over a bit array.  The index is built once
+// over a bit array whose contents then stay fixed, and answers
+//   rank(i):   how many ones lie before position i, in O(1), and
+//   select(k): where the k th one lies, in near O(1),
+// using about 3.5% extra space on top of the bit array itself.
+//
+// The bit array must not be modified behind the index's back.  After a
+// change, call rankselect_refresh_range on the changed subarray (or
+// rankselect_rebuild), or rotate through rankselect_rotate, which does both.
+// An index cannot follow a change of size: after appending to or truncating
+// the bit array, free the index and build a new one.
+
+#ifndef RANKSELECT_H
+#define RANKSELECT_H
+
+#include <sys/types.h>
+
+#include "./bitarray.h"
+
+// ********************************* Types **********************************
+
+// Abstract data type representing a rank/select index over a bit array.
+typedef struct rankselect rankselect_t;
+
+// ******************************* Prototypes *******************************
+
+// Builds an index over bitarray.  The bit array must outlive the index.
+// Returns NULL if memory could not be allocated.
+rankselect_t* rankselect_new(bitarray_t* const bitarray);
+
+// Frees an index allocated by rankselect_new.  The bit array is untouched.
+void rankselect_free(rankselect_t* const rankselect);
+
+// Recomputes the whole index from the current contents of the bit array.
+// Returns false, leaving the index untouched, if memory could not be
+// allocated.
+bool rankselect_rebuild(rankselect_t* const rankselect);
+
+// Updates the index after the subarray [bit_offset, bit_offset + bit_length)
+// of the bit array has been modified.  Work is proportional to bit_length
+// when the number of ones in the subarray is unchanged, and falls back to a
+// full rebuild otherwise.  Returns false, leaving the index untouched, if
+// memory could not be allocated.
+bool rankselect_refresh_range(rankselect_t* const rankselect,
+                              const size_t bit_offset,
+                              const size_t bit_length);
+
+// Rotates a subarray of the indexed bit array exactly like bitarray_rotate,
+// then refreshes the index over that subarray.  Since a rotation never
+// changes how many ones a subarray holds, only the superblocks it overlaps
+// are recounted.  Returns false, leaving both the bit array and the index
+// untouched, if memory could not be allocated.
+bool rankselect_rotate(rankselect_t* const rankselect,
+                       const size_t bit_offset,
+                       const size_t bit_length,
+                       const ssize_t bit_right_amount);
+
+// Returns the number of set bits in [0, bit_index).  bit_index may equal
+// the size of the bit array.
+size_t rankselect_rank(const rankselect_t* const rankselect,
+                       const size_t bit_index);
+
+// Returns the index of the k th set bit, counting from zero, or the size of
+// the bit array if it holds k or fewer set bits.
+size_t rankselect_select(const rankselect_t* const rankselect, const size_t k);
+
+// Returns the total number of set bits in the bit array.
+size_t rankselect_get_ones(const rankselect_t* const rankselect);
+
+// Returns the number of bytes the index uses, not counting the bit array.
+size_t rankselect_get_space(const rankselect_t* const rankselect);
+
+#endif  // RANKSELECT_H
@@ -0,0 +1,431 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// We need _POSIX_C_SOURCE for gethostname, uname and gmtime_r.
+#define _POSIX_C_SOURCE 200112L
+
+#include "./results.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/utsname.h>
+#include <unistd.h>
+
+
+// ********************************* Macros *********************************
+
+// The longest line results_compare reads, and the most fields in a CSV line.
+#define RESULTS_LINE_MAX 4096
+#define RESULTS_MAX_FIELDS 64
+
+// Pairs faster than this in both runs are not judged by results_compare.
+#define RESULTS_MIN_COMPARE_SECONDS 0.0001
+
+// The longest operation name results_compare keeps.
+#define RESULTS_OP_MAX 32
+
+
+// ********************************* Types **********************************
+
+// A record as results_compare reads it back.
+typedef struct {
+  char op[RESULTS_OP_MAX];
+  size_t bytes;
+  size_t shift;
+  double seconds;
+  bool matched;
+} results_entry_t;
+
+// The records of one results file.
+typedef struct {
+  results_entry_t* entries;
+  size_t n;
+  size_t capacity;
+} results_file_t;
+
+
+// ******************** Prototypes for static functions *********************
+
+// Writes text as a JSON string, quoted and escaped.
+static void results_json_string(FILE* const out, const char* const text);
+
+// Reads the model name of the CPU into buf, or "unknown".
+static void results_cpu_model(char* const buf, const size_t buf_sz);
+
+// Reads the records of the results file at path, in either format, into
+// file.  Returns false if it cannot be read.
+static bool results_read(const char* const path, results_file_t* const file);
+
+// Appends a record to file.  Returns false if memory runs out.
+static bool results_append(results_file_t* const file, const results_entry_t* const entry);
+
+// Parses a JSON record line into entry.  Returns false if line is not one.
+static bool results_parse_json(const char* const line, results_entry_t* const entry);
+
+// Returns the text after "key": in a JSON record line, or NULL.
+static const char* results_json_value(const char* const line, const char* const key);
+
+// Splits a CSV line in place at its commas, into at most RESULTS_MAX_FIELDS
+// fields.  Returns the number of fields.
+static size_t results_split_csv(char* const line, char** const fields);
+
+
+// ******************************** Globals *********************************
+
+static const char* const results_format_names[] = {"text", "json", "csv"};
+
+// Where records go, in which format, and whether one has been written yet.
+static FILE* results_out = NULL;
+static results_format_t results_format = RESULTS_TEXT;
+static bool results_first = true;
+
+
+// ******************************* Functions ********************************
+
+bool results_format_from_name(const char* const name, results_format_t* const format) {
+  for (size_t i = 0; i < sizeof(results_format_names) / sizeof(results_format_names[0]); i++) {
+    if (strcmp(name, results_format_names[i]) == 0) {
+      *format = (results_format_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void results_begin(FILE* const out,
+                   const results_format_t format,
+                   const char* const program,
+                   const size_t trials) {
+  if (format == RESULTS_TEXT) {
+    return;
+  }
+  results_out = out;
+  results_format = format;
+  results_first = true;
+
+  char host[256] = "unknown";
+  gethostname(host, sizeof(host) - 1);
+  struct utsname system;
+  char os[2 * sizeof(system.release) + 2] = "unknown";
+  if (uname(&system) == 0) {
+    snprintf(os, sizeof(os), "%s %s", system.sysname, system.release);
+  }
+  char cpu[256];
+  results_cpu_model(cpu, sizeof(cpu));
+  long cpus = -1;
+#ifdef _SC_NPROCESSORS_ONLN
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  char timestamp[32] = "unknown";
+  const time_t now = time(NULL);
+  struct tm now_utc;
+  if (gmtime_r(&now, &now_utc) != NULL) {
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &now_utc);
+  }
+  const char* const clock = ktiming_clock_name(ktiming_get_clock());
+
+  if (format == RESULTS_JSON) {
+    fprintf(out, "{\n\"meta\": {\"program\": ");
+    results_json_string(out, program);
+    fprintf(out, ", \"host\": ");
+    results_json_string(out, host);
+    fprintf(out, ", \"os\": ");
+    results_json_string(out, os);
+    fprintf(out, ", \"cpu\": ");
+    results_json_string(out, cpu);
+    fprintf(out, ", \"cpus\": %ld, \"clock\": \"%s\", \"trials\": %zu, \"time\": \"%s\"},\n"
+            "\"results\": [\n", cpus, clock, trials, timestamp);
+  } else {
+    fprintf(out, "# program: %s\n# host: %s\n# os: %s\n# cpu: %s\n# cpus: %ld\n"
+            "# clock: %s\n# trials: %zu\n# time: %s\n",
+            program, host, os, cpu, cpus, clock, trials, timestamp);
+    fprintf(out, "op,tier,bytes,shift,seconds,low,high,wall,cpu,rate,unit,passed");
+    for (int event = 0; event < KTIMING_NEVENTS; event++) {
+      fprintf(out, ",%s", ktiming_event_name(event));
+    }
+    fprintf(out, "\n");
+  }
+}
+
+bool results_active() {
+  return results_out != NULL;
+}
+
+void results_write(const results_record_t* const record) {
+  assert(results_active());
+  FILE* const out = results_out;
+  if (results_format == RESULTS_JSON) {
+    fprintf(out, "%s{\"op\": ", results_first ? "" : ",\n");
+    results_json_string(out, record->op);
+    fprintf(out, ", \"tier\": %d, \"bytes\": %zu, \"shift\": %zu, \"seconds\": %.9g, "
+            "\"low\": %.9g, \"high\": %.9g, \"wall\": %.9g, \"cpu\": %.9g, "
+            "\"rate\": %.6g, \"unit\": \"%s\", \"passed\": %s",
+            record->tier, record->bytes, record->shift, record->seconds, record->low,
+            record->high, record->wall, record->cpu, record->rate, record->unit,
+            record->passed ? "true" : "false");
+    for (int event = 0; record->counts != NULL && event < KTIMING_NEVENTS; event++) {
+      if (record->counts->counted[event]) {
+        fprintf(out, ", \"%s\": %llu", ktiming_event_name(event),
+                (unsigned long long)record->counts->count[event]);
+      }
+    }
+    fprintf(out, "}");
+  } else {
+    fprintf(out, "%s,%d,%zu,%zu,%.9g,%.9g,%.9g,%.9g,%.9g,%.6g,%s,%d",
+            record->op, record->tier, record->bytes, record->shift, record->seconds,
+            record->low, record->high, record->wall, record->cpu, record->rate,
+            record->unit, record->passed);
+    for (int event = 0; event < KTIMING_NEVENTS; event++) {
+      if (record->counts != NULL && record->counts->counted[event]) {
+        fprintf(out, ",%llu", (unsigned long long)record->counts->count[event]);
+      } else {
+        fprintf(out, ",");
+      }
+    }
+    fprintf(out, "\n");
+  }
+  results_first = false;
+  fflush(out);
+}
+
+void results_end() {
+  if (!results_active()) {
+    return;
+  }
+  if (results_format == RESULTS_JSON) {
+    fprintf(results_out, "%s]\n}\n", results_first ? "" : "\n");
+  }
+  fflush(results_out);
+  results_out = NULL;
+}
+
+int results_compare(const char* const base_path,
+                    const char* const new_path,
+                    const double threshold) {
+  results_file_t base = {NULL, 0, 0};
+  results_file_t current = {NULL, 0, 0};
+  if (!results_read(base_path, &base) || !results_read(new_path, &current)) {
+    free(base.entries);
+    free(current.entries);
+    return 2;
+  }
+
+  printf("%-14s %12s %10s %12s %12s %9s\n", "op", "bytes", "shift", "base", "new", "change");
+  size_t regressions = 0;
+  for (size_t i = 0; i < base.n; i++) {
+    const results_entry_t* const old = &base.entries[i];
+    results_entry_t* match = NULL;
+    for (size_t j = 0; j < current.n && match == NULL; j++) {
+      results_entry_t* const entry = &current.entries[j];
+      if (!entry->matched && entry->bytes == old->bytes && entry->shift == old->shift &&
+          strcmp(entry->op, old->op) == 0) {
+        match = entry;
+      }
+    }
+    if (match == NULL) {
+      printf("%-14s %12zu %10zu %11.6fs %12s %9s  REGRESSION\n",
+             old->op, old->bytes, old->shift, old->seconds, "missing", "-");
+      regressions++;
+      continue;
+    }
+    match->matched = true;
+
+    const bool judged = old->seconds >= RESULTS_MIN_COMPARE_SECONDS ||
+                        match->seconds >= RESULTS_MIN_COMPARE_SECONDS;
+    const double change = old->seconds > 0 ? match->seconds / old->seconds - 1 : 0;
+    const bool regressed = judged && change > threshold;
+    printf("%-14s %12zu %10zu %11.6fs %11.6fs %+8.1f%%%s\n",
+           old->op, old->bytes, old->shift, old->seconds, match->seconds, change * 100,
+           regressed ? "  REGRESSION" : (judged ? "" : "  (too fast to judge)"));
+    regressions += regressed;
+  }
+  for (size_t j = 0; j < current.n; j++) {
+    const results_entry_t* const entry = &current.entries[j];
+    if (!entry->matched) {
+      printf("%-14s %12zu %10zu %12s %11.6fs %9s  new\n",
+             entry->op, entry->bytes, entry->shift, "-", entry->seconds, "-");
+    }
+  }
+  printf("%zu regression%s beyond %.1f%%\n", regressions, regressions == 1 ? "" : "s",
+         threshold * 100);
+
+  free(base.entries);
+  free(current.entries);
+  return regressions > 0 ? 1 : 0;
+}
+
+static void results_json_string(FILE* const out, const char* const text) {
+  fputc('"', out);
+  for (const char* c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(out, "\\u%04x", (unsigned char)*c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void results_cpu_model(char* const buf, const size_t buf_sz) {
+  snprintf(buf, buf_sz, "unknown");
+  FILE* const cpuinfo = fopen("/proc/cpuinfo", "r");
+  if (cpuinfo == NULL) {
+    return;
+  }
+  char line[RESULTS_LINE_MAX];
+  while (fgets(line, sizeof(line), cpuinfo) != NULL) {
+    const char* const colon = strchr(line, ':');
+    if (strncmp(line, "model name", strlen("model name")) == 0 && colon != NULL) {
+      snprintf(buf, buf_sz, "%s", colon + 2);
+      buf[strcspn(buf, "\n")] = '\0';
+      break;
+    }
+  }
+  fclose(cpuinfo);
+}
+
+static bool results_read(const char* const path, results_file_t* const file) {
+  FILE* const in = fopen(path, "r");
+  if (in == NULL) {
+    perror(path);
+    return false;
+  }
+
+  // A CSV file names its columns in its first line that is not a comment.
+  char line[RESULTS_LINE_MAX];
+  char* fields[RESULTS_MAX_FIELDS];
+  int columns[4] = {-1, -1, -1, -1};
+  const char* const column_names[4] = {"op", "bytes", "shift", "seconds"};
+  bool json = false;
+  bool header = false;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '{' && !header) {
+      json = true;
+    }
+    results_entry_t entry;
+    if (json) {
+      if (results_parse_json(line, &entry)) {
+        ok = results_append(file, &entry);
+      }
+      continue;
+    }
+    if (line[0] == '#' || line[0] == '\0') {
+      continue;
+    }
+    const size_t nfields = results_split_csv(line, fields);
+    if (!header) {
+      for (size_t f = 0; f < nfields; f++) {
+        for (int c = 0; c < 4; c++) {
+          if (strcmp(fields[f], column_names[c]) == 0) {
+            columns[c] = f;
+          }
+        }
+      }
+      header = true;
+      if (columns[0] < 0 || columns[1] < 0 || columns[2] < 0 || columns[3] < 0) {
+        fprintf(stderr, "%s: not a results file\n", path);
+        ok = false;
+      }
+      continue;
+    }
+    if (nfields <= (size_t)columns[0] || nfields <= (size_t)columns[1] ||
+        nfields <= (size_t)columns[2] || nfields <= (size_t)columns[3]) {
+      continue;
+    }
+    snprintf(entry.op, sizeof(entry.op), "%s", fields[columns[0]]);
+    entry.bytes = strtoull(fields[columns[1]], NULL, 10);
+    entry.shift = strtoull(fields[columns[2]], NULL, 10);
+    entry.seconds = strtod(fields[columns[3]], NULL);
+    entry.matched = false;
+    ok = results_append(file, &entry);
+  }
+  fclose(in);
+  if (ok && file->n == 0) {
+    fprintf(stderr, "%s: no results\n", path);
+    ok = false;
+  }
+  return ok;
+}
+
+static bool results_append(results_file_t* const file, const results_entry_t* const entry) {
+  if (file->n == file->capacity) {
+    const size_t capacity = file->capacity > 0 ? 2 * file->capacity : 64;
+    results_entry_t* const entries = realloc(file->entries, capacity * sizeof(results_entry_t));
+    if (entries == NULL) {
+      fprintf(stderr, "Out of memory reading results\n");
+      return false;
+    }
+    file->entries = entries;
+    file->capacity = capacity;
+  }
+  file->entries[file->n++] = *entry;
+  return true;
+}
+
+static bool results_parse_json(const char* const line, results_entry_t* const entry) {
+  const char* const op = results_json_value(line, "op");
+  const char* const bytes = results_json_value(line, "bytes");
+  const char* const shift = results_json_value(line, "shift");
+  const char* const seconds = results_json_value(line, "seconds");
+  if (op == NULL || *op != '"' || bytes == NULL || shift == NULL || seconds == NULL) {
+    return false;
+  }
+  const size_t op_length = strcspn(op + 1, "\"");
+  snprintf(entry->op, sizeof(entry->op), "%.*s", (int)op_length, op + 1);
+  entry->bytes = strtoull(bytes, NULL, 10);
+  entry->shift = strtoull(shift, NULL, 10);
+  entry->seconds = strtod(seconds, NULL);
+  entry->matched = false;
+  return true;
+}
+
+static const char* results_json_value(const char* const line, const char* const key) {
+  char pattern[RESULTS_OP_MAX + 8];
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char* const found = strstr(line, pattern);
+  return found != NULL ? found + strlen(pattern) : NULL;
+}
+
+static size_t results_split_csv(char* const line, char** const fields) {
+  size_t n = 0;
+  char* field = line;
+  while (n < RESULTS_MAX_FIELDS) {
+    fields[n++] = field;
+    char* const comma = strchr(field, ',');
+    if (comma == NULL) {
+      break;
+    }
+    *comma = '\0';
+    field = comma + 1;
+  }
+  return n;
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2012 MIT License by 6.172 Staff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ **/
+
+// Machine-readable benchmark results, written by the harness's -s/-m/-l
+// modes and by the benchmark suite, and compared between two runs.
+//
+// A results file starts with metadata about the run: the program, host, OS,
+// CPU model and count, clock and number of trials, and when it ran.  Then
+// comes one record per tier or point.  In JSON, the file is one object,
+// {"meta": {...}, "results": [...]}, with each record on a line of its own.
+// In CSV, the metadata are comment lines starting with "#", followed by a
+// header line and one line per record.
+//
+// results_compare reads either format back, pairs up the records of two
+// files by operation, size and shift, and flags those that got slower by
+// more than a threshold.
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "./ktiming.h"
+
+// ********************************* Types **********************************
+
+// How results are written: as the programs' usual text, or as records.
+typedef enum {
+  RESULTS_TEXT,
+  RESULTS_JSON,
+  RESULTS_CSV
+} results_format_t;
+
+// One tier or point of a run.  Times are in seconds.
+typedef struct {
+  // The operation, as named on the command line.
+  const char* op;
+  // The harness's tier number, or -1 for the benchmark suite's points.
+  int tier;
+  // The size of the subarray operated on, in bytes, and the rotation amount
+  // in bits, or 0 for operations that do not rotate.
+  size_t bytes;
+  size_t shift;
+  // The median time on the selected clock, and its spread: a 95% confidence
+  // interval for the harness, the 10th and 90th percentiles for the suite.
+  double seconds;
+  double low;
+  double high;
+  // The median wall and process CPU times.
+  double wall;
+  double cpu;
+  // The rate at the median, 0 if too fast to measure, and its unit.
+  double rate;
+  const char* unit;
+  // Whether the tier finished within the time limit; always true for the
+  // suite.
+  bool passed;
+  // The hardware events, or NULL if they were not counted.
+  const ktiming_counts_t* counts;
+} results_record_t;
+
+
+// ******************************* Prototypes *******************************
+
+// Parses the name of a format: "text", "json" or "csv".  Returns false if
+// name is none of them.
+bool results_format_from_name(const char* const name, results_format_t* const format);
+
+// Starts writing records in the given format to out, beginning with the
+// metadata of the run: program is the program's name and trials the number
+// of trials per record.  Does nothing for RESULTS_TEXT.
+void results_begin(FILE* const out,
+                   const results_format_t format,
+                   const char* const program,
+                   const size_t trials);
+
+// Returns whether records are being written, between results_begin in a
+// format other than RESULTS_TEXT and results_end.
+bool results_active();
+
+// Writes one record.  Requires results_active().
+void results_write(const results_record_t* const record);
+
+// Finishes writing records.
+void results_end();
+
+// Compares the results file at new_path against the one at base_path,
+// printing each pair of records with the change in median time.  A pair
+// that got slower by more than threshold (0.05 for 5%), or a record of the
+// base run missing from the new one, is a regression, except that pairs
+// under 100 microseconds in both runs are too noisy to judge.
+// Returns 0 if there are no regressions, 1 if there are, or 2 if a file
+// cannot be read.
+int results_compare(const char* const base_path,
+                    const char* const new_path,
+                    const double threshold);
+
+#endif  // RESULTS_H
@@ -21,15 +21,25 @@
  **/
 #define _GNU_SOURCE
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "./bitarray.h"
 #include "./ktiming.h"
+#include "./bitmatrix.h"
+#include "./bitview.h"
+#include "./ewah.h"
+#include "./hybrid.h"
+#include "./rankselect.h"
+#include "./results.h"
 #include "./tests.h"
 
 #define ANSI_COLOR_RED     "\x1b[31m"
@@ -40,19 +50,257 @@
 #define ANSI_COLOR_CYAN    "\x1b[36m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
+// Bits converted to text per fwrite when printing a bit array.
+#define PRINT_CHUNK_BITS 4096
+
+// Most threads the atomic stress test runs at once.
+#define MAX_STRESS_THREADS 64
+
+// timed_operation times each tier over TIMED_TRIALS trials, unless told
+// otherwise, and over at most TIMED_MAX_TRIALS.  It warns of a noisy tier
+// when the trials' coefficient of variation is above TIMED_NOISY_CV, unless
+// the tier takes under TIMED_NOISY_FLOOR of the time limit, where timer
+// resolution alone can spread the trials that much.
+#define TIMED_TRIALS 5
+#define TIMED_MAX_TRIALS 1000
+#define TIMED_NOISY_CV 0.10
+#define TIMED_NOISY_FLOOR 0.01
+
 // ******************************* Prototypes *******************************
 
 // Creates a new bit array in test_bitarray by parsing a string of 0s
 // and 1s.  For instance, "0101011011" is a suitable argument.
 void testutil_frmstr(const char* const bitstring);
 
+// Creates a new bit array in test_operand, the second operand of the
+// logical-operation tests, by parsing a string of 0s and 1s.
+void testutil_operand_frmstr(const char* const bitstring);
+
+// Applies op in place to a subarray of test_bitarray, taking the other
+// operand from test_operand (or, if from_self is true, from test_bitarray
+// itself).
+// Requires that test_bitarray is not NULL.
+void testutil_logic(const bitarray_logic_t op,
+                    const bool from_self,
+                    const size_t dst_offset,
+                    const size_t src_offset,
+                    const size_t bit_length);
+
+// Verifies that test_bitarray op test_operand, over subarrays of length
+// bit_length at a_offset and b_offset respectively, has expected set bits.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_logic_count(const bitarray_logic_t op,
+                                 const size_t a_offset,
+                                 const size_t b_offset,
+                                 const size_t bit_length,
+                                 const size_t expected,
+                                 const char* const func_name,
+                                 const int line);
+
+// Verifies that comparing test_bitarray's subarray at a_offset with
+// test_operand's at b_offset, over bit_length bits, gives expected (-1, 0
+// or 1), that bitarray_equal_range agrees, and that equal subarrays hash
+// equally.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_compare(const size_t a_offset,
+                             const size_t b_offset,
+                             const size_t bit_length,
+                             const int expected,
+                             const char* const func_name,
+                             const int line);
+
+// Transposes the rows x cols matrix stored at src_offset in test_bitarray
+// into the cols x rows matrix at dst_offset, which must not overlap it.
+// Requires that test_bitarray is not NULL.
+void testutil_transpose(const size_t src_offset,
+                        const size_t dst_offset,
+                        const size_t rows,
+                        const size_t cols);
+
+// Copies column col of the rows x cols matrix stored at src_offset in
+// test_bitarray to the rows bits at dst_offset, which must not overlap it.
+// Requires that test_bitarray is not NULL.
+void testutil_get_column(const size_t src_offset,
+                         const size_t rows,
+                         const size_t cols,
+                         const size_t col,
+                         const size_t dst_offset);
+
+// Appends the bits of a string of 0s and 1s to test_bitarray, one at a time
+// or, if packed is true, packed into words and appended as a single run.
+// Drops test_rankselect, which cannot follow a change of size.
+// Requires that test_bitarray is not NULL.
+void testutil_append(const char* const bitstring, const bool packed);
+
+// Truncates test_bitarray to bit_sz bits and releases the spare capacity.
+// Drops test_rankselect, which cannot follow a change of size.
+// Requires that test_bitarray is not NULL.
+void testutil_truncate(const size_t bit_sz);
+
+// Narrows the window of test_bitarray that later rotations, reversals,
+// fills, counts and scans address to [bit_offset, bit_offset + bit_length)
+// of the current window.  The window is reset when test_bitarray is
+// replaced or resized.
+// Requires that test_bitarray is not NULL.
+void testutil_window(const size_t bit_offset, const size_t bit_length);
+
+// Round-trips test_bitarray through the compressed form, rotating a
+// subarray of it while compressed.
+// Requires that test_bitarray is not NULL.
+void testutil_ewah_rotate(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount);
+
+// Replaces test_bitarray with test_bitarray op test_operand, computed on
+// their compressed forms.  Fails if the fused count on the compressed forms
+// disagrees with the result.
+void testutil_ewah_logic(const bitarray_logic_t op,
+                         const char* const func_name,
+                         const int line);
+
+// Verifies that the compressed form of test_bitarray counts expected set
+// bits.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_ewah_count(const size_t expected,
+                                const char* const func_name,
+                                const int line);
+
+// Fills test_bitarray and test_operand with bit_sz bits each, in 65536-bit
+// regions (the chunks of the hybrid form) that are random, sparse, runs,
+// all ones or all zeros, as chosen by seed.
+void testutil_newmixed(const size_t bit_sz, const unsigned int seed);
+
+// Rotates a subarray of test_bitarray both in place and through its hybrid
+// form, and verifies that the two agree.
+// Outputs FAIL or PASS as appropriate.
+void testutil_hybrid_rotate(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount,
+                            const char* const func_name,
+                            const int line);
+
+// Replaces test_bitarray with test_bitarray op test_operand, computed both
+// in place and on the hybrid forms, and verifies that the two agree and
+// that the fused count on the hybrid forms matches.
+// Outputs FAIL or PASS as appropriate.
+void testutil_hybrid_logic(const bitarray_logic_t op,
+                           const char* const func_name,
+                           const int line);
+
+// Sets the bits of a subarray of test_bitarray to value one at a time, both
+// in place and through its hybrid form, and verifies that the two agree.
+// Outputs FAIL or PASS as appropriate.
+void testutil_hybrid_set(const size_t bit_offset,
+                         const size_t bit_length,
+                         const bool value,
+                         const char* const func_name,
+                         const int line);
+
+// Verifies that the hybrid form of test_bitarray counts expected set bits
+// in a subarray.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_hybrid_count(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const size_t expected,
+                                  const char* const func_name,
+                                  const int line);
+
+// Writes test_bitarray to a temporary file in the binary format, and
+// verifies that reading it back and mapping it both give the same bits and
+// that reading it back with one bit flipped fails the checksum.  The mapped
+// copy then replaces test_bitarray, so later commands run on a bit array
+// backed by the file.
+// Outputs FAIL or PASS as appropriate.
+void testutil_roundtrip(const char* const func_name, const int line);
+
+// Moves test_bitarray into test_arena: replaces it with a bit array holding
+// the same bits, allocated from the arena.
+void testutil_arena();
+
+// Takes a snapshot of test_bitarray, replacing any earlier one, and keeps a
+// plain copy of its bits to check it against.
+void testutil_snapshot();
+
+// Verifies that the snapshot taken by testutil_snapshot still holds the bits
+// it was taken with, then again from another thread while this one rotates
+// test_bitarray back and forth underneath it.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_snapshot(const char* const func_name, const int line);
+
+// Sets, clears, test-and-sets and ORs every bit of test_bitarray from
+// `threads` threads at once with the atomic operations, neighbouring bits
+// going to different threads, and verifies after each round that no update
+// was lost and that each test-and-set was won exactly once.  Leaves every
+// bit set.
+// Outputs FAIL or PASS as appropriate.
+void testutil_atomic_stress(const size_t threads,
+                            const char* const func_name,
+                            const int line);
+
+// Verifies that the text of test_bitarray starting at bit_offset is
+// bitstring, and that parsing bitstring gives back the same bits.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_text(const size_t bit_offset,
+                          const char* const bitstring,
+                          const char* const func_name,
+                          const int line);
+
 // Rotates test_bitarray in place.
 // Requires that test_bitarray is not NULL.
 void testutil_rotate(const size_t bit_offset,
                      const size_t bit_length,
                      const ssize_t bit_right_shift_amount);
 
-// Checks that the rotation is valid given the size of test_bitarray.
+// Fills a subarray of test_bitarray with value.
+// Requires that test_bitarray is not NULL.
+void testutil_fill(const size_t bit_offset,
+                   const size_t bit_length,
+                   const bool value);
+
+// Reverses a subarray of test_bitarray in place.
+// Requires that test_bitarray is not NULL.
+void testutil_reverse(const size_t bit_offset, const size_t bit_length);
+
+// Verifies that the subarray [bit_offset, bit_offset + bit_length) of
+// test_bitarray holds exactly expected set bits.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_count(const size_t bit_offset,
+                           const size_t bit_length,
+                           const size_t expected,
+                           const char* const func_name,
+                           const int line);
+
+// Verifies that rank and select on test_rankselect give expected, building
+// the index over test_bitarray first if there is none yet.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_rank(const size_t bit_index,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line);
+void testutil_expect_select(const size_t k,
+                            const size_t expected,
+                            const char* const func_name,
+                            const int line);
+
+// Verifies that the first set (or, if set is false, clear) bit of
+// test_bitarray at or after bit_index is at expected.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_find(const size_t bit_index,
+                          const bool set,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line);
+
+// Verifies that iterating the set bits of test_bitarray from bit_index
+// yields exactly expected indices, each of them set and in increasing order.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_iter(const size_t bit_index,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line);
+
+// Checks that the rotation is valid given the size of the current window of
+// test_bitarray.
 // Causes a test suite failure if the input is invalid.
 void testutil_require_valid_input(const size_t bit_offset,
                                   const size_t bit_length,
@@ -60,13 +308,67 @@ void testutil_require_valid_input(const size_t bit_offset,
                                   const char* const func_name,
                                   const int line);
 
+// Checks that a subarray addressed from the start of test_bitarray, ignoring
+// any window, lies within it.
+// Causes a test suite failure if the input is invalid.
+void testutil_require_valid_range(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const char* const func_name,
+                                  const int line);
+
 // Creates a new bit array in test_bitarray of the specified size and
 // fills it with random data based on the seed given.  For a given seed number,
-// the pseudorandom data will be the same (at least on the same glibc
-// implementation).
+// the pseudorandom data will be the same.
 static void testutil_newrand(const size_t bit_sz, const unsigned int seed);
 
-// Prints a string representation of a bit array.
+// A generator to fill bit arrays from, and its parameter: the density, the
+// mean run length or the period.  It is named "uniform", "density:p",
+// "runs:mean", "periodic:period" or "adversarial".
+typedef enum {
+  FILL_UNIFORM,
+  FILL_DENSITY,
+  FILL_RUNS,
+  FILL_PERIODIC,
+  FILL_ADVERSARIAL
+} fill_kind_t;
+
+typedef struct {
+  fill_kind_t kind;
+  double param;
+} fill_spec_t;
+
+// Parses a generator's name into fill.  Returns false if spec does not
+// name one, or its parameter is out of range.
+static bool parse_fill_spec(const char* const spec, fill_spec_t* const fill);
+
+// Fills a bit array from a generator with the given seed.
+static void fill_bits(bitarray_t* const bitarray,
+                      const fill_spec_t* const fill,
+                      const uint64_t seed);
+
+// Refills test_bitarray from the generator spec names, with the given seed.
+// Causes a test suite failure if spec is not a generator's name.
+void testutil_fill_spec(const char* const spec,
+                        const uint64_t seed,
+                        const char* const func_name,
+                        const int line);
+
+// Verifies that test_bitarray looks like what the generator spec names
+// makes: for a density or runs, that the number of set bits or of runs is
+// within six standard deviations of its mean; for a period, that every bit
+// matches the one a period on; for the adversarial fill, that every whole
+// word has one bit set; and for the uniform fill, a density of 1/2.
+// Outputs FAIL or PASS as appropriate.
+void testutil_expect_fill(const char* const spec,
+                          const char* const func_name,
+                          const int line);
+
+// Returns a new bit array parsed from a string of 0s and 1s.
+// Requires that the string holds nothing else.
+static bitarray_t* bitarray_frmstr(const char* const bitstring);
+
+// Prints a string representation of a bit array, converting it a chunk at a
+// time.
 static void bitarray_fprint(FILE* const stream,
                             const bitarray_t* const bitarray);
 
@@ -79,6 +381,35 @@ static void testutil_expect_internal(const char* const bitstring,
                                      const char* const func_name,
                                      const int line);
 
+// Converts an operation name (and, or, xor, andnot) into a
+// bitarray_logic_t.
+static bitarray_logic_t logicfromstr(const char* const name);
+
+// Returns the view of the current window of test_bitarray.
+static bitview_t testutil_view(void);
+
+// Makes bitarray, which must have the same size, the new test_bitarray in
+// place of the old one, keeping the window.
+static void testutil_replace(bitarray_t* const bitarray);
+
+// Advances a xorshift generator and returns its next value.
+static uint64_t xorshift(uint64_t* const state);
+
+// Fills a subarray with regions that are random, sparse, runs, all ones or
+// all zeros, drawing everything from a generator seeded with seed, so that
+// the bits are the same on every platform.
+static void mixedfill(bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length,
+                      const unsigned int seed);
+
+// Verifies that hybrid holds the same bits as test_bitarray, reading them
+// both through hybrid_to_bitarray and bit by bit through hybrid_get.
+// Outputs FAIL or PASS as appropriate.
+static void testutil_expect_hybrid(const hybrid_t* const hybrid,
+                                   const char* const func_name,
+                                   const int line);
+
 // Converts a character into a boolean.  The character '1' converts to true;
 // the character '0' converts to false.
 static bool boolfromchar(const char c);
@@ -93,6 +424,65 @@ char* next_arg_char();
 // The bit array currently under test.
 static bitarray_t* test_bitarray = NULL;
 
+// The rank/select index over test_bitarray, if a test has asked for one.
+// Once built, rotations and fills go through it so it stays current.
+static rankselect_t* test_rankselect = NULL;
+
+// The second operand of the logical-operation tests.
+static bitarray_t* test_operand = NULL;
+
+// The window that offsets of rotations, reversals, fills, counts and scans
+// are relative to, if a test has narrowed one with testutil_window;
+// otherwise they address the whole of test_bitarray.
+static bitview_t test_view;
+static bool test_view_active = false;
+
+// Compressed copies of the subarrays the compressed-array benchmarks use.
+static ewah_t* timed_ewah = NULL;
+static ewah_t* timed_ewah_operand = NULL;
+
+// The subarray the serialization benchmarks write and read, and the
+// temporary file they use.
+static bitarray_t* timed_file_array = NULL;
+static int timed_fd = -1;
+
+// The text the text-conversion benchmarks parse and format into.
+static char* timed_text = NULL;
+
+// The generator the timed operations fill their bit arrays from.
+static fill_spec_t timed_fill = {FILL_UNIFORM, 0.5};
+
+// The number of trials timed_operation times each tier over.
+static size_t timed_trials = TIMED_TRIALS;
+
+// Whether timed_operation counts hardware events around each trial.
+static bool timed_counting = false;
+
+// Whether the setups print what they set up, which they do on the first
+// trial of a tier only, and not while results are written as records.
+static bool timed_report_setup = false;
+
+// The arena testutil_arena allocates from, made on first use.
+static bitarray_arena_t* test_arena = NULL;
+
+// The arena the arena-allocation benchmark allocates from.
+static bitarray_arena_t* timed_arena = NULL;
+
+// The small bit arrays the small-array access benchmarks read and write.
+static bitarray_t** timed_small = NULL;
+
+// The snapshot testutil_snapshot took, and the bits it should hold.
+static bitarray_snapshot_t* test_snapshot = NULL;
+static bitarray_t* test_snapshot_expected = NULL;
+
+// The subarray the snapshot benchmarks write to, and its snapshot.
+static bitarray_t* timed_cow_array = NULL;
+static bitarray_snapshot_t* timed_snapshot = NULL;
+
+// Hybrid copies of the subarrays the hybrid-array benchmarks use.
+static hybrid_t* timed_hybrid = NULL;
+static hybrid_t* timed_hybrid_operand = NULL;
+
 // Whether or not tests should be verbose.
 static bool test_verbose = false;
 
@@ -140,17 +530,18 @@ static void testutil_newrand(const size_t bit_sz, const unsigned int seed) {
   // If we somehow managed to avoid freeing test_bitarray after a previous
   // test, go free it now.
   if (test_bitarray != NULL) {
+    rankselect_free(test_rankselect);
+    test_rankselect = NULL;
+    test_view_active = false;
     bitarray_free(test_bitarray);
   }
 
   test_bitarray = bitarray_new(bit_sz);
   assert(test_bitarray != NULL);
 
-  // Reseed the RNG with whatever we were passed; this ensures that we can
+  // Fill from whatever seed we were passed; this ensures that we can
   // repeat the test deterministically by specifying the same seed.
-  srand(seed);
-
-  bitarray_randfill(test_bitarray);
+  bitarray_randfill(test_bitarray, seed);
 
   // If we were asked to be verbose, go ahead and show the bit array and
   // the random seed.
@@ -161,23 +552,159 @@ static void testutil_newrand(const size_t bit_sz, const unsigned int seed) {
   }
 }
 
-void testutil_frmstr(const char* const bitstring) {
-  const size_t bitstring_length = strlen(bitstring);
+static bool parse_fill_spec(const char* const spec, fill_spec_t* const fill) {
+  if (strcmp(spec, "uniform") == 0) {
+    *fill = (fill_spec_t) {FILL_UNIFORM, 0.5};
+    return true;
+  }
+  if (strcmp(spec, "adversarial") == 0) {
+    *fill = (fill_spec_t) {FILL_ADVERSARIAL, 1.0 / 64};
+    return true;
+  }
+  const char* const colon = strchr(spec, ':');
+  if (colon == NULL) {
+    return false;
+  }
+  char* end;
+  const double param = strtod(colon + 1, &end);
+  if (end == colon + 1 || *end != '\0') {
+    return false;
+  }
+  const size_t name_length = colon - spec;
+  if (name_length == strlen("density") && strncmp(spec, "density", name_length) == 0) {
+    *fill = (fill_spec_t) {FILL_DENSITY, param};
+    return param >= 0 && param <= 1;
+  }
+  if (name_length == strlen("runs") && strncmp(spec, "runs", name_length) == 0) {
+    *fill = (fill_spec_t) {FILL_RUNS, param};
+    return param >= 1;
+  }
+  if (name_length == strlen("periodic") && strncmp(spec, "periodic", name_length) == 0) {
+    *fill = (fill_spec_t) {FILL_PERIODIC, param};
+    return param >= 1 && param == (size_t)param;
+  }
+  return false;
+}
+
+static void fill_bits(bitarray_t* const bitarray,
+                      const fill_spec_t* const fill,
+                      const uint64_t seed) {
+  switch (fill->kind) {
+  case FILL_UNIFORM:
+    bitarray_randfill(bitarray, seed);
+    break;
+  case FILL_DENSITY:
+    bitarray_randfill_density(bitarray, fill->param, seed);
+    break;
+  case FILL_RUNS:
+    bitarray_randfill_runs(bitarray, fill->param, seed);
+    break;
+  case FILL_PERIODIC:
+    bitarray_randfill_periodic(bitarray, (size_t)fill->param, seed);
+    break;
+  case FILL_ADVERSARIAL:
+    bitarray_randfill_adversarial(bitarray, seed);
+    break;
+  }
+}
+
+bool timed_select_fill(const char* const spec) {
+  return parse_fill_spec(spec, &timed_fill);
+}
+
+void testutil_fill_spec(const char* const spec,
+                        const uint64_t seed,
+                        const char* const func_name,
+                        const int line) {
+  assert(test_bitarray != NULL);
+  fill_spec_t fill;
+  if (!parse_fill_spec(spec, &fill)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - no generator %s", spec);
+    return;
+  }
+  fill_bits(test_bitarray, &fill, seed);
+  if (test_rankselect != NULL) {
+    rankselect_rebuild(test_rankselect);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " fill %s, seed=%llu\n", spec, (unsigned long long) seed);
+  }
+}
+
+void testutil_expect_fill(const char* const spec,
+                          const char* const func_name,
+                          const int line) {
+  assert(test_bitarray != NULL);
+  fill_spec_t fill;
+  if (!parse_fill_spec(spec, &fill)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - no generator %s", spec);
+    return;
+  }
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+
+  // Counts follow a binomial distribution over n trials of probability p.
+  double n = bit_sz;
+  double p = fill.param;
+  size_t observed = bitarray_count(test_bitarray, 0, bit_sz);
+  switch (fill.kind) {
+  case FILL_RUNS:
+    // Each bit after the first starts a new run with probability 1 / mean.
+    n = bit_sz > 0 ? bit_sz - 1 : 0;
+    p = 1 / fill.param;
+    observed = 0;
+    for (size_t i = 1; i < bit_sz; i++) {
+      observed += bitarray_get(test_bitarray, i) != bitarray_get(test_bitarray, i - 1);
+    }
+    break;
+  case FILL_PERIODIC:
+    {
+      const size_t period = (size_t)fill.param;
+      if (period < bit_sz &&
+          !bitarray_equal_range(test_bitarray, 0, test_bitarray, period, bit_sz - period)) {
+        TEST_FAIL_WITH_NAME(func_name, line, " Bits do not repeat every %zu", period);
+      } else {
+        TEST_PASS_WITH_NAME(func_name, line);
+      }
+    }
+    return;
+  case FILL_ADVERSARIAL:
+    for (size_t w = 0; w + 1 <= bit_sz / 64; w++) {
+      if (bitarray_count(test_bitarray, w * 64, 64) != 1) {
+        TEST_FAIL_WITH_NAME(func_name, line, " Word %zu does not have exactly one bit set", w);
+        return;
+      }
+    }
+    TEST_PASS_WITH_NAME(func_name, line);
+    return;
+  default:
+    break;
+  }
+
+  // Allow six standard deviations, and one more count for rounding; the
+  // squares are compared so as not to need sqrt.
+  const double mean = n * p;
+  const double variance = n * p * (1 - p);
+  const double off = (observed > mean ? observed - mean : mean - observed) - 1;
+  if (off > 0 && off * off > 36 * variance) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Counted %zu where %s expects %.1f, variance %.1f",
+                        observed, spec, mean, variance);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
 
+void testutil_frmstr(const char* const bitstring) {
   // If we somehow managed to avoid freeing test_bitarray after a previous
   // test, go free it now.
   if (test_bitarray != NULL) {
+    rankselect_free(test_rankselect);
+    test_rankselect = NULL;
+    test_view_active = false;
     bitarray_free(test_bitarray);
   }
 
-  test_bitarray = bitarray_new(bitstring_length);
-  assert(test_bitarray != NULL);
-
-  bool current_bit;
-  for (size_t i = 0; i < bitstring_length; i++) {
-    current_bit = boolfromchar(bitstring[i]);
-    bitarray_set(test_bitarray, i, current_bit);
-  }
+  test_bitarray = bitarray_frmstr(bitstring);
   bitarray_fprint(stdout, test_bitarray);
   if (test_verbose) {
     fprintf(stdout, " newstr lit=%s\n", bitstring);
@@ -185,10 +712,88 @@ void testutil_frmstr(const char* const bitstring) {
   }
 }
 
+void testutil_operand_frmstr(const char* const bitstring) {
+  bitarray_free(test_operand);
+  test_operand = bitarray_frmstr(bitstring);
+}
+
+void testutil_logic(const bitarray_logic_t op,
+                    const bool from_self,
+                    const size_t dst_offset,
+                    const size_t src_offset,
+                    const size_t bit_length) {
+  assert(test_bitarray != NULL);
+  assert(from_self || test_operand != NULL);
+  bitarray_logic_range(test_bitarray, dst_offset,
+                       from_self ? test_bitarray : test_operand, src_offset,
+                       bit_length, op);
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " logic op=%d, dst=%zu, src=%zu, len=%zu\n",
+            (int)op, dst_offset, src_offset, bit_length);
+  }
+}
+
+void testutil_expect_logic_count(const bitarray_logic_t op,
+                                 const size_t a_offset,
+                                 const size_t b_offset,
+                                 const size_t bit_length,
+                                 const size_t expected,
+                                 const char* const func_name,
+                                 const int line) {
+  assert(test_bitarray != NULL && test_operand != NULL);
+  const size_t actual = bitarray_logic_count(test_bitarray, a_offset,
+                                             test_operand, b_offset,
+                                             bit_length, op);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect fused count.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_expect_compare(const size_t a_offset,
+                             const size_t b_offset,
+                             const size_t bit_length,
+                             const int expected,
+                             const char* const func_name,
+                             const int line) {
+  assert(test_bitarray != NULL && test_operand != NULL);
+  const int cmp = bitarray_compare_range(test_bitarray, a_offset,
+                                         test_operand, b_offset, bit_length);
+  const int actual = (cmp > 0) - (cmp < 0);
+  const bool equal = bitarray_equal_range(test_bitarray, a_offset,
+                                          test_operand, b_offset, bit_length);
+  const bool same_hash =
+      bitarray_hash_range(test_bitarray, a_offset, bit_length) ==
+      bitarray_hash_range(test_operand, b_offset, bit_length);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect comparison.\n    Expected: %d\n    Actual:   %d",
+                        expected, actual);
+  } else if (equal != (expected == 0)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Equality disagrees with comparison %d", expected);
+  } else if (equal && !same_hash) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Equal subarrays hashed differently");
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+static bitarray_t* bitarray_frmstr(const char* const bitstring) {
+  bitarray_t* const bitarray = bitarray_from_string(bitstring);
+  assert(bitarray != NULL);
+  return bitarray;
+}
+
 static void bitarray_fprint(FILE* const stream,
                             const bitarray_t* const bitarray) {
-  for (size_t i = 0; i < bitarray_get_bit_sz(bitarray); i++) {
-    fprintf(stream, "%d", bitarray_get(bitarray, i) ? 1 : 0);
+  char text[PRINT_CHUNK_BITS + 1];
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  for (size_t i = 0; i < bit_sz; i += PRINT_CHUNK_BITS) {
+    const size_t n = bit_sz - i < PRINT_CHUNK_BITS ? bit_sz - i : PRINT_CHUNK_BITS;
+    bitarray_to_string(bitarray, i, n, text);
+    fwrite(text, 1, n, stream);
   }
 }
 
@@ -201,29 +806,23 @@ static void testutil_expect_internal(const char* bitstring,
 
   assert(test_bitarray != NULL);
 
-  // Check the length of the bit array under test.
+  // Check the length of the bit array under test, then the content.
   const size_t bitstring_length = strlen(bitstring);
   if (bitstring_length != bitarray_get_bit_sz(test_bitarray)) {
     bad = "bitarray size";
-  }
-
-  // Check the content.
-  for (size_t i = 0; i < bitstring_length; i++) {
-    if (bitarray_get(test_bitarray, i) != boolfromchar(bitstring[i])) {
+  } else {
+    bitarray_t* const expected = bitarray_frmstr(bitstring);
+    if (!bitarray_equal_range(test_bitarray, 0, expected, 0, bitstring_length)) {
       bad = "bitarray content";
     }
+    bitarray_free(expected);
   }
 
   // Obtain a string for the actual bitstring.
   const size_t actual_bitstring_length = bitarray_get_bit_sz(test_bitarray);
-  char* actual_bitstring = calloc(sizeof(char), bitstring_length + 1);
-  for (size_t i = 0; i < actual_bitstring_length; i++) {
-    if (bitarray_get(test_bitarray, i)) {
-      actual_bitstring[i] = '1';
-    } else {
-      actual_bitstring[i] = '0';
-    }
-  }
+  char* actual_bitstring = malloc(actual_bitstring_length + 1);
+  assert(actual_bitstring != NULL);
+  bitarray_to_string(test_bitarray, 0, actual_bitstring_length, actual_bitstring);
 
   if (bad != NULL) {
     bitarray_fprint(stdout, test_bitarray);
@@ -236,101 +835,1872 @@ static void testutil_expect_internal(const char* bitstring,
   free(actual_bitstring);
 }
 
-void testutil_rotate(const size_t bit_offset,
-                     const size_t bit_length,
-                     const ssize_t bit_right_shift_amount) {
+void testutil_arena() {
   assert(test_bitarray != NULL);
-  bitarray_rotate(test_bitarray, bit_offset, bit_length, bit_right_shift_amount);
+  if (test_arena == NULL) {
+    test_arena = bitarray_arena_new();
+    assert(test_arena != NULL);
+  }
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  bitarray_t* const bitarray = bitarray_arena_alloc(test_arena, bit_sz);
+  assert(bitarray != NULL);
+  bitarray_logic3(bitarray, test_bitarray, test_bitarray, BITARRAY_AND);
+  testutil_replace(bitarray);
   if (test_verbose) {
     bitarray_fprint(stdout, test_bitarray);
-    fprintf(stdout, " rotate off=%zu, len=%zu, amnt=%zd\n",
-            bit_offset, bit_length, bit_right_shift_amount);
+    fprintf(stdout, " arena sz=%zu\n", bit_sz);
   }
 }
 
-void testutil_require_valid_input(const size_t bit_offset,
-                                  const size_t bit_length,
-                                  const ssize_t bit_right_shift_amount,
-                                  const char* const func_name,
-                                  const int line) {
-  size_t bitarray_length = bitarray_get_bit_sz(test_bitarray);
-  if (bit_offset >= bitarray_length || bit_length > bitarray_length ||
-      bit_offset + bit_length > bitarray_length) {
-    // invalid input
-    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - " \
-                        "bit_offset + bit_length > bitarray_length");
+void testutil_snapshot() {
+  assert(test_bitarray != NULL);
+  bitarray_snapshot_free(test_snapshot);
+  bitarray_free(test_snapshot_expected);
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  test_snapshot = bitarray_snapshot(test_bitarray);
+  test_snapshot_expected = bitarray_new(bit_sz);
+  assert(test_snapshot != NULL && test_snapshot_expected != NULL);
+  bitarray_logic3(test_snapshot_expected, test_bitarray, test_bitarray, BITARRAY_AND);
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " snapshot sz=%zu\n", bit_sz);
   }
 }
 
-// Precomputed array of fibonacci numbers
-const int FIB_SIZE = 53;
-const double fibs[FIB_SIZE] = {1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597, 2584, 4181, 6765, 10946, 17711, 28657, 46368, 75025, 121393, 196418, 317811, 514229, 832040, 1346269, 2178309, 3524578, 5702887, 9227465, 14930352, 24157817, 39088169, 63245986, 102334155, 165580141, 267914296, 433494437, 701408733, 1134903170, 1836311903, 2971215073, 4807526976, 7778742049, 12586269025, 20365011074, 32951280099, 53316291173, 86267571272};
-
-int timed_rotation(const double time_limit_seconds) {
-  // We're going to be doing a bunch of rotations; we probably shouldn't
-  // let the user see all the verbose output.
-  test_verbose = false;
+// Returns the number of ways in which test_snapshot differs from
+// test_snapshot_expected: its size, its bits read back as a copy and one at
+// a time, and its counts over a few subarrays.
+static size_t snapshot_differences() {
+  const size_t bit_sz = bitarray_get_bit_sz(test_snapshot_expected);
+  if (bitarray_snapshot_get_bit_sz(test_snapshot) != bit_sz) {
+    return 1;
+  }
+  size_t differences = 0;
+  bitarray_t* const copy = bitarray_snapshot_copy(test_snapshot);
+  assert(copy != NULL);
+  differences += !bitarray_equal_range(copy, 0, test_snapshot_expected, 0, bit_sz);
+  bitarray_free(copy);
+  for (size_t i = 0; i < bit_sz; i += 1 + i / 4096) {
+    differences += bitarray_snapshot_get(test_snapshot, i) !=
+                   bitarray_get(test_snapshot_expected, i);
+  }
+  const size_t ranges[][2] = {{0, bit_sz}, {bit_sz / 3, bit_sz / 3},
+                              {bit_sz / 2, bit_sz - bit_sz / 2}};
+  for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+    differences += bitarray_snapshot_count(test_snapshot, ranges[r][0], ranges[r][1]) !=
+                   bitarray_count(test_snapshot_expected, ranges[r][0], ranges[r][1]);
+  }
+  return differences;
+}
 
-  // Continue until the rotation exceeds time_limits_seconds
-  int tier_num = 0;
-  while(tier_num + 3 < FIB_SIZE){
-    const size_t bit_offset             = fibs[tier_num];
-    const size_t bit_right_shift_amount = fibs[tier_num+1];
-    const size_t bit_length             = fibs[tier_num+2];
-    const size_t bit_sz                 = fibs[tier_num+3];
-    assert(bit_sz > bit_length);
-    assert(bit_length > bit_right_shift_amount);
-    assert(bit_right_shift_amount > bit_offset);
-    assert(bit_sz > bit_offset + bit_length);
+// Checks the snapshot a few times over, for a reader thread.
+static void* snapshot_reader(void* const arg) {
+  size_t* const differences = arg;
+  for (int round = 0; round < 4; round++) {
+    *differences += snapshot_differences();
+  }
+  return NULL;
+}
 
-    // Initialize a new bit_array
-    testutil_newrand(bit_sz, 6172);
- 
-    // Time the duration of a rotation
-    const clockmark_t start_time = ktiming_getmark();
-    testutil_rotate(bit_offset, bit_length, bit_right_shift_amount);
-    const clockmark_t end_time = ktiming_getmark();
-    double diff_seconds = ktiming_diff_usec(&start_time, &end_time) / 1000000000.0;
+void testutil_expect_snapshot(const char* const func_name, const int line) {
+  assert(test_bitarray != NULL);
+  if (test_snapshot == NULL) {
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - no snapshot taken");
+    return;
+  }
+  const size_t differences = snapshot_differences();
 
-    //char *str_size = NULL;
-    char buf[20];
-    if (bit_length < 8*1024){
-        sprintf(buf, "%luB", bit_length / 8);
-    } else if (bit_length < 8 * 1024 * 1024){
-        sprintf(buf, "%luKB", bit_length / (8 * 1024));
-    } else if (bit_length < 8UL * 1024 * 1024 * 1024){
-        sprintf(buf, "%luMB", bit_length / (8 * 1024 * 1024));
-    } else {
-        sprintf(buf, "%luGB", bit_length / (8UL * 1024 * 1024 * 1024));
-    }
-    if (diff_seconds < time_limit_seconds){
-      printf("Tier %d (≈%s) completed in " ANSI_COLOR_GREEN "%.6fs" ANSI_COLOR_RESET "\n",
-        tier_num, buf, diff_seconds);
-      tier_num++;
-    } else {
-      printf("Tier %d (≈%s) exceeded %.2fs cutoff with time" ANSI_COLOR_RED " %.6fs" ANSI_COLOR_RESET "\n",
-         tier_num, buf, time_limit_seconds, diff_seconds);
-      // Return the last tier that was succesful.
-      return tier_num - 1;
-    }
+  // Rotating by one and back leaves test_bitarray as it was, but writes
+  // every chunk of it while the reader is at work.
+  size_t concurrent_differences = 0;
+  pthread_t reader;
+  const int created = pthread_create(&reader, NULL, snapshot_reader, &concurrent_differences);
+  assert(created == 0);
+  (void)created;
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  for (int round = 0; round < 4 && bit_sz > 0; round++) {
+    bitarray_rotate(test_bitarray, 0, bit_sz, 1);
+    bitarray_rotate(test_bitarray, 0, bit_sz, -1);
   }
+  pthread_join(reader, NULL);
 
-  // Return the last tier that was succesful.
-  return tier_num - 1;
+  if (differences != 0) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Snapshot changed in %zu ways", differences);
+  } else if (concurrent_differences != 0) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Snapshot read %zu differences while written",
+                        concurrent_differences);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+  if (test_verbose) {
+    fprintf(stdout, " expect snapshot space=%zu\n", bitarray_snapshot_get_space(test_snapshot));
+  }
 }
 
-static bool boolfromchar(const char c) {
-  assert(c == '0' || c == '1');
-  return c == '1';
+// A round of the atomic stress test.
+typedef enum {
+  STRESS_SET,
+  STRESS_CLEAR,
+  STRESS_TEST_AND_SET,
+  STRESS_FETCH_OR
+} stress_round_t;
+
+// What one thread of the atomic stress test does, and what it saw.
+typedef struct {
+  stress_round_t round;
+  size_t thread;
+  size_t threads;
+  // Test-and-sets this thread won, or for STRESS_FETCH_OR, words in which it
+  // found one of its own bits already set.
+  size_t tally;
+} stress_arg_t;
+
+static void* stress_worker(void* const arg) {
+  stress_arg_t* const stress = arg;
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  switch (stress->round) {
+  case STRESS_SET:
+    for (size_t i = stress->thread; i < bit_sz; i += stress->threads) {
+      bitarray_atomic_set(test_bitarray, i, BITARRAY_ACQ_REL);
+    }
+    break;
+  case STRESS_CLEAR:
+    for (size_t i = stress->thread; i < bit_sz; i += stress->threads) {
+      bitarray_atomic_clear(test_bitarray, i, BITARRAY_RELAXED);
+    }
+    break;
+  case STRESS_TEST_AND_SET:
+    // Every thread tries every bit, each starting at its own point, so the
+    // threads run into each other wherever they overlap.
+    for (size_t j = 0; j < bit_sz; j++) {
+      const size_t i = (j + stress->thread * bit_sz / stress->threads) % bit_sz;
+      stress->tally += !bitarray_atomic_test_and_set(test_bitarray, i, BITARRAY_ACQ_REL);
+    }
+    break;
+  case STRESS_FETCH_OR:
+    for (size_t w = 0; w * 64 < bit_sz; w++) {
+      uint64_t mask = 0;
+      for (size_t b = 0; b < 64 && w * 64 + b < bit_sz; b++) {
+        mask |= (uint64_t)((w * 64 + b) % stress->threads == stress->thread) << b;
+      }
+      stress->tally += (bitarray_atomic_fetch_or(test_bitarray, w, mask,
+                                                 BITARRAY_RELAXED) & mask) != 0;
+    }
+    break;
+  }
+  return NULL;
 }
 
-char* next_arg_char() {
-  char* buf = strtok(NULL, " ");
-  char* eol = NULL;
-  if ((eol = strchr(buf, '\n')) != NULL) {
-    *eol = '\0';
+// Runs one round of the atomic stress test on `threads` threads and returns
+// the sum of their tallies.
+static size_t stress_round(const stress_round_t round, const size_t threads) {
+  pthread_t workers[MAX_STRESS_THREADS];
+  stress_arg_t args[MAX_STRESS_THREADS];
+  for (size_t t = 0; t < threads; t++) {
+    args[t] = (stress_arg_t) {.round = round, .thread = t, .threads = threads, .tally = 0};
+    const int created = pthread_create(&workers[t], NULL, stress_worker, &args[t]);
+    assert(created == 0);
+    (void)created;
   }
-  return buf;
+  size_t tally = 0;
+  for (size_t t = 0; t < threads; t++) {
+    pthread_join(workers[t], NULL);
+    tally += args[t].tally;
+  }
+  return tally;
+}
+
+void testutil_atomic_stress(const size_t threads,
+                            const char* const func_name,
+                            const int line) {
+  assert(test_bitarray != NULL);
+  if (threads == 0 || threads > MAX_STRESS_THREADS) {
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - between 1 and %d threads",
+                        MAX_STRESS_THREADS);
+    return;
+  }
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+
+  bitarray_fill_range(test_bitarray, 0, bit_sz, false);
+  stress_round(STRESS_SET, threads);
+  const size_t set = bitarray_count(test_bitarray, 0, bit_sz);
+  stress_round(STRESS_CLEAR, threads);
+  const size_t cleared = bitarray_count(test_bitarray, 0, bit_sz);
+  const size_t won = stress_round(STRESS_TEST_AND_SET, threads);
+  const size_t tested = bitarray_count(test_bitarray, 0, bit_sz);
+  bitarray_fill_range(test_bitarray, 0, bit_sz, false);
+  const size_t clashes = stress_round(STRESS_FETCH_OR, threads);
+  const size_t ored = bitarray_count(test_bitarray, 0, bit_sz);
+  if (test_rankselect != NULL) {
+    rankselect_rebuild(test_rankselect);
+  }
+
+  if (set != bit_sz || cleared != 0 || tested != bit_sz || ored != bit_sz) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Lost updates.\n    Set: %zu, cleared: %zu, "
+                        "test-and-set: %zu, fetch-or: %zu of %zu",
+                        set, cleared, tested, ored, bit_sz);
+  } else if (won != bit_sz) {
+    TEST_FAIL_WITH_NAME(func_name, line, " %zu test-and-sets won for %zu bits", won, bit_sz);
+  } else if (clashes != 0) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Fetch-or saw %zu foreign bits", clashes);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " atomic stress threads=%zu\n", threads);
+  }
+}
+
+void testutil_expect_text(const size_t bit_offset,
+                          const char* const bitstring,
+                          const char* const func_name,
+                          const int line) {
+  assert(test_bitarray != NULL);
+  const size_t bit_length = strlen(bitstring);
+  char* const actual = malloc(bit_length + 1);
+  assert(actual != NULL);
+  bitarray_to_string(test_bitarray, bit_offset, bit_length, actual);
+  bitarray_t* const parsed = bitarray_from_string(bitstring);
+
+  if (strcmp(actual, bitstring) != 0) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect text.\n    Expected: %s\n    Actual:   %s",
+                        bitstring, actual);
+  } else if (parsed == NULL ||
+             !bitarray_equal_range(parsed, 0, test_bitarray, bit_offset, bit_length)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Parsing the text gave different bits");
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+  bitarray_free(parsed);
+  free(actual);
+}
+
+void testutil_rotate(const size_t bit_offset,
+                     const size_t bit_length,
+                     const ssize_t bit_right_shift_amount) {
+  assert(test_bitarray != NULL);
+  const bitview_t view = bitview_slice(testutil_view(), bit_offset, bit_length);
+  if (test_rankselect != NULL) {
+    rankselect_rotate(test_rankselect, view.bit_offset, bit_length, bit_right_shift_amount);
+  } else {
+    bitview_rotate(view, bit_right_shift_amount);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " rotate off=%zu, len=%zu, amnt=%zd\n",
+            bit_offset, bit_length, bit_right_shift_amount);
+  }
+}
+
+void testutil_fill(const size_t bit_offset,
+                   const size_t bit_length,
+                   const bool value) {
+  assert(test_bitarray != NULL);
+  const bitview_t view = bitview_slice(testutil_view(), bit_offset, bit_length);
+  bitview_fill(view, value);
+  if (test_rankselect != NULL) {
+    rankselect_refresh_range(test_rankselect, view.bit_offset, bit_length);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " fill off=%zu, len=%zu, val=%d\n",
+            bit_offset, bit_length, value ? 1 : 0);
+  }
+}
+
+void testutil_reverse(const size_t bit_offset, const size_t bit_length) {
+  assert(test_bitarray != NULL);
+  const bitview_t view = bitview_slice(testutil_view(), bit_offset, bit_length);
+  bitview_reverse(view);
+  if (test_rankselect != NULL) {
+    rankselect_refresh_range(test_rankselect, view.bit_offset, bit_length);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " reverse off=%zu, len=%zu\n", bit_offset, bit_length);
+  }
+}
+
+void testutil_window(const size_t bit_offset, const size_t bit_length) {
+  assert(test_bitarray != NULL);
+  test_view = bitview_slice(testutil_view(), bit_offset, bit_length);
+  test_view_active = true;
+  if (test_verbose) {
+    fprintf(stdout, " window off=%zu, len=%zu\n", test_view.bit_offset, test_view.bit_length);
+  }
+}
+
+static void testutil_replace(bitarray_t* const bitarray) {
+  assert(bitarray != NULL);
+  assert(bitarray_get_bit_sz(bitarray) == bitarray_get_bit_sz(test_bitarray));
+  rankselect_free(test_rankselect);
+  test_rankselect = NULL;
+  bitarray_free(test_bitarray);
+  test_bitarray = bitarray;
+  if (test_view_active) {
+    test_view.bitarray = bitarray;
+  }
+}
+
+void testutil_ewah_rotate(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  assert(test_bitarray != NULL);
+  ewah_t* const ewah = ewah_from_bitarray(test_bitarray);
+  assert(ewah != NULL);
+  if (!ewah_rotate(ewah, bit_offset, bit_length, bit_right_amount)) {
+    TEST_FAIL(" Could not rotate the compressed bit array");
+  }
+  testutil_replace(ewah_to_bitarray(ewah));
+  ewah_free(ewah);
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " ewah rotate off=%zu, len=%zu, amnt=%zd\n",
+            bit_offset, bit_length, bit_right_amount);
+  }
+}
+
+void testutil_ewah_logic(const bitarray_logic_t op,
+                         const char* const func_name,
+                         const int line) {
+  assert(test_bitarray != NULL && test_operand != NULL);
+  ewah_t* const a = ewah_from_bitarray(test_bitarray);
+  ewah_t* const b = ewah_from_bitarray(test_operand);
+  ewah_t* const result = ewah_logic(a, b, op);
+  assert(a != NULL && b != NULL && result != NULL);
+  const size_t fused = ewah_logic_count(a, b, op);
+  const size_t count = ewah_count(result);
+  if (fused != count) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect fused compressed count.\n    Expected: %zu\n    Actual:   %zu",
+                        count, fused);
+  }
+  testutil_replace(ewah_to_bitarray(result));
+  ewah_free(a);
+  ewah_free(b);
+  ewah_free(result);
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " ewah logic op=%d\n", (int)op);
+  }
+}
+
+void testutil_expect_ewah_count(const size_t expected,
+                                const char* const func_name,
+                                const int line) {
+  assert(test_bitarray != NULL);
+  ewah_t* const ewah = ewah_from_bitarray(test_bitarray);
+  assert(ewah != NULL);
+  const size_t actual = ewah_count(ewah);
+  ewah_free(ewah);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect compressed count.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+// Each region of MIXED_REGION_BITS bits gets one of these kinds.
+#define MIXED_REGION_BITS 65536
+#define MIXED_KINDS 5
+
+static uint64_t xorshift(uint64_t* const state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void mixedfill(bitarray_t* const bitarray,
+                      const size_t bit_offset,
+                      const size_t bit_length,
+                      const unsigned int seed) {
+  uint64_t state = (seed + 1ULL) * 0x9e3779b97f4a7c15ULL;
+  const size_t bit_end = bit_offset + bit_length;
+  for (size_t base = bit_offset; base < bit_end; base += MIXED_REGION_BITS) {
+    const size_t end = bit_end - base < MIXED_REGION_BITS ? bit_end : base + MIXED_REGION_BITS;
+    switch ((xorshift(&state) >> 32) % MIXED_KINDS) {
+    case 0: {
+      // Random: dense.
+      size_t i = base;
+      for (; i + 64 <= end; i += 64) {
+        bitarray_set_u64(bitarray, i, xorshift(&state));
+      }
+      for (uint64_t bits = xorshift(&state); i < end; i++, bits >>= 1) {
+        bitarray_set(bitarray, i, bits & 1);
+      }
+      break;
+    }
+    case 1:
+      // Sparse: a one every 150 bits or so.
+      bitarray_fill_range(bitarray, base, end - base, false);
+      for (size_t i = base + xorshift(&state) % 300; i < end; i += 1 + xorshift(&state) % 300) {
+        bitarray_set(bitarray, i, true);
+      }
+      break;
+    case 2:
+      // Runs of up to 2000 bits, alternating.
+      for (size_t i = base, value = xorshift(&state) % 2; i < end; value = !value) {
+        const size_t run = 1 + xorshift(&state) % 2000;
+        const size_t n = end - i < run ? end - i : run;
+        bitarray_fill_range(bitarray, i, n, value);
+        i += n;
+      }
+      break;
+    default:
+      bitarray_fill_range(bitarray, base, end - base, xorshift(&state) % 2);
+      break;
+    }
+  }
+}
+
+void testutil_newmixed(const size_t bit_sz, const unsigned int seed) {
+  testutil_newrand(bit_sz, seed);
+  mixedfill(test_bitarray, 0, bit_sz, seed);
+  bitarray_free(test_operand);
+  test_operand = bitarray_new(bit_sz);
+  assert(test_operand != NULL);
+  mixedfill(test_operand, 0, bit_sz, ~seed);
+  if (test_verbose) {
+    fprintf(stdout, " newmixed sz=%zu, seed=%u\n", bit_sz, seed);
+  }
+}
+
+static void testutil_expect_hybrid(const hybrid_t* const hybrid,
+                                   const char* const func_name,
+                                   const int line) {
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  bitarray_t* const expanded = hybrid_to_bitarray(hybrid);
+  assert(expanded != NULL);
+  const bool equal = bitarray_equal_range(expanded, 0, test_bitarray, 0, bit_sz);
+  bitarray_free(expanded);
+  if (!equal) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Hybrid form differs from the bit array.");
+    return;
+  }
+  for (size_t i = 0; i < bit_sz; i++) {
+    if (hybrid_get(hybrid, i) != bitarray_get(test_bitarray, i)) {
+      TEST_FAIL_WITH_NAME(func_name, line, " Hybrid form reads bit %zu wrong.", i);
+      return;
+    }
+  }
+  const size_t count = bitarray_count(test_bitarray, 0, bit_sz);
+  const size_t actual = hybrid_count(hybrid, 0, bit_sz);
+  if (actual != count) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect hybrid count.\n    Expected: %zu\n    Actual:   %zu",
+                        count, actual);
+    return;
+  }
+  TEST_PASS_WITH_NAME(func_name, line);
+}
+
+void testutil_hybrid_rotate(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount,
+                            const char* const func_name,
+                            const int line) {
+  assert(test_bitarray != NULL);
+  hybrid_t* const hybrid = hybrid_from_bitarray(test_bitarray);
+  assert(hybrid != NULL);
+  if (!hybrid_rotate(hybrid, bit_offset, bit_length, bit_right_amount)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Could not rotate the hybrid bit array");
+  }
+  bitarray_rotate(test_bitarray, bit_offset, bit_length, bit_right_amount);
+  rankselect_free(test_rankselect);
+  test_rankselect = NULL;
+  testutil_expect_hybrid(hybrid, func_name, line);
+  hybrid_free(hybrid);
+}
+
+void testutil_hybrid_logic(const bitarray_logic_t op,
+                           const char* const func_name,
+                           const int line) {
+  assert(test_bitarray != NULL && test_operand != NULL);
+  hybrid_t* const a = hybrid_from_bitarray(test_bitarray);
+  hybrid_t* const b = hybrid_from_bitarray(test_operand);
+  assert(a != NULL && b != NULL);
+  hybrid_t* const result = hybrid_logic(a, b, op);
+  assert(result != NULL);
+  const size_t fused = hybrid_logic_count(a, b, op);
+  testutil_logic(op, false, 0, 0, bitarray_get_bit_sz(test_bitarray));
+  const size_t count = bitarray_count(test_bitarray, 0, bitarray_get_bit_sz(test_bitarray));
+  if (fused != count) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect fused hybrid count.\n    Expected: %zu\n    Actual:   %zu",
+                        count, fused);
+  } else {
+    testutil_expect_hybrid(result, func_name, line);
+  }
+  hybrid_free(a);
+  hybrid_free(b);
+  hybrid_free(result);
+}
+
+void testutil_hybrid_set(const size_t bit_offset,
+                         const size_t bit_length,
+                         const bool value,
+                         const char* const func_name,
+                         const int line) {
+  assert(test_bitarray != NULL);
+  hybrid_t* const hybrid = hybrid_from_bitarray(test_bitarray);
+  assert(hybrid != NULL);
+  for (size_t i = bit_offset; i < bit_offset + bit_length; i++) {
+    if (!hybrid_set(hybrid, i, value)) {
+      TEST_FAIL_WITH_NAME(func_name, line, " Could not set bit %zu of the hybrid bit array", i);
+      break;
+    }
+    bitarray_set(test_bitarray, i, value);
+  }
+  rankselect_free(test_rankselect);
+  test_rankselect = NULL;
+  testutil_expect_hybrid(hybrid, func_name, line);
+  hybrid_free(hybrid);
+}
+
+void testutil_expect_hybrid_count(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const size_t expected,
+                                  const char* const func_name,
+                                  const int line) {
+  assert(test_bitarray != NULL);
+  hybrid_t* const hybrid = hybrid_from_bitarray(test_bitarray);
+  assert(hybrid != NULL);
+  const size_t actual = hybrid_count(hybrid, bit_offset, bit_length);
+  hybrid_free(hybrid);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect hybrid count.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_roundtrip(const char* const func_name, const int line) {
+  assert(test_bitarray != NULL);
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  char path[] = "/tmp/everybit-XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  // The file lives on, nameless, until it is closed and unmapped.
+  unlink(path);
+  if (!bitarray_write(test_bitarray, fd)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Could not write the bit array");
+    close(fd);
+    return;
+  }
+
+  // Flip the first bit of the words, which start right after the 64-byte
+  // header, and make sure the checksum catches it.
+  bool corrupt_read = false;
+  bool restored = true;
+  char byte = 0;
+  if (bit_sz > 0 && pread(fd, &byte, 1, 64) == 1) {
+    byte ^= 1;
+    if (pwrite(fd, &byte, 1, 64) == 1) {
+      lseek(fd, 0, SEEK_SET);
+      bitarray_t* const corrupt = bitarray_read(fd);
+      corrupt_read = corrupt != NULL;
+      bitarray_free(corrupt);
+    }
+    byte ^= 1;
+    restored = pwrite(fd, &byte, 1, 64) == 1;
+  }
+
+  lseek(fd, 0, SEEK_SET);
+  bitarray_t* const read_back = bitarray_read(fd);
+  bitarray_t* const mapped = bitarray_map(fd, true);
+  close(fd);
+  if (!restored || read_back == NULL || mapped == NULL) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Could not read back the bit array");
+    bitarray_free(mapped);
+  } else if (corrupt_read) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Read a bit array with a bad checksum");
+    bitarray_free(mapped);
+  } else if (!bitarray_equal_range(read_back, 0, test_bitarray, 0, bit_sz) ||
+             !bitarray_equal_range(mapped, 0, test_bitarray, 0, bit_sz)) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Bit array changed in the round trip");
+    bitarray_free(mapped);
+  } else {
+    testutil_replace(mapped);
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+  bitarray_free(read_back);
+}
+
+void testutil_append(const char* const bitstring, const bool packed) {
+  assert(test_bitarray != NULL);
+  rankselect_free(test_rankselect);
+  test_rankselect = NULL;
+  test_view_active = false;
+
+  const size_t bitstring_length = strlen(bitstring);
+  bool grown = true;
+  if (packed) {
+    uint64_t* const words = calloc(bitstring_length / 64 + 1, sizeof(uint64_t));
+    assert(words != NULL);
+    for (size_t i = 0; i < bitstring_length; i++) {
+      words[i / 64] |= (uint64_t)boolfromchar(bitstring[i]) << (i % 64);
+    }
+    grown = bitarray_append_bits(test_bitarray, words, bitstring_length);
+    free(words);
+  } else {
+    for (size_t i = 0; i < bitstring_length && grown; i++) {
+      grown = bitarray_append(test_bitarray, boolfromchar(bitstring[i]));
+    }
+  }
+  if (!grown) {
+    TEST_FAIL(" Could not grow the bit array");
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " append packed=%d, bits=%s\n", packed ? 1 : 0, bitstring);
+  }
+}
+
+void testutil_truncate(const size_t bit_sz) {
+  assert(test_bitarray != NULL);
+  rankselect_free(test_rankselect);
+  test_rankselect = NULL;
+  test_view_active = false;
+
+  bitarray_truncate(test_bitarray, bit_sz);
+  if (!bitarray_shrink_to_fit(test_bitarray)) {
+    TEST_FAIL(" Could not shrink the bit array");
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " truncate sz=%zu\n", bit_sz);
+  }
+}
+
+void testutil_transpose(const size_t src_offset,
+                        const size_t dst_offset,
+                        const size_t rows,
+                        const size_t cols) {
+  assert(test_bitarray != NULL);
+  bitmatrix_t* const src = bitmatrix_new(test_bitarray, src_offset, rows, cols);
+  bitmatrix_t* const dst = bitmatrix_new(test_bitarray, dst_offset, cols, rows);
+  assert(src != NULL && dst != NULL);
+  bitmatrix_transpose(dst, src);
+  bitmatrix_free(src);
+  bitmatrix_free(dst);
+  if (test_rankselect != NULL) {
+    rankselect_refresh_range(test_rankselect, dst_offset, rows * cols);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " transpose src=%zu, dst=%zu, rows=%zu, cols=%zu\n",
+            src_offset, dst_offset, rows, cols);
+  }
+}
+
+void testutil_get_column(const size_t src_offset,
+                         const size_t rows,
+                         const size_t cols,
+                         const size_t col,
+                         const size_t dst_offset) {
+  assert(test_bitarray != NULL);
+  bitmatrix_t* const src = bitmatrix_new(test_bitarray, src_offset, rows, cols);
+  assert(src != NULL);
+  bitmatrix_get_column(src, col, test_bitarray, dst_offset);
+  bitmatrix_free(src);
+  if (test_rankselect != NULL) {
+    rankselect_refresh_range(test_rankselect, dst_offset, rows);
+  }
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " column src=%zu, rows=%zu, cols=%zu, col=%zu, dst=%zu\n",
+            src_offset, rows, cols, col, dst_offset);
+  }
+}
+
+void testutil_expect_count(const size_t bit_offset,
+                           const size_t bit_length,
+                           const size_t expected,
+                           const char* const func_name,
+                           const int line) {
+  assert(test_bitarray != NULL);
+  const size_t actual = bitview_count(bitview_slice(testutil_view(), bit_offset, bit_length));
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect count.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_expect_rank(const size_t bit_index,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line) {
+  assert(test_bitarray != NULL);
+  if (test_rankselect == NULL) {
+    test_rankselect = rankselect_new(test_bitarray);
+    assert(test_rankselect != NULL);
+  }
+  const size_t actual = rankselect_rank(test_rankselect, bit_index);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect rank.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_expect_select(const size_t k,
+                            const size_t expected,
+                            const char* const func_name,
+                            const int line) {
+  assert(test_bitarray != NULL);
+  if (test_rankselect == NULL) {
+    test_rankselect = rankselect_new(test_bitarray);
+    assert(test_rankselect != NULL);
+  }
+  const size_t actual = rankselect_select(test_rankselect, k);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect select.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_expect_find(const size_t bit_index,
+                          const bool set,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line) {
+  assert(test_bitarray != NULL);
+  const bitview_t view = testutil_view();
+  const size_t actual = set ? bitview_find_next_set(view, bit_index) :
+                              bitview_find_next_clear(view, bit_index);
+  if (actual != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect next %s bit.\n    Expected: %zu\n    Actual:   %zu",
+                        set ? "set" : "clear", expected, actual);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_expect_iter(const size_t bit_index,
+                          const size_t expected,
+                          const char* const func_name,
+                          const int line) {
+  assert(test_bitarray != NULL);
+  bitarray_iter_t iter;
+  size_t count = 0;
+  size_t previous = 0;
+  size_t i;
+  bitarray_iter_init(&iter, test_bitarray, bit_index);
+  while (bitarray_iter_next(&iter, &i)) {
+    if (i < bit_index || (count > 0 && i <= previous) || !bitarray_get(test_bitarray, i)) {
+      TEST_FAIL_WITH_NAME(func_name, line, " Iterator yielded bad index %zu", i);
+      return;
+    }
+    previous = i;
+    count++;
+  }
+  if (count != expected) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect iteration count.\n    Expected: %zu\n    Actual:   %zu",
+                        expected, count);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+}
+
+void testutil_require_valid_input(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const ssize_t bit_right_shift_amount,
+                                  const char* const func_name,
+                                  const int line) {
+  size_t bitarray_length = bitview_get_bit_sz(testutil_view());
+  if (bit_offset >= bitarray_length || bit_length > bitarray_length ||
+      bit_offset + bit_length > bitarray_length) {
+    // invalid input
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - " \
+                        "bit_offset + bit_length > bitarray_length");
+  }
+}
+
+void testutil_require_valid_range(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const char* const func_name,
+                                  const int line) {
+  const size_t bitarray_length = bitarray_get_bit_sz(test_bitarray);
+  if (bit_offset > bitarray_length || bit_length > bitarray_length - bit_offset) {
+    TEST_FAIL_WITH_NAME(func_name, line, " TEST SUITE ERROR - " \
+                        "bit_offset + bit_length > bitarray_length");
+  }
+}
+
+// Precomputed array of fibonacci numbers
+const int FIB_SIZE = 53;
+const double fibs[FIB_SIZE] = {1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144, 233, 377, 610, 987, 1597, 2584, 4181, 6765, 10946, 17711, 28657, 46368, 75025, 121393, 196418, 317811, 514229, 832040, 1346269, 2178309, 3524578, 5702887, 9227465, 14930352, 24157817, 39088169, 63245986, 102334155, 165580141, 267914296, 433494437, 701408733, 1134903170, 1836311903, 2971215073, 4807526976, 7778742049, 12586269025, 20365011074, 32951280099, 53316291173, 86267571272};
+
+// An operation that timed_operation can measure.  Each run acts on the
+// subarray [bit_offset, bit_offset + bit_length) of test_bitarray, after an
+// untimed setup over the same subarray (which may be NULL).  Query operations make `queries`
+// independent calls per run and report queries per second; the others report
+// GB/s over the subarray.  An operation far faster than its setup sets
+// `repeats` to run that many times per tier, which keeps the tiers it climbs
+// to small enough to set up; its rate counts every repetition.
+typedef struct {
+  const char* name;
+  void (*setup)(const size_t bit_offset, const size_t bit_length);
+  void (*run)(const size_t bit_offset,
+              const size_t bit_length,
+              const ssize_t bit_right_amount);
+  size_t queries;
+  size_t repeats;
+} timed_op_t;
+
+// The spread of a tier's trials, in seconds: their median, the median
+// absolute deviation from it, a distribution-free 95% confidence interval
+// for the median, and the coefficient of variation (standard deviation over
+// mean).
+typedef struct {
+  double median;
+  double mad;
+  double ci_low;
+  double ci_high;
+  double cv;
+} timed_stats_t;
+
+// Orders doubles, for qsort.
+static int timed_compare(const void* const a, const void* const b) {
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the median of n sorted samples.
+static double timed_median(const double* const sorted, const size_t n) {
+  return n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+// Summarizes n trial times, sorting them in place.
+static timed_stats_t timed_statistics(double* const samples, const size_t n) {
+  assert(n > 0 && n <= TIMED_MAX_TRIALS);
+  qsort(samples, n, sizeof(double), timed_compare);
+  timed_stats_t stats;
+  stats.median = timed_median(samples, n);
+
+  double deviations[TIMED_MAX_TRIALS];
+  double sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    deviations[i] = fabs(samples[i] - stats.median);
+    sum += samples[i];
+  }
+  qsort(deviations, n, sizeof(double), timed_compare);
+  stats.mad = timed_median(deviations, n);
+
+  const double mean = sum / n;
+  double squares = 0;
+  for (size_t i = 0; i < n; i++) {
+    squares += (samples[i] - mean) * (samples[i] - mean);
+  }
+  stats.cv = n > 1 && mean > 0 ? sqrt(squares / (n - 1)) / mean : 0;
+
+  // The number of samples below the median is binomial(n, 1/2), so the
+  // order statistics about 1.96 sqrt(n) / 2 ranks either side of it bound
+  // the median 95% of the time.  The ranks are from zero.
+  const double half_width = 1.96 * sqrt(n) / 2;
+  const double low_rank = floor(n / 2.0 - half_width) - 1;
+  const double high_rank = ceil(n / 2.0 + half_width);
+  stats.ci_low = samples[low_rank < 0 ? 0 : (size_t)low_rank];
+  stats.ci_high = samples[high_rank > n - 1 ? n - 1 : (size_t)high_rank];
+  return stats;
+}
+
+// Number of calls made by each run of a query operation.
+#define TIMED_QUERIES 100000
+
+// Number of times each run of a compressed-array operation is repeated.
+#define TIMED_EWAH_REPEATS 256
+
+// Number of times each run of a whole-array hybrid count is repeated.
+#define TIMED_HYBRID_REPEATS 4096
+
+// Threads the shared-bitmap benchmarks split their queries among.
+#define TIMED_THREADS 4
+
+// Number of snapshots taken and freed by each run of the snapshot benchmark.
+#define TIMED_SNAPSHOT_REPEATS 4096
+
+// The allocation benchmarks keep this many small bit arrays live at once,
+// each of up to TIMED_SMALL_BITS bits.
+#define TIMED_LIVE_ARRAYS 64
+#define TIMED_SMALL_BITS 512
+
+// The small-array access benchmarks spread their queries over this many bit
+// arrays of TIMED_SHORT_BITS bits, more than fit in cache.
+#define TIMED_SMALL_ARRAYS 65536
+#define TIMED_SHORT_BITS 200
+
+// Results of read-only operations are accumulated here so the compiler
+// cannot drop the call being timed.
+static volatile size_t timed_sink = 0;
+
+static void timed_op_rotate(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount) {
+  testutil_rotate(bit_offset, bit_length, bit_right_amount);
+}
+
+static void timed_op_count(const size_t bit_offset,
+                           const size_t bit_length,
+                           const ssize_t bit_right_amount) {
+  timed_sink += bitarray_count(test_bitarray, bit_offset, bit_length);
+}
+
+static void timed_op_fill(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  testutil_fill(bit_offset, bit_length, true);
+}
+
+static void timed_op_reverse(const size_t bit_offset,
+                             const size_t bit_length,
+                             const ssize_t bit_right_amount) {
+  testutil_reverse(bit_offset, bit_length);
+}
+
+static void timed_setup_rankselect(const size_t bit_offset, const size_t bit_length) {
+  test_rankselect = rankselect_new(test_bitarray);
+  assert(test_rankselect != NULL);
+}
+
+// Query positions are drawn from a xorshift generator so that each query
+// misses the cache the way independent lookups would.
+static void timed_op_rank(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  uint64_t x = 88172645463325252ULL;
+  size_t sum = 0;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += rankselect_rank(test_rankselect, bit_offset + x % bit_length);
+  }
+  timed_sink += sum;
+}
+
+static void timed_op_select(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount) {
+  const size_t ones = rankselect_get_ones(test_rankselect);
+  if (ones == 0) {
+    return;
+  }
+  uint64_t x = 88172645463325252ULL;
+  size_t sum = 0;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += rankselect_select(test_rankselect, x % ones);
+  }
+  timed_sink += sum;
+}
+
+// Scans are timed over a sparse array: one set bit per 64K, as in the
+// mostly-empty bitmaps they are meant for, unless a generator was chosen.
+static void timed_setup_sparse(const size_t bit_offset, const size_t bit_length) {
+  if (timed_fill.kind != FILL_UNIFORM) {
+    return;
+  }
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  bitarray_fill_range(test_bitarray, 0, bit_sz, false);
+  for (size_t i = 0; i < bit_sz; i += 65536) {
+    bitarray_set(test_bitarray, i, true);
+  }
+}
+
+static void timed_op_scan(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  bitarray_iter_t iter;
+  size_t i;
+  size_t sum = 0;
+  bitarray_iter_init(&iter, test_bitarray, bit_offset);
+  while (bitarray_iter_next(&iter, &i) && i < bit_offset + bit_length) {
+    sum += i;
+  }
+  timed_sink += sum;
+}
+
+// Logical operations take their second operand from a random array of the
+// same size, read at offset 0 so that it is generally misaligned with the
+// subarray.
+static void timed_setup_operand(const size_t bit_offset, const size_t bit_length) {
+  bitarray_free(test_operand);
+  test_operand = bitarray_new(bitarray_get_bit_sz(test_bitarray));
+  assert(test_operand != NULL);
+  fill_bits(test_operand, &timed_fill, ~bitarray_get_bit_sz(test_operand));
+}
+
+static void timed_op_and(const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount) {
+  bitarray_logic_range(test_bitarray, bit_offset, test_operand, 0, bit_length, BITARRAY_AND);
+}
+
+static void timed_op_andcount(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  timed_sink += bitarray_logic_count(test_bitarray, bit_offset, test_operand, 0,
+                                     bit_length, BITARRAY_AND);
+}
+
+// Makes test_operand a copy of test_bitarray, so that comparisons between
+// the two run the whole length.
+static void timed_setup_copy(const size_t bit_offset, const size_t bit_length) {
+  timed_setup_operand(bit_offset, bit_length);
+  bitarray_logic3(test_operand, test_bitarray, test_bitarray, BITARRAY_AND);
+}
+
+static void timed_op_equal(const size_t bit_offset,
+                           const size_t bit_length,
+                           const ssize_t bit_right_amount) {
+  timed_sink += bitarray_equal_range(test_bitarray, bit_offset,
+                                     test_operand, bit_offset, bit_length);
+}
+
+static void timed_op_hash(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  timed_sink += bitarray_hash_range(test_bitarray, bit_offset, bit_length);
+}
+
+// The serialization benchmarks write a copy of the subarray to a temporary
+// file, which the setup leaves holding it for the read and map benchmarks.
+static void timed_setup_file(const size_t bit_offset, const size_t bit_length) {
+  bitarray_free(timed_file_array);
+  timed_file_array = bitarray_new(bit_length);
+  assert(timed_file_array != NULL);
+  bitarray_logic3_range(timed_file_array, 0, test_bitarray, bit_offset, test_bitarray, bit_offset,
+                        bit_length, BITARRAY_AND);
+  if (timed_fd < 0) {
+    char path[] = "/tmp/everybit-XXXXXX";
+    timed_fd = mkstemp(path);
+    assert(timed_fd >= 0);
+    unlink(path);
+  }
+  const bool written = ftruncate(timed_fd, 0) == 0 &&
+                       lseek(timed_fd, 0, SEEK_SET) == 0 &&
+                       bitarray_write(timed_file_array, timed_fd);
+  assert(written);
+  timed_sink += written;
+}
+
+static void timed_op_write(const size_t bit_offset,
+                           const size_t bit_length,
+                           const ssize_t bit_right_amount) {
+  lseek(timed_fd, 0, SEEK_SET);
+  timed_sink += bitarray_write(timed_file_array, timed_fd);
+}
+
+static void timed_op_read(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_amount) {
+  lseek(timed_fd, 0, SEEK_SET);
+  bitarray_t* const bitarray = bitarray_read(timed_fd);
+  assert(bitarray != NULL);
+  timed_sink += bitarray_get_bit_sz(bitarray);
+  bitarray_free(bitarray);
+}
+
+// Maps the file and verifies its checksum, which pages in every word.
+static void timed_op_map(const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount) {
+  bitarray_t* const bitarray = bitarray_map(timed_fd, true);
+  assert(bitarray != NULL);
+  timed_sink += bitarray_get_bit_sz(bitarray);
+  bitarray_free(bitarray);
+}
+
+// The text benchmarks convert the subarray to '0'/'1' characters and back,
+// through a buffer the setup formats once.
+static void timed_setup_text(const size_t bit_offset, const size_t bit_length) {
+  free(timed_text);
+  timed_text = malloc(bit_length + 1);
+  assert(timed_text != NULL);
+  bitarray_to_string(test_bitarray, bit_offset, bit_length, timed_text);
+}
+
+static void timed_op_tostring(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  bitarray_to_string(test_bitarray, bit_offset, bit_length, timed_text);
+  timed_sink += timed_text[bit_length / 2];
+}
+
+static void timed_op_fromstring(const size_t bit_offset,
+                                const size_t bit_length,
+                                const ssize_t bit_right_amount) {
+  bitarray_t* const bitarray = bitarray_from_string(timed_text);
+  assert(bitarray != NULL);
+  timed_sink += bitarray_get_bit_sz(bitarray);
+  bitarray_free(bitarray);
+}
+
+// How the shared-bitmap benchmarks set bits: with the atomic test-and-set,
+// with the atomic fetch-or, or with bitarray_get and bitarray_set under a
+// lock.
+typedef enum {
+  TIMED_SHARED_ATOMIC,
+  TIMED_SHARED_FETCH_OR,
+  TIMED_SHARED_LOCKED
+} timed_shared_t;
+
+typedef struct {
+  timed_shared_t how;
+  size_t bit_offset;
+  size_t bit_length;
+  uint64_t seed;
+  size_t hits;
+} timed_shared_arg_t;
+
+static pthread_mutex_t timed_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* timed_shared_worker(void* const arg) {
+  timed_shared_arg_t* const shared = arg;
+  uint64_t x = shared->seed;
+  for (size_t i = 0; i < TIMED_QUERIES / TIMED_THREADS; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const size_t bit_index = shared->bit_offset + x % shared->bit_length;
+    switch (shared->how) {
+    case TIMED_SHARED_ATOMIC:
+      shared->hits += bitarray_atomic_test_and_set(test_bitarray, bit_index, BITARRAY_RELAXED);
+      break;
+    case TIMED_SHARED_FETCH_OR:
+      shared->hits += bitarray_atomic_fetch_or(test_bitarray, bit_index / 64,
+                                               1ULL << (bit_index % 64), BITARRAY_ACQ_REL) != 0;
+      break;
+    case TIMED_SHARED_LOCKED:
+      pthread_mutex_lock(&timed_lock);
+      shared->hits += bitarray_get(test_bitarray, bit_index);
+      bitarray_set(test_bitarray, bit_index, true);
+      pthread_mutex_unlock(&timed_lock);
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Sets TIMED_QUERIES random bits of the subarray from TIMED_THREADS threads
+// at once.
+static void timed_shared_set(const timed_shared_t how,
+                             const size_t bit_offset,
+                             const size_t bit_length) {
+  pthread_t workers[TIMED_THREADS];
+  timed_shared_arg_t args[TIMED_THREADS];
+  for (size_t t = 0; t < TIMED_THREADS; t++) {
+    args[t] = (timed_shared_arg_t) {.how = how, .bit_offset = bit_offset,
+                                    .bit_length = bit_length,
+                                    .seed = 88172645463325252ULL + t, .hits = 0};
+    const int created = pthread_create(&workers[t], NULL, timed_shared_worker, &args[t]);
+    assert(created == 0);
+    (void)created;
+  }
+  for (size_t t = 0; t < TIMED_THREADS; t++) {
+    pthread_join(workers[t], NULL);
+    timed_sink += args[t].hits;
+  }
+}
+
+static void timed_op_atomicset(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  timed_shared_set(TIMED_SHARED_ATOMIC, bit_offset, bit_length);
+}
+
+static void timed_op_atomicor(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  timed_shared_set(TIMED_SHARED_FETCH_OR, bit_offset, bit_length);
+}
+
+static void timed_op_lockedset(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  timed_shared_set(TIMED_SHARED_LOCKED, bit_offset, bit_length);
+}
+
+// The snapshot benchmarks work on a copy of the subarray.  The cowset setup
+// takes a snapshot of it for the timed sets to copy chunks out of, after
+// rehearsing those sets once on another snapshot to report how much of the
+// subarray they end up copying.
+static void timed_setup_cow_array(const size_t bit_offset, const size_t bit_length) {
+  bitarray_snapshot_free(timed_snapshot);
+  timed_snapshot = NULL;
+  bitarray_free(timed_cow_array);
+  timed_cow_array = bitarray_new(bit_length);
+  assert(timed_cow_array != NULL);
+  bitarray_logic3_range(timed_cow_array, 0, test_bitarray, bit_offset, test_bitarray, bit_offset,
+                        bit_length, BITARRAY_AND);
+}
+
+static void timed_op_set(const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount);
+
+static void timed_setup_cow(const size_t bit_offset, const size_t bit_length) {
+  if (timed_report_setup) {
+    timed_setup_cow_array(bit_offset, bit_length);
+    timed_snapshot = bitarray_snapshot(timed_cow_array);
+    assert(timed_snapshot != NULL);
+    timed_op_set(bit_offset, bit_length, 0);
+    printf("  %zu sets copied %zuKB of %zuKB\n", (size_t)TIMED_QUERIES,
+           bitarray_snapshot_get_space(timed_snapshot) / 1024, bit_length / (8 * 1024));
+  }
+  timed_setup_cow_array(bit_offset, bit_length);
+  timed_snapshot = bitarray_snapshot(timed_cow_array);
+  assert(timed_snapshot != NULL);
+}
+
+static void timed_op_snapshot(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  bitarray_snapshot_t* const snapshot = bitarray_snapshot(timed_cow_array);
+  assert(snapshot != NULL);
+  timed_sink += bitarray_snapshot_get_bit_sz(snapshot);
+  bitarray_snapshot_free(snapshot);
+}
+
+// Sets random bits of timed_cow_array, which copies chunks out for its
+// snapshot if it has one.
+static void timed_op_set(const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount) {
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    bitarray_set(timed_cow_array, x % bit_length, x >> 63);
+  }
+}
+
+// The arena allocation benchmark starts each tier on a new arena.
+static void timed_setup_arena(const size_t bit_offset, const size_t bit_length) {
+  bitarray_arena_free(timed_arena);
+  timed_arena = bitarray_arena_new();
+  assert(timed_arena != NULL);
+}
+
+// Allocates TIMED_QUERIES small bit arrays of random sizes, from arena if it
+// is not NULL and with bitarray_new otherwise, and sets a bit in each.  Each
+// replaces, and frees, the oldest of the last TIMED_LIVE_ARRAYS.
+static void timed_small_arrays(bitarray_arena_t* const arena) {
+  bitarray_t* live[TIMED_LIVE_ARRAYS] = {NULL};
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const size_t bit_sz = 1 + x % TIMED_SMALL_BITS;
+    bitarray_free(live[i % TIMED_LIVE_ARRAYS]);
+    bitarray_t* const bitarray = arena != NULL ? bitarray_arena_alloc(arena, bit_sz) :
+                                 bitarray_new(bit_sz);
+    assert(bitarray != NULL);
+    bitarray_set(bitarray, (x >> 32) % bit_sz, true);
+    live[i % TIMED_LIVE_ARRAYS] = bitarray;
+  }
+  for (size_t i = 0; i < TIMED_LIVE_ARRAYS; i++) {
+    timed_sink += bitarray_get_bit_sz(live[i]);
+    bitarray_free(live[i]);
+  }
+}
+
+static void timed_op_alloc(const size_t bit_offset,
+                           const size_t bit_length,
+                           const ssize_t bit_right_amount) {
+  timed_small_arrays(NULL);
+}
+
+static void timed_op_arenaalloc(const size_t bit_offset,
+                                const size_t bit_length,
+                                const ssize_t bit_right_amount) {
+  timed_small_arrays(timed_arena);
+}
+
+// Allocates the small bit arrays, with storage of their own outside the
+// struct if out_of_line, and fills them with random bits.  The subarray
+// plays no part.
+static void timed_setup_small(const size_t bit_offset,
+                              const size_t bit_length,
+                              const bool out_of_line) {
+  if (timed_small == NULL) {
+    timed_small = calloc(TIMED_SMALL_ARRAYS, sizeof(bitarray_t*));
+    assert(timed_small != NULL);
+  }
+  for (size_t i = 0; i < TIMED_SMALL_ARRAYS; i++) {
+    bitarray_free(timed_small[i]);
+    timed_small[i] = bitarray_new(TIMED_SHORT_BITS);
+    assert(timed_small[i] != NULL);
+    if (out_of_line) {
+      const bool reserved = bitarray_reserve(timed_small[i],
+                                             bitarray_get_capacity(timed_small[i]) + 1);
+      assert(reserved);
+      (void)reserved;
+    }
+    bitarray_randfill(timed_small[i], i);
+  }
+}
+
+static void timed_setup_small_inline(const size_t bit_offset, const size_t bit_length) {
+  timed_setup_small(bit_offset, bit_length, false);
+}
+
+static void timed_setup_small_heap(const size_t bit_offset, const size_t bit_length) {
+  timed_setup_small(bit_offset, bit_length, true);
+}
+
+// Reads and then writes a random bit of a random small bit array, per query.
+static void timed_op_smallget(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  uint64_t x = 88172645463325252ULL;
+  size_t hits = 0;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    bitarray_t* const bitarray = timed_small[x % TIMED_SMALL_ARRAYS];
+    const size_t bit_index = (x >> 32) % TIMED_SHORT_BITS;
+    hits += bitarray_get(bitarray, bit_index);
+    bitarray_set(bitarray, bit_index, x >> 63);
+  }
+  timed_sink += hits;
+}
+
+// Refills a copy of the subarray with random bits.
+static void timed_op_randfill(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  bitarray_randfill(timed_cow_array, bit_length);
+  timed_sink += bitarray_get(timed_cow_array, bit_length / 2);
+}
+
+// Transposes a matrix with about as many rows as columns, a multiple of 64
+// wide, out of test_bitarray into test_operand.
+static void timed_op_transpose(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  size_t cols = 64;
+  while (cols * cols * 4 <= bit_length) {
+    cols *= 2;
+  }
+  const size_t rows = bit_length / cols;
+  bitmatrix_t* const src = bitmatrix_new(test_bitarray, bit_offset, rows, cols);
+  bitmatrix_t* const dst = bitmatrix_new(test_operand, 0, cols, rows);
+  assert(src != NULL && dst != NULL);
+  bitmatrix_transpose(dst, src);
+  bitmatrix_free(src);
+  bitmatrix_free(dst);
+}
+
+// Bits appended per call by the append benchmark, deliberately not a
+// multiple of 64 so that most runs are spliced across words.
+#define TIMED_APPEND_BITS (4096 * 64 - 3)
+
+// Builds a bit_length-bit array from empty by appending runs of
+// TIMED_APPEND_BITS bits, letting it grow as it goes.
+static void timed_op_append(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount) {
+  static uint64_t words[TIMED_APPEND_BITS / 64 + 1];
+  uint64_t x = 88172645463325252ULL;
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    words[i] = x;
+  }
+
+  bitarray_t* const bitarray = bitarray_new(0);
+  assert(bitarray != NULL);
+  for (size_t done = 0; done < bit_length; done += TIMED_APPEND_BITS) {
+    const size_t n = bit_length - done < TIMED_APPEND_BITS ?
+                     bit_length - done : TIMED_APPEND_BITS;
+    if (!bitarray_append_bits(bitarray, words, n)) {
+      TEST_FAIL(" Could not grow the bit array");
+      break;
+    }
+  }
+  timed_sink += bitarray_get_bit_sz(bitarray);
+  bitarray_free(bitarray);
+}
+
+// The compressed-array benchmarks run over a sparse subarray and a sparse
+// operand whose set bits half coincide with it, compressed in the untimed
+// setup.  Their packed counterparts run over the same subarray, so the
+// packed and compressed rates compare directly; the setup reports the space
+// each form takes.
+static void timed_setup_ewah(const size_t bit_offset, const size_t bit_length) {
+  timed_setup_sparse(bit_offset, bit_length);
+  timed_setup_operand(bit_offset, bit_length);
+  bitarray_fill_range(test_operand, 0, bitarray_get_bit_sz(test_operand), false);
+  for (size_t i = 0; i < bit_length; i += 32768) {
+    bitarray_set(test_operand, i, true);
+  }
+
+  // Compress exactly the bit_length bits the packed forms are timed over.
+  bitarray_t* const subarray = bitarray_new(bit_length);
+  bitarray_t* const operand = bitarray_new(bit_length);
+  assert(subarray != NULL && operand != NULL);
+  bitarray_logic3_range(subarray, 0, test_bitarray, bit_offset, test_bitarray, bit_offset,
+                        bit_length, BITARRAY_AND);
+  bitarray_logic3_range(operand, 0, test_operand, 0, test_operand, 0,
+                        bit_length, BITARRAY_AND);
+  ewah_free(timed_ewah);
+  ewah_free(timed_ewah_operand);
+  timed_ewah = ewah_from_bitarray(subarray);
+  timed_ewah_operand = ewah_from_bitarray(operand);
+  assert(timed_ewah != NULL && timed_ewah_operand != NULL);
+  bitarray_free(subarray);
+  bitarray_free(operand);
+  if (timed_report_setup) {
+    printf("Space: packed %zu bytes, compressed %zu bytes\n",
+           bit_length / 8, ewah_get_space(timed_ewah));
+  }
+}
+
+static void timed_op_sparsecount(const size_t bit_offset,
+                                 const size_t bit_length,
+                                 const ssize_t bit_right_amount) {
+  timed_sink += bitarray_count(test_bitarray, bit_offset, bit_length);
+}
+
+static void timed_op_ewahcount(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  timed_sink += ewah_count(timed_ewah);
+}
+
+static void timed_op_sparseand(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  bitarray_logic_range(test_bitarray, bit_offset, test_operand, 0, bit_length, BITARRAY_AND);
+}
+
+static void timed_op_ewahand(const size_t bit_offset,
+                             const size_t bit_length,
+                             const ssize_t bit_right_amount) {
+  ewah_t* const result = ewah_logic(timed_ewah, timed_ewah_operand, BITARRAY_AND);
+  assert(result != NULL);
+  timed_sink += ewah_get_space(result);
+  ewah_free(result);
+}
+
+static void timed_op_sparseor(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  bitarray_logic_range(test_bitarray, bit_offset, test_operand, 0, bit_length, BITARRAY_OR);
+}
+
+static void timed_op_ewahor(const size_t bit_offset,
+                            const size_t bit_length,
+                            const ssize_t bit_right_amount) {
+  ewah_t* const result = ewah_logic(timed_ewah, timed_ewah_operand, BITARRAY_OR);
+  assert(result != NULL);
+  timed_sink += ewah_get_space(result);
+  ewah_free(result);
+}
+
+static void timed_op_sparserotate(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const ssize_t bit_right_amount) {
+  bitarray_rotate(test_bitarray, bit_offset, bit_length, bit_right_amount);
+}
+
+static void timed_op_ewahrotate(const size_t bit_offset,
+                                const size_t bit_length,
+                                const ssize_t bit_right_amount) {
+  const bool rotated = ewah_rotate(timed_ewah, 0, bit_length, bit_right_amount);
+  timed_sink += rotated;
+}
+
+// The hybrid-array benchmarks run over a subarray and an operand made of
+// mixed regions, converted in the untimed setup, next to their packed
+// counterparts over the same subarray.  The setup reports the space the
+// packed, EWAH and hybrid forms take.
+static void timed_setup_hybrid(const size_t bit_offset, const size_t bit_length) {
+  timed_setup_operand(bit_offset, bit_length);
+  mixedfill(test_bitarray, bit_offset, bit_length, 6172);
+  mixedfill(test_operand, 0, bit_length, ~6172U);
+
+  // Convert exactly the bit_length bits the packed forms are timed over.
+  bitarray_t* const subarray = bitarray_new(bit_length);
+  bitarray_t* const operand = bitarray_new(bit_length);
+  assert(subarray != NULL && operand != NULL);
+  bitarray_logic3_range(subarray, 0, test_bitarray, bit_offset, test_bitarray, bit_offset,
+                        bit_length, BITARRAY_AND);
+  bitarray_logic3_range(operand, 0, test_operand, 0, test_operand, 0,
+                        bit_length, BITARRAY_AND);
+  hybrid_free(timed_hybrid);
+  hybrid_free(timed_hybrid_operand);
+  timed_hybrid = hybrid_from_bitarray(subarray);
+  timed_hybrid_operand = hybrid_from_bitarray(operand);
+  ewah_t* const ewah = ewah_from_bitarray(subarray);
+  assert(timed_hybrid != NULL && timed_hybrid_operand != NULL && ewah != NULL);
+  if (timed_report_setup) {
+    printf("Space: packed %zu bytes, EWAH %zu bytes, hybrid %zu bytes\n",
+           bit_length / 8, ewah_get_space(ewah), hybrid_get_space(timed_hybrid));
+  }
+  ewah_free(ewah);
+  bitarray_free(subarray);
+  bitarray_free(operand);
+}
+
+static void timed_op_mixedget(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  uint64_t x = 88172645463325252ULL;
+  size_t sum = 0;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += bitarray_get(test_bitarray, bit_offset + x % bit_length);
+  }
+  timed_sink += sum;
+}
+
+static void timed_op_hybridget(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  uint64_t x = 88172645463325252ULL;
+  size_t sum = 0;
+  for (size_t i = 0; i < TIMED_QUERIES; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sum += hybrid_get(timed_hybrid, x % bit_length);
+  }
+  timed_sink += sum;
+}
+
+static void timed_op_mixedcount(const size_t bit_offset,
+                                const size_t bit_length,
+                                const ssize_t bit_right_amount) {
+  timed_sink += bitarray_count(test_bitarray, bit_offset, bit_length);
+}
+
+static void timed_op_hybridcount(const size_t bit_offset,
+                                 const size_t bit_length,
+                                 const ssize_t bit_right_amount) {
+  timed_sink += hybrid_count(timed_hybrid, 0, bit_length);
+}
+
+static void timed_op_mixedand(const size_t bit_offset,
+                              const size_t bit_length,
+                              const ssize_t bit_right_amount) {
+  bitarray_logic_range(test_bitarray, bit_offset, test_operand, 0, bit_length, BITARRAY_AND);
+}
+
+static void timed_op_hybridand(const size_t bit_offset,
+                               const size_t bit_length,
+                               const ssize_t bit_right_amount) {
+  hybrid_t* const result = hybrid_logic(timed_hybrid, timed_hybrid_operand, BITARRAY_AND);
+  assert(result != NULL);
+  timed_sink += hybrid_get_space(result);
+  hybrid_free(result);
+}
+
+static void timed_op_mixedrotate(const size_t bit_offset,
+                                 const size_t bit_length,
+                                 const ssize_t bit_right_amount) {
+  bitarray_rotate(test_bitarray, bit_offset, bit_length, bit_right_amount);
+}
+
+static void timed_op_hybridrotate(const size_t bit_offset,
+                                  const size_t bit_length,
+                                  const ssize_t bit_right_amount) {
+  const bool rotated = hybrid_rotate(timed_hybrid, 0, bit_length, bit_right_amount);
+  timed_sink += rotated;
+}
+
+static const timed_op_t timed_ops[] = {
+  {"rotate", NULL, timed_op_rotate, 0},
+  {"count", NULL, timed_op_count, 0},
+  {"fill", NULL, timed_op_fill, 0},
+  {"reverse", NULL, timed_op_reverse, 0},
+  {"rank", timed_setup_rankselect, timed_op_rank, TIMED_QUERIES},
+  {"select", timed_setup_rankselect, timed_op_select, TIMED_QUERIES},
+  {"scan", timed_setup_sparse, timed_op_scan, 0},
+  {"and", timed_setup_operand, timed_op_and, 0},
+  {"andcount", timed_setup_operand, timed_op_andcount, 0},
+  {"equal", timed_setup_copy, timed_op_equal, 0},
+  {"hash", NULL, timed_op_hash, 0},
+  {"transpose", timed_setup_operand, timed_op_transpose, 0},
+  {"append", NULL, timed_op_append, 0},
+  {"write", timed_setup_file, timed_op_write, 0},
+  {"read", timed_setup_file, timed_op_read, 0},
+  {"map", timed_setup_file, timed_op_map, 0},
+  {"tostring", timed_setup_text, timed_op_tostring, 0},
+  {"fromstring", timed_setup_text, timed_op_fromstring, 0},
+  {"atomicset", NULL, timed_op_atomicset, TIMED_QUERIES},
+  {"atomicor", NULL, timed_op_atomicor, TIMED_QUERIES},
+  {"lockedset", NULL, timed_op_lockedset, TIMED_QUERIES},
+  {"snapshot", timed_setup_cow_array, timed_op_snapshot, 0, TIMED_SNAPSHOT_REPEATS},
+  {"set", timed_setup_cow_array, timed_op_set, TIMED_QUERIES},
+  {"cowset", timed_setup_cow, timed_op_set, TIMED_QUERIES},
+  {"alloc", NULL, timed_op_alloc, TIMED_QUERIES},
+  {"arenaalloc", timed_setup_arena, timed_op_arenaalloc, TIMED_QUERIES},
+  {"randfill", timed_setup_cow_array, timed_op_randfill, 0},
+  {"smallget", timed_setup_small_inline, timed_op_smallget, TIMED_QUERIES},
+  {"heapget", timed_setup_small_heap, timed_op_smallget, TIMED_QUERIES},
+  {"sparsecount", timed_setup_ewah, timed_op_sparsecount, 0},
+  {"ewahcount", timed_setup_ewah, timed_op_ewahcount, 0, TIMED_EWAH_REPEATS},
+  {"sparseand", timed_setup_ewah, timed_op_sparseand, 0},
+  {"ewahand", timed_setup_ewah, timed_op_ewahand, 0, TIMED_EWAH_REPEATS},
+  {"sparseor", timed_setup_ewah, timed_op_sparseor, 0},
+  {"ewahor", timed_setup_ewah, timed_op_ewahor, 0, TIMED_EWAH_REPEATS},
+  {"sparserotate", timed_setup_ewah, timed_op_sparserotate, 0},
+  {"ewahrotate", timed_setup_ewah, timed_op_ewahrotate, 0, TIMED_EWAH_REPEATS},
+  {"mixedget", timed_setup_hybrid, timed_op_mixedget, TIMED_QUERIES},
+  {"hybridget", timed_setup_hybrid, timed_op_hybridget, TIMED_QUERIES},
+  {"mixedcount", timed_setup_hybrid, timed_op_mixedcount, 0},
+  {"hybridcount", timed_setup_hybrid, timed_op_hybridcount, 0, TIMED_HYBRID_REPEATS},
+  {"mixedand", timed_setup_hybrid, timed_op_mixedand, 0},
+  {"hybridand", timed_setup_hybrid, timed_op_hybridand, 0},
+  {"mixedrotate", timed_setup_hybrid, timed_op_mixedrotate, 0},
+  {"hybridrotate", timed_setup_hybrid, timed_op_hybridrotate, 0},
+};
+
+// Prints the mean counts over a tier's trials of the events that could be
+// counted, and the instructions per cycle if both were.
+static void timed_print_counts(const ktiming_counts_t* const sums, const size_t trials) {
+  printf("        per trial:");
+  const char* separator = " ";
+  for (int event = 0; event < KTIMING_NEVENTS; event++) {
+    if (sums->counted[event]) {
+      printf("%s%s %.4g", separator, ktiming_event_name(event),
+             (double)sums->count[event] / trials);
+      separator = ", ";
+    }
+  }
+  if (sums->counted[KTIMING_EVENT_CYCLES] && sums->counted[KTIMING_EVENT_INSTRUCTIONS] &&
+      sums->count[KTIMING_EVENT_CYCLES] > 0) {
+    printf(", IPC %.2f", (double)sums->count[KTIMING_EVENT_INSTRUCTIONS] /
+           sums->count[KTIMING_EVENT_CYCLES]);
+  }
+  printf("\n");
+}
+
+bool timed_count_events(void) {
+  timed_counting = ktiming_counters_open() > 0;
+  return timed_counting;
+}
+
+bool timed_set_trials(const size_t trials) {
+  if (trials == 0 || trials > TIMED_MAX_TRIALS) {
+    return false;
+  }
+  timed_trials = trials;
+  return true;
+}
+
+size_t timed_get_trials(void) {
+  return timed_trials;
+}
+
+int timed_rotation(const double time_limit_seconds) {
+  return timed_operation("rotate", time_limit_seconds);
+}
+
+int timed_operation(const char* const op_name, const double time_limit_seconds) {
+  const timed_op_t* op = NULL;
+  for (size_t i = 0; i < sizeof(timed_ops) / sizeof(timed_ops[0]); i++) {
+    if (strcmp(timed_ops[i].name, op_name) == 0) {
+      op = &timed_ops[i];
+    }
+  }
+  if (op == NULL) {
+    fprintf(stderr, "Unknown operation %s\n", op_name);
+    return -1;
+  }
+
+  // We're going to be doing a bunch of operations; we probably shouldn't
+  // let the user see all the verbose output.
+  test_verbose = false;
+
+  // Continue until the operation exceeds time_limits_seconds
+  int tier_num = 0;
+  while(tier_num + 3 < FIB_SIZE){
+    const size_t bit_offset             = fibs[tier_num];
+    const size_t bit_right_shift_amount = fibs[tier_num+1];
+    const size_t bit_length             = fibs[tier_num+2];
+    const size_t bit_sz                 = fibs[tier_num+3];
+    assert(bit_sz > bit_length);
+    assert(bit_length > bit_right_shift_amount);
+    assert(bit_right_shift_amount > bit_offset);
+    assert(bit_sz > bit_offset + bit_length);
+
+    // Time the operation over several trials, each on a freshly set up bit
+    // array, and judge the tier on their median.  Wall and process CPU time
+    // are taken alongside the selected clock, for comparison.
+    const size_t repeats = op->repeats > 0 ? op->repeats : 1;
+    double samples[TIMED_MAX_TRIALS];
+    double wall_samples[TIMED_MAX_TRIALS];
+    double cpu_samples[TIMED_MAX_TRIALS];
+    ktiming_counts_t count_sums;
+    memset(&count_sums, 0, sizeof(count_sums));
+    for (size_t t = 0; t < timed_trials; t++) {
+      // Initialize a new bit_array, from the generator asked for.
+      testutil_newrand(bit_sz, 6172);
+      if (timed_fill.kind != FILL_UNIFORM) {
+        fill_bits(test_bitarray, &timed_fill, 6172);
+      }
+      if (op->setup != NULL) {
+        timed_report_setup = t == 0 && !results_active();
+        op->setup(bit_offset, bit_length);
+      }
+
+      // Time the duration of the operation
+      if (timed_counting) {
+        ktiming_counters_start();
+      }
+      const clockmark_t start_wall = ktiming_getmark_clock(KTIMING_WALL);
+      const clockmark_t start_cpu = ktiming_getmark_clock(KTIMING_CPU);
+      const clockmark_t start_time = ktiming_getmark();
+      for (size_t r = 0; r < repeats; r++) {
+        op->run(bit_offset, bit_length, bit_right_shift_amount);
+      }
+      const clockmark_t end_time = ktiming_getmark();
+      const clockmark_t end_cpu = ktiming_getmark_clock(KTIMING_CPU);
+      const clockmark_t end_wall = ktiming_getmark_clock(KTIMING_WALL);
+      if (timed_counting) {
+        ktiming_counts_t counts;
+        ktiming_counters_stop(&counts);
+        for (int event = 0; event < KTIMING_NEVENTS; event++) {
+          count_sums.count[event] += counts.count[event];
+          count_sums.counted[event] = counts.counted[event];
+        }
+      }
+      samples[t] = ktiming_diff_usec(&start_time, &end_time) / 1000000000.0;
+      wall_samples[t] = ktiming_diff_usec(&start_wall, &end_wall) / 1000000000.0;
+      cpu_samples[t] = ktiming_diff_usec(&start_cpu, &end_cpu) / 1000000000.0;
+    }
+    const timed_stats_t stats = timed_statistics(samples, timed_trials);
+    const timed_stats_t wall_stats = timed_statistics(wall_samples, timed_trials);
+    const timed_stats_t cpu_stats = timed_statistics(cpu_samples, timed_trials);
+    const double diff_seconds = stats.median;
+
+    const char* const unit = op->queries > 0 ? "Mq/s" : "GB/s";
+    double rate_value = 0;
+    if (diff_seconds > 0) {
+      rate_value = op->queries > 0
+          ? op->queries / diff_seconds / 1e6
+          : (double)repeats * (bit_length / 8) / diff_seconds / 1e9;
+    }
+
+    if (results_active()) {
+      // Records carry the mean counts of a trial.
+      ktiming_counts_t per_trial = count_sums;
+      for (int event = 0; event < KTIMING_NEVENTS; event++) {
+        per_trial.count[event] /= timed_trials;
+      }
+      const results_record_t record = {
+        op->name, tier_num, bit_length / 8, bit_right_shift_amount,
+        diff_seconds, stats.ci_low, stats.ci_high, wall_stats.median, cpu_stats.median,
+        rate_value, unit, diff_seconds < time_limit_seconds,
+        timed_counting ? &per_trial : NULL
+      };
+      results_write(&record);
+      if (diff_seconds >= time_limit_seconds) {
+        return tier_num - 1;
+      }
+      tier_num++;
+      continue;
+    }
+
+    char rate[32];
+    if (diff_seconds <= 0) {
+      sprintf(rate, "-");
+    } else {
+      sprintf(rate, "%.2f %s", rate_value, unit);
+    }
+
+    //char *str_size = NULL;
+    char buf[20];
+    if (bit_length < 8*1024){
+        sprintf(buf, "%luB", bit_length / 8);
+    } else if (bit_length < 8 * 1024 * 1024){
+        sprintf(buf, "%luKB", bit_length / (8 * 1024));
+    } else if (bit_length < 8UL * 1024 * 1024 * 1024){
+        sprintf(buf, "%luMB", bit_length / (8 * 1024 * 1024));
+    } else {
+        sprintf(buf, "%luGB", bit_length / (8UL * 1024 * 1024 * 1024));
+    }
+    if (diff_seconds < time_limit_seconds){
+      printf("Tier %d (≈%s) completed in " ANSI_COLOR_GREEN "%.6fs" ANSI_COLOR_RESET
+             " (%s)\n",
+        tier_num, buf, diff_seconds, rate);
+    } else {
+      printf("Tier %d (≈%s) exceeded %.2fs cutoff with time" ANSI_COLOR_RED " %.6fs" ANSI_COLOR_RESET
+             " (%s)\n",
+         tier_num, buf, time_limit_seconds, diff_seconds, rate);
+    }
+    printf("        %s clock; wall %.6fs, cpu %.6fs\n",
+           ktiming_clock_name(ktiming_get_clock()), wall_stats.median, cpu_stats.median);
+    if (timed_counting) {
+      timed_print_counts(&count_sums, timed_trials);
+    }
+    if (timed_trials > 1) {
+      printf("        median of %zu trials, MAD %.6fs, 95%% CI [%.6fs, %.6fs]\n",
+             timed_trials, stats.mad, stats.ci_low, stats.ci_high);
+      if (stats.cv > TIMED_NOISY_CV &&
+          stats.median >= TIMED_NOISY_FLOOR * time_limit_seconds) {
+        printf(ANSI_COLOR_YELLOW "        warning: noisy timing, coefficient of variation"
+               " %.1f%%" ANSI_COLOR_RESET "\n", stats.cv * 100);
+      }
+    }
+    if (diff_seconds >= time_limit_seconds) {
+      // Return the last tier that was succesful.
+      return tier_num - 1;
+    }
+    tier_num++;
+  }
+
+  // Return the last tier that was succesful.
+  return tier_num - 1;
+}
+
+static bitarray_logic_t logicfromstr(const char* const name) {
+  if (strcmp(name, "and") == 0) {
+    return BITARRAY_AND;
+  } else if (strcmp(name, "or") == 0) {
+    return BITARRAY_OR;
+  } else if (strcmp(name, "xor") == 0) {
+    return BITARRAY_XOR;
+  }
+  assert(strcmp(name, "andnot") == 0);
+  return BITARRAY_ANDNOT;
+}
+
+static bitview_t testutil_view(void) {
+  return test_view_active ? test_view : bitview_of(test_bitarray);
+}
+
+static bool boolfromchar(const char c) {
+  assert(c == '0' || c == '1');
+  return c == '1';
+}
+
+char* next_arg_char() {
+  char* buf = strtok(NULL, " ");
+  char* eol = NULL;
+  if ((eol = strchr(buf, '\n')) != NULL) {
+    *eol = '\0';
+  }
+  return buf;
 }
 
 void parse_and_run_tests(const char* filename, int selected_test) {
@@ -390,6 +2760,336 @@ void parse_and_run_tests(const char* filename, int selected_test) {
         testutil_rotate(offset, length, amount);
       }
       break;
+    case 'f':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        bool value = NEXT_ARG_LONG() != 0;
+        testutil_require_valid_input(offset, length, 0, filename, line);
+        testutil_fill(offset, length, value);
+      }
+      break;
+    case 'v':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_input(offset, length, 0, filename, line);
+        testutil_reverse(offset, length);
+      }
+      break;
+    case 'c':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_input(offset, length, 0, filename, line);
+        testutil_expect_count(offset, length, expected, filename, line);
+      }
+      break;
+    case 'k':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t index = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_rank(index, expected, filename, line);
+      }
+      break;
+    case 's':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t k = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_select(k, expected, filename, line);
+      }
+      break;
+    case 'x':
+    case 'z':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t index = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_find(index, token[0] == 'x', expected, filename, line);
+      }
+      break;
+    case 'm':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_operand_frmstr(next_arg_char());
+      break;
+    case 'l':
+    case 'y':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        bitarray_logic_t op = logicfromstr(strtok(NULL, " "));
+        size_t dst_offset = (size_t) NEXT_ARG_LONG();
+        size_t src_offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(dst_offset, length, filename, line);
+        testutil_logic(op, token[0] == 'y', dst_offset, src_offset, length);
+      }
+      break;
+    case 'p':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        bitarray_logic_t op = logicfromstr(strtok(NULL, " "));
+        size_t a_offset = (size_t) NEXT_ARG_LONG();
+        size_t b_offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_logic_count(op, a_offset, b_offset, length, expected,
+                                    filename, line);
+      }
+      break;
+    case 'o':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t src_offset = (size_t) NEXT_ARG_LONG();
+        size_t dst_offset = (size_t) NEXT_ARG_LONG();
+        size_t rows = (size_t) NEXT_ARG_LONG();
+        size_t cols = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(src_offset, rows * cols, filename, line);
+        testutil_require_valid_range(dst_offset, rows * cols, filename, line);
+        testutil_transpose(src_offset, dst_offset, rows, cols);
+      }
+      break;
+    case 'u':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t src_offset = (size_t) NEXT_ARG_LONG();
+        size_t rows = (size_t) NEXT_ARG_LONG();
+        size_t cols = (size_t) NEXT_ARG_LONG();
+        size_t col = (size_t) NEXT_ARG_LONG();
+        size_t dst_offset = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(src_offset, rows * cols, filename, line);
+        testutil_require_valid_range(dst_offset, rows, filename, line);
+        testutil_get_column(src_offset, rows, cols, col, dst_offset);
+      }
+      break;
+    case 'a':
+    case 'b':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        const bool packed = token[0] == 'b';
+        char* bits = next_arg_char();
+        testutil_append(bits, packed);
+      }
+      break;
+    case 'j':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t bit_sz = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(0, bit_sz, filename, line);
+        testutil_truncate(bit_sz);
+      }
+      break;
+    case 'w':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_input(offset, length, 0, filename, line);
+        testutil_window(offset, length);
+      }
+      break;
+    case 'g':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        ssize_t amount = (ssize_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(offset, length, filename, line);
+        testutil_ewah_rotate(offset, length, amount);
+      }
+      break;
+    case 'd':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_ewah_logic(logicfromstr(next_arg_char()), filename, line);
+      break;
+    case 'h':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_ewah_count(expected, filename, line);
+      }
+      break;
+    case 'U':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t bit_sz = (size_t) NEXT_ARG_LONG();
+        unsigned int seed = (unsigned int) NEXT_ARG_LONG();
+        testutil_newrand(bit_sz, seed);
+      }
+      break;
+    case 'G':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        char* spec = next_arg_char();
+        uint64_t seed = (uint64_t) NEXT_ARG_LONG();
+        testutil_fill_spec(spec, seed, filename, line);
+      }
+      break;
+    case 'D':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_expect_fill(next_arg_char(), filename, line);
+      break;
+    case 'M':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t bit_sz = (size_t) NEXT_ARG_LONG();
+        unsigned int seed = (unsigned int) NEXT_ARG_LONG();
+        testutil_newmixed(bit_sz, seed);
+      }
+      break;
+    case 'R':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        ssize_t amount = (ssize_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(offset, length, filename, line);
+        testutil_hybrid_rotate(offset, length, amount, filename, line);
+      }
+      break;
+    case 'L':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_hybrid_logic(logicfromstr(next_arg_char()), filename, line);
+      break;
+    case 'S':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        bool value = NEXT_ARG_LONG() != 0;
+        testutil_require_valid_range(offset, length, filename, line);
+        testutil_hybrid_set(offset, length, value, filename, line);
+      }
+      break;
+    case 'C':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_require_valid_range(offset, length, filename, line);
+        testutil_expect_hybrid_count(offset, length, expected, filename, line);
+      }
+      break;
+    case 'W':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_roundtrip(filename, line);
+      break;
+    case 'A':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_atomic_stress((size_t) NEXT_ARG_LONG(), filename, line);
+      break;
+    case 'N':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_arena();
+      break;
+    case 'P':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_snapshot();
+      break;
+    case 'V':
+      if (!ready_to_run) {
+        continue;
+      }
+      testutil_expect_snapshot(filename, line);
+      break;
+    case 'T':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        char* expected = next_arg_char();
+        testutil_require_valid_range(offset, strlen(expected), filename, line);
+        testutil_expect_text(offset, expected, filename, line);
+      }
+      break;
+    case 'q':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t a_offset = (size_t) NEXT_ARG_LONG();
+        size_t b_offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        int expected = (int) NEXT_ARG_LONG();
+        testutil_expect_compare(a_offset, b_offset, length, expected,
+                                filename, line);
+      }
+      break;
+    case 'i':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t index = (size_t) NEXT_ARG_LONG();
+        size_t expected = (size_t) NEXT_ARG_LONG();
+        testutil_expect_iter(index, expected, filename, line);
+      }
+      break;
     default:
       fprintf(stderr, "Unknown command %s", buf);
     }
@@ -38,6 +38,38 @@
 // than time_limit_seconds to complete.
 int timed_rotation(const double time_limit_seconds);
 
+// Like timed_rotation, but times the named operation ("rotate", "count",
+// "and", ...; see timed_ops in tests.c) on the same tier shapes and reports
+// its throughput in GB/s, or in queries per second for query operations.
+// Tiers are timed on the clock ktiming_set_clock selects, with the wall and
+// process CPU times reported beside it.  While results_begin has records
+// being written, each tier is written as a record instead of text.  Returns
+// -1 if op_name is not a known operation.
+int timed_operation(const char* const op_name, const double time_limit_seconds);
+
+// Sets the number of trials timed_operation times each tier over, 5 unless
+// set.  A tier passes or fails on the median trial; timed_operation reports
+// the median absolute deviation and a 95% confidence interval for the median
+// alongside it, and warns when the trials vary by more than 10%.  Returns
+// false, leaving the number unchanged, unless 1 <= trials <= 1000.
+bool timed_set_trials(const size_t trials);
+
+// Returns the number of trials timed_operation times each tier over.
+size_t timed_get_trials(void);
+
+// Makes timed_operation count hardware events (see ktiming_counters_open)
+// around each trial and print their mean per trial under each tier.
+// Returns false, counting nothing, if no event can be counted here.
+bool timed_count_events(void);
+
+// Makes the timed operations fill their bit arrays from the generator spec
+// names, in place of uniform random bits: "uniform", "density:p" for bits
+// set with probability p, "runs:mean" for runs of mean length mean,
+// "periodic:period" for a random pattern of period bits repeated, or
+// "adversarial" for one bit set per word.  Returns false if spec is not
+// one of those.
+bool timed_select_fill(const char* const spec);
+
 
 // Runs the testsuite specified in a given file.
 void parse_and_run_tests(const char* filename, int min_test);